@@ -13,6 +13,11 @@ Abstract:
 #include "BufferPool.hpp"
 #include "BufferPool.tmh"
 
+// Upper bound on the number of distinct start offsets handed out when cache coloring
+// is enabled. Each color is one color stride (a cache line, or the buffer alignment
+// if larger) apart.
+#define BUFFER_POOL_MAX_COLORS 8
+
 class RtlMdl
 {
 public:
@@ -104,6 +109,8 @@ NxBufferPool::Initialize(
     _In_ size_t AllocateSize,
     _In_ size_t AlignmentOffset,
     _In_ size_t Alignment,
+    _In_ bool EnableCacheColoring,
+    _In_ bool TrackHoldTime,
     _Out_ size_t* TotalSizeRequested,
     _Out_ size_t* MinimumChunkSize)
 {
@@ -114,11 +121,26 @@ NxBufferPool::Initialize(
     m_Alignment = Alignment;
     //store total pool size
     m_RequestedPoolSize = PoolSize;
+    //hold times cost a timestamp per allocation and free, only take them
+    //when the owner reports counters
+    m_TrackHoldTime = TrackHoldTime;
 
     //1. calculate the total size of one buffer element (including the alignment)
     m_StrideSize = ALIGN_UP_BY(AllocateSize, Alignment);
     CX_RETURN_NTSTATUS_IF(STATUS_INTEGER_OVERFLOW, m_StrideSize < AllocateSize);
 
+    //1.a if requested, stagger the start of consecutive buffers by a multiple of the
+    //cache line size so the headers of a burst of buffers do not all land on the same
+    //cache sets. The color offsets live in the slack between AllocateSize and the stride,
+    //growing the stride if the natural slack cannot hold enough colors
+    m_NumColors = 1;
+    m_ColorStride = 0;
+    m_MaxColorOffset = 0;
+
+    if (EnableCacheColoring)
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS(InitializeCacheColoring(AllocateSize));
+    }
 
     //2. calculate the total size of memory needed to populate the entire pool
     //Buffer Manage only allows alignment value < PAGE_SIZE and grantuates the memory chunck it
@@ -149,6 +171,41 @@ NxBufferPool::Initialize(
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+NxBufferPool::InitializeCacheColoring(
+    _In_ size_t AllocateSize)
+{
+    m_ColorStride = max(m_Alignment, (size_t) SYSTEM_CACHE_ALIGNMENT_SIZE);
+
+    //coloring with page sized strides does not change the cache set of a buffer
+    if (m_ColorStride >= PAGE_SIZE)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    const size_t colorSpan = (BUFFER_POOL_MAX_COLORS - 1) * m_ColorStride;
+
+    if (m_StrideSize - AllocateSize < colorSpan)
+    {
+        size_t paddedSize;
+        CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTAdd(AllocateSize, colorSpan, &paddedSize));
+
+        m_StrideSize = ALIGN_UP_BY(paddedSize, m_Alignment);
+        CX_RETURN_NTSTATUS_IF(STATUS_INTEGER_OVERFLOW, m_StrideSize < paddedSize);
+    }
+
+    m_NumColors = min((size_t) BUFFER_POOL_MAX_COLORS,
+                      (m_StrideSize - AllocateSize) / m_ColorStride + 1);
+
+    //every buffer reports the same capacity regardless of its color, so a colored buffer
+    //never overlaps the next stride and Free can still recover its index by division
+    m_MaxColorOffset = (m_NumColors - 1) * m_ColorStride;
+
+    NT_ASSERT(m_StrideSize - m_MaxColorOffset >= AllocateSize);
+
+    return STATUS_SUCCESS;
+}
+
 NONPAGED
 size_t
 NxBufferPool::AvailableBuffersCount()
@@ -277,6 +334,17 @@ NxBufferPool::AddMemoryChunks(
     CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
                           !m_MemoryChunks.reserve(m_NumMemoryChunks));
 
+    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
+                          !m_ChunkBuffersInUse.resize(m_NumMemoryChunks));
+
+    for (size_t i = 0; i < m_NumMemoryChunks; i++)
+    {
+        m_ChunkBuffersInUse[i] = 0;
+    }
+
+    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
+                          m_TrackHoldTime && !m_BufferAllocationTimestamps.resize(newPoolSize));
+
     m_MemoryChunks = wistd::move(MemoryChunks);
 
     CX_RETURN_IF_NOT_NT_SUCCESS(StitchMemoryChunks());
@@ -295,7 +363,8 @@ NxBufferPool::FillBufferPool()
     {
         for (size_t bufferIndex = 0; bufferIndex < m_NumBuffersPerChunk; bufferIndex++)
         {
-            const size_t bufferOffset = m_ChunkOffset + bufferIndex * m_StrideSize;
+            const size_t colorOffset = (bufferIndex % m_NumColors) * m_ColorStride;
+            const size_t bufferOffset = m_ChunkOffset + bufferIndex * m_StrideSize + colorOffset;
 
             NxBufferDescriptor buffer =
             {
@@ -323,21 +392,36 @@ NxBufferPool::Allocate(_Out_ PVOID* VirtualAddress,
                        _Out_ size_t* Offset,
                        _Out_ size_t* AllocatedSize)
 {
-    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
-                          m_NumBuffersInUse >= m_PopulatedPoolSize);
+    if (m_NumBuffersInUse >= m_PopulatedPoolSize)
+    {
+        m_Counters.AllocationFailures++;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
     size_t bufferIndex = m_Buffers[m_NumBuffersInUse].BufferIndex;
 
     NT_FRE_ASSERT(!m_BuffersInUseFlag.TestBit(bufferIndex));
     m_BuffersInUseFlag.SetBit(bufferIndex);
 
+    m_ChunkBuffersInUse[m_Buffers[m_NumBuffersInUse].ChunkIndex]++;
+
+    if (m_TrackHoldTime)
+    {
+        m_BufferAllocationTimestamps[bufferIndex] = ReadTimeStampCounter();
+    }
+
     *VirtualAddress = m_Buffers[m_NumBuffersInUse].VirtualAddress;
     *PhysicalAddress = m_Buffers[m_NumBuffersInUse].LogicalAddress;
     *Offset = m_AlignmentOffset;
-    *AllocatedSize = m_StrideSize;
+    *AllocatedSize = m_StrideSize - m_MaxColorOffset;
 
     m_NumBuffersInUse++;
 
+    if (m_NumBuffersInUse > m_Counters.BuffersInUseHighWatermark)
+    {
+        m_Counters.BuffersInUseHighWatermark = m_NumBuffersInUse;
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -368,6 +452,8 @@ NxBufferPool::Free(_In_ PVOID VirtualAddress)
     buffer.LogicalAddress.QuadPart =
         m_MemoryChunkBaseAddresses[buffer.ChunkIndex].LogicalAddress.QuadPart + offsetFromChunk;
 
+    //a color offset is always smaller than the stride, so the division
+    //below drops it and yields the buffer index
     buffer.BufferIndex =
         buffer.ChunkIndex * m_NumBuffersPerChunk +
         (offsetFromChunk - m_ChunkOffset) / m_StrideSize;
@@ -375,5 +461,68 @@ NxBufferPool::Free(_In_ PVOID VirtualAddress)
 
     NT_FRE_ASSERT(m_BuffersInUseFlag.TestBit(buffer.BufferIndex));
     m_BuffersInUseFlag.ClearBit(buffer.BufferIndex);
+
+    m_ChunkBuffersInUse[buffer.ChunkIndex]--;
+
+    if (m_TrackHoldTime)
+    {
+        m_Counters.CumulativeHoldTime +=
+            ReadTimeStampCounter() - m_BufferAllocationTimestamps[buffer.BufferIndex];
+        m_Counters.NumberOfFrees++;
+    }
+}
+
+NONPAGED
+VOID
+NxBufferPool::RecordAllocationBatch(_In_ ULONG NumBuffers)
+{
+    if (NumBuffers == 0)
+    {
+        return;
+    }
+
+    //bucket i counts batches of [2^i, 2^(i+1)) buffers, the last bucket
+    //also counts every larger batch
+    ULONG bucket;
+    _BitScanReverse(&bucket, NumBuffers);
+    bucket = min(bucket, (ULONG) (NET_CLIENT_BUFFER_POOL_BATCH_SIZE_BUCKETS - 1));
+
+    m_Counters.AllocationBatchSizeHistogram[bucket]++;
+}
+
+NONPAGED
+VOID
+NxBufferPool::GetCounters(_Out_ NET_CLIENT_BUFFER_POOL_COUNTERS* Counters) const
+{
+    *Counters = m_Counters;
+
+    Counters->PoolSize = m_PopulatedPoolSize;
+    Counters->BuffersInUse = m_NumBuffersInUse;
+    Counters->NumberOfChunks = m_NumMemoryChunks;
+    Counters->MinimumChunkOccupancy = 0;
+    Counters->MaximumChunkOccupancy = 0;
+
+    for (size_t i = 0; i < m_ChunkBuffersInUse.count(); i++)
+    {
+        if (i == 0 || m_ChunkBuffersInUse[i] < Counters->MinimumChunkOccupancy)
+        {
+            Counters->MinimumChunkOccupancy = m_ChunkBuffersInUse[i];
+        }
+
+        if (m_ChunkBuffersInUse[i] > Counters->MaximumChunkOccupancy)
+        {
+            Counters->MaximumChunkOccupancy = m_ChunkBuffersInUse[i];
+        }
+    }
+}
+
+NONPAGED
+VOID
+NxBufferPool::ResetCounters()
+{
+    //the high watermark restarts from the buffers in use right now, every
+    //other counter accumulates over one report interval
+    m_Counters = {};
+    m_Counters.BuffersInUseHighWatermark = m_NumBuffersInUse;
 }
 
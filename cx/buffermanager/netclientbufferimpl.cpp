@@ -49,6 +49,8 @@ NetClientAllocateBuffers(
     //CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
     //                      pool->AvailableBuffersCount() < NumBuffers);
 
+    pool->RecordAllocationBatch(NumBuffers);
+
     for (UINT32 i = 0; i < NumBuffers; i++)
     {
         size_t allocatedSize, offset;
@@ -92,12 +94,41 @@ NetClientFreeBuffers(
     }
 }
 
+NONPAGEDX
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+VOID
+NetClientGetBufferPoolCounters(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool,
+    _Out_ NET_CLIENT_BUFFER_POOL_COUNTERS * Counters)
+{
+    NxBufferPool* pool = reinterpret_cast<NxBufferPool *> (BufferPool);
+
+    pool->GetCounters(Counters);
+}
+
+NONPAGEDX
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+VOID
+NetClientResetBufferPoolCounters(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool)
+{
+    NxBufferPool* pool = reinterpret_cast<NxBufferPool *> (BufferPool);
+
+    pool->ResetCounters();
+}
+
 static const NET_CLIENT_BUFFER_POOL_DISPATCH PoolDispatch =
 {
     sizeof(NET_CLIENT_BUFFER_POOL_DISPATCH),
     &NetClientDestroyBufferPool,
     &NetClientAllocateBuffers,
     &NetClientFreeBuffers,
+    &NetClientGetBufferPoolCounters,
+    &NetClientResetBufferPoolCounters,
 };
 
 PAGEDX
@@ -142,6 +173,8 @@ NetClientCreateBufferPool(
                                                  BufferPoolConfig->BufferSize,
                                                  BufferPoolConfig->BufferAlignmentOffset,
                                                  combinedAlignmentRequirement,
+                                                 !!(BufferPoolConfig->Flag & NET_CLIENT_BUFFER_POOL_FLAGS_CACHE_COLORING),
+                                                 !!(BufferPoolConfig->Flag & NET_CLIENT_BUFFER_POOL_FLAGS_TRACK_HOLD_TIME),
                                                  &requestedTotalSize,
                                                  &minimumChunkSize));
 
@@ -17,6 +17,7 @@ Abstract:
 #include "NxAdapter.tmh"
 #include "NxAdapter.hpp"
 
+#include "NxConfiguration.hpp"
 #include "NxDevice.hpp"
 #include "NxDriver.hpp"
 #include "NxMacros.hpp"
@@ -2238,6 +2239,10 @@ NxAdapter::InitializeDatapath(
 {
     CxDriverContext *driverContext = GetCxDriverContextFromHandle(WdfGetDriver());
 
+    // Read before the translator creates its queues, they pick the
+    // settings up from the adapter properties
+    QueryTxCompletionModeration();
+
     void * client;
     CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
         driverContext->TranslationAppFactory.CreateApp(
@@ -2255,6 +2260,46 @@ NxAdapter::InitializeDatapath(
     return STATUS_SUCCESS;
 }
 
+void
+NxAdapter::QueryTxCompletionModeration(
+    void
+    )
+{
+    // The keywords are optional, moderation stays disabled without them
+    NxConfiguration *nxConfiguration;
+    NTSTATUS status = NxConfiguration::_Create(
+        GetPrivateGlobals(),
+        this,
+        NULL,
+        &nxConfiguration);
+
+    if (!NT_SUCCESS(status))
+    {
+        return;
+    }
+
+    status = nxConfiguration->Open();
+
+    if (NT_SUCCESS(status))
+    {
+        NDIS_STRING batchNblsKeyword = NDIS_STRING_CONST("TxCompletionBatchNbls");
+        NDIS_STRING budgetKeyword = NDIS_STRING_CONST("TxCompletionBudgetUs");
+        ULONG value;
+
+        if (NT_SUCCESS(nxConfiguration->QueryUlong(NET_CONFIGURATION_QUERY_ULONG_NO_FLAGS, &batchNblsKeyword, &value)))
+        {
+            m_TxCompletionBatchNbls = value;
+        }
+
+        if (NT_SUCCESS(nxConfiguration->QueryUlong(NET_CONFIGURATION_QUERY_ULONG_NO_FLAGS, &budgetKeyword, &value)))
+        {
+            m_TxCompletionBudgetInMicroseconds = value;
+        }
+    }
+
+    nxConfiguration->Close();
+}
+
 AdapterState
 NxAdapter::GetCurrentState(
     void
@@ -2521,6 +2566,8 @@ NxAdapter::GetProperties(
     Properties->NetLuid = m_NetLuid;
     Properties->DriverIsVerifying = !!MmIsDriverVerifyingByAddress(m_datapathCallbacks.EvtAdapterCreateTxQueue);
     Properties->NdisAdapterHandle = m_NdisAdapterHandle;
+    Properties->TxCompletionBatchNbls = m_TxCompletionBatchNbls;
+    Properties->TxCompletionBudgetInMicroseconds = m_TxCompletionBudgetInMicroseconds;
 
     // C++ object shared across ABI
     // this is not viable once the translator is removed from the Cx
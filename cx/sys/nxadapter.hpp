@@ -288,6 +288,16 @@ private:
     NDIS_MEDIUM
         m_MediaType = (NDIS_MEDIUM)0xFFFFFFFF;
 
+    //
+    // Tx completion moderation settings, read from the adapter's registry
+    // keywords when the datapath is initialized. Zero disables moderation.
+    //
+    ULONG
+        m_TxCompletionBatchNbls = 0;
+
+    ULONG
+        m_TxCompletionBudgetInMicroseconds = 0;
+
     NET_CLIENT_CONTROL_DISPATCH const *
         m_ClientDispatch = nullptr;
 
@@ -922,6 +932,11 @@ public:
         void
         );
 
+    void
+    QueryTxCompletionModeration(
+        void
+        );
+
     NET_LUID
     GetNetLuid(
         void
@@ -27,7 +27,9 @@ NxBuffer::_GetTypedClientContext(
     auto rb = NET_DATAPATH_DESCRIPTOR_GET_PACKET_RING_BUFFER(Descriptor);
     NxQueue *queue = NXQUEUE_FROM_RING_BUFFER(rb);
 
-    if (queue->GetPrivateExtensionOffset() == 0)
+    auto contextBase = queue->GetClientContextBase(NetPacket);
+
+    if (contextBase == nullptr)
     {
         // There are no client contexts in the NET_PACKET
         return nullptr;
@@ -38,7 +40,7 @@ NxBuffer::_GetTypedClientContext(
         // See if the context type exists in the NET_PACKET
         if (internalToken.ContextTypeInfo == TypeInfo)
         {
-            return (PVOID)((PUCHAR)NetPacket + internalToken.Offset);
+            return (PVOID)(contextBase + internalToken.Offset);
         }
     }
 
@@ -55,12 +57,14 @@ NxBuffer::_GetClientContextFromToken(
     auto rb = NET_DATAPATH_DESCRIPTOR_GET_PACKET_RING_BUFFER(Descriptor);
     NxQueue *queue = NXQUEUE_FROM_RING_BUFFER(rb);
 
-    if (queue->GetPrivateExtensionOffset() == 0)
+    auto contextBase = queue->GetClientContextBase(NetPacket);
+
+    if (contextBase == nullptr)
     {
         // There are no client contexts in the NET_PACKET
         return nullptr;
     }
 
     NET_PACKET_CONTEXT_TOKEN_INTERNAL *internalToken = reinterpret_cast<NET_PACKET_CONTEXT_TOKEN_INTERNAL *>(Token);
-    return (PVOID)((PUCHAR)NetPacket + internalToken->Offset);
+    return (PVOID)(contextBase + internalToken->Offset);
 }
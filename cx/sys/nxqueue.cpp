@@ -88,6 +88,21 @@ static const NET_CLIENT_QUEUE_DISPATCH QueueDispatch
     &NetClientQueueGetDatapathDescriptor,
 };
 
+//
+// Packet extensions the translators read or write for every packet. These are
+// laid out right after the NET_PACKET so that they share its first cache line.
+//
+static
+bool
+IsHotPacketExtension(
+    _In_ NET_PACKET_EXTENSION_PRIVATE const & Extension
+    )
+{
+    return
+        0 == wcscmp(Extension.Name, NET_PACKET_EXTENSION_CHECKSUM_NAME) ||
+        0 == wcscmp(Extension.Name, NET_PACKET_EXTENSION_LSO_NAME);
+}
+
 NTSTATUS
 GetAttributesContextSize(
     _In_ NET_PACKET_CONTEXT_ATTRIBUTES const & Attributes,
@@ -160,6 +175,7 @@ NxQueue::Start(
     m_packetRingBuffer->NextIndex = 0;
     m_packetRingBuffer->EndIndex = 0;
     m_packetRingBuffer->OSReserved2[0] = static_cast<void *>(0);
+    m_postedEndIndex = 0;
 
     if (m_packetQueueConfig.EvtStart)
     {
@@ -183,9 +199,32 @@ NxQueue::Advance(
     void
     )
 {
+    if (m_queueType == NxQueue::Type::Rx && m_clientContextBuffer)
+    {
+        ZeroPostedClientContexts();
+    }
+
     m_packetQueueConfig.EvtAdvance(m_queue);
 }
 
+void
+NxQueue::ZeroPostedClientContexts(
+    void
+    )
+{
+    // Rx packets are reused, the NIC driver expects the contexts of every
+    // packet posted to it to be zeroed, as they were when the contexts lived
+    // in the packet ring element and the translator reinitialized them
+    auto const endIndex = m_packetRingBuffer->EndIndex;
+
+    for (auto i = m_postedEndIndex; i != endIndex; i = (i + 1) & m_packetRingBuffer->ElementIndexMask)
+    {
+        RtlZeroMemory(m_clientContextBuffer.get() + i * m_clientContextStride, m_clientContextStride);
+    }
+
+    m_postedEndIndex = endIndex;
+}
+
 void
 NxQueue::Cancel(
     void
@@ -277,8 +316,21 @@ NxQueue::Initialize(
         m_privateExtensionOffset = NetPacketGetSize();
     }
 
-    auto const extensionSize = ALIGN_UP_BY(m_privateExtensionSize, MEMORY_ALLOCATION_ALIGNMENT);
-    auto const elementSize = ALIGN_UP_BY(m_privateExtensionOffset + extensionSize, NET_PACKET_ALIGNMENT_BYTES);
+    for (auto const & extension : m_AddedPacketExtensions)
+    {
+        if (IsHotPacketExtension(extension) &&
+            extension.AssignedOffset + extension.ExtensionSize > SYSTEM_CACHE_ALIGNMENT_SIZE)
+        {
+            LogWarning(m_adapter->GetRecorderLog(), FLAG_ADAPTER,
+                "Hot packet extension %S does not fit in the first cache line of the NET_PACKET, offset=%Iu",
+                extension.Name,
+                extension.AssignedOffset);
+        }
+    }
+
+    // Client contexts are not part of the packet ring element, they are
+    // stored in m_clientContextBuffer, see below
+    auto const elementSize = ALIGN_UP_BY(m_privateExtensionOffset, NET_PACKET_ALIGNMENT_BYTES);
     auto const ringSize = InitContext.ClientQueueConfig->NumberOfPackets * elementSize;
     auto const allocationSize = ringSize + FIELD_OFFSET(NET_RING_BUFFER, Buffer[0]);
 
@@ -308,9 +360,36 @@ NxQueue::Initialize(
             return STATUS_INSUFFICIENT_RESOURCES;
         }
 
-        // For each context type initialize a context token
+        //
+        // Client contexts are rarely touched by the translators, keeping them
+        // inside the NET_PACKET element would pull their bytes into the cache
+        // every time the packet is processed. They live in an array parallel
+        // to the packet ring instead, one m_clientContextStride sized slot per packet.
+        //
+        m_clientContextStride = ALIGN_UP_BY(m_privateExtensionSize, MEMORY_ALLOCATION_ALIGNMENT);
+
+        size_t contextBufferSize;
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            RtlSizeTMult(
+                m_clientContextStride,
+                InitContext.ClientQueueConfig->NumberOfPackets,
+                &contextBufferSize),
+            "Client context buffer too large.");
+
+        auto clientContextBuffer = reinterpret_cast<UCHAR *>(
+            ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned, contextBufferSize, 'BRxN'));
+        if (! clientContextBuffer)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        RtlZeroMemory(clientContextBuffer, contextBufferSize);
+
+        m_clientContextBuffer.reset(clientContextBuffer);
+
+        // For each context type initialize a context token, offsets are
+        // relative to the packet's slot in m_clientContextBuffer
         ULONG i = 0;
-        ULONG offset = static_cast<ULONG>(m_privateExtensionOffset);
+        ULONG offset = 0;
         for (auto& packetContextAttribs : InitContext.PacketContextAttributes)
         {
             ULONG contextSize;
@@ -325,7 +404,7 @@ NxQueue::Initialize(
             m_clientContextInfo[i].Size = contextSize;
             m_clientContextInfo[i].ContextTypeInfo = packetContextAttribs.ContextTypeInfo;
 
-            NT_ASSERT(m_clientContextInfo[i].Offset + m_clientContextInfo[i].Size <= m_packetRingBuffer->ElementStride);
+            NT_ASSERT(m_clientContextInfo[i].Offset + m_clientContextInfo[i].Size <= m_clientContextStride);
 
             i++;
 
@@ -362,6 +441,28 @@ NxQueue::GetPrivateExtensionOffset(
     return m_privateExtensionOffset;
 }
 
+_Use_decl_annotations_
+PUCHAR
+NxQueue::GetClientContextBase(
+    NET_PACKET const * NetPacket
+    ) const
+{
+    if (! m_clientContextBuffer)
+    {
+        return nullptr;
+    }
+
+    auto const packetOffset =
+        reinterpret_cast<UCHAR const *>(NetPacket) -
+        reinterpret_cast<UCHAR const *>(NetRingBufferGetElementAtIndex(m_packetRingBuffer.get(), 0));
+
+    auto const packetIndex = static_cast<size_t>(packetOffset) / m_packetRingBuffer->ElementStride;
+
+    NT_ASSERT(packetIndex < m_packetRingBuffer->NumberOfElements);
+
+    return m_clientContextBuffer.get() + packetIndex * m_clientContextStride;
+}
+
 Rtl::KArray<NET_PACKET_CONTEXT_TOKEN_INTERNAL, NonPagedPoolNx> &
 NxQueue::GetClientContextInfo(
     void
@@ -499,11 +600,24 @@ NxQueue::PrepareAndStorePacketExtensions(
     QUEUE_CREATION_CONTEXT & InitContext
     )
 {
+    //
+    // Extensions are assigned offsets in this order. Hot extensions go first
+    // so they land in the same cache line as the NET_PACKET fields, within
+    // each group sort by alignment to keep padding small.
+    //
     auto const sortByAlignment = [](
         NET_PACKET_EXTENSION_PRIVATE const & Lhs,
         NET_PACKET_EXTENSION_PRIVATE const & Rhs
         )
     {
+        bool const lhsHot = IsHotPacketExtension(Lhs);
+        bool const rhsHot = IsHotPacketExtension(Rhs);
+
+        if (lhsHot != rhsHot)
+        {
+            return lhsHot;
+        }
+
         return Lhs.NonWdfStyleAlignment < Rhs.NonWdfStyleAlignment;
     };
 
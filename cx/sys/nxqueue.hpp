@@ -114,6 +114,18 @@ public:
     KPoolPtr<NET_RING_BUFFER>
         m_fragmentRingBuffer;
 
+    // Client packet contexts, kept out of the packet ring element. Slot i
+    // holds the contexts of the packet at index i of m_packetRingBuffer.
+    KPoolPtr<UCHAR>
+        m_clientContextBuffer;
+
+    size_t
+        m_clientContextStride = 0;
+
+    // Rx only, EndIndex up to which client contexts were zeroed for the NIC
+    UINT32
+        m_postedEndIndex = 0;
+
     void
     Start(
         void
@@ -159,6 +171,11 @@ public:
         void
         );
 
+    PUCHAR
+    GetClientContextBase(
+        _In_ NET_PACKET const * NetPacket
+        ) const;
+
     NET_PACKET_CONTEXT_TOKEN *
     GetPacketContextTokenFromTypeInfo(
         _In_ PCNET_CONTEXT_TYPE_INFO ContextTypeInfo
@@ -185,6 +202,11 @@ protected:
     NxAdapter *
         m_adapter = nullptr;
 
+    void
+    ZeroPostedClientContexts(
+        void
+        );
+
     Rtl::KArray<NET_PACKET_EXTENSION_PRIVATE>
         m_AddedPacketExtensions;
 
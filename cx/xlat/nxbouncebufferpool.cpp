@@ -6,6 +6,16 @@
 
 #include "NxBounceBufferPool.hpp"
 
+// Buffers are allocated from and returned to the pool this many at a time
+#define NX_BOUNCE_BUFFER_BATCH_SIZE 16
+
+// Buffers of completed packets are returned to the pool this many at a time
+#define NX_BOUNCE_BUFFER_FREE_BATCH_SIZE 64
+
+// Leading bytes of a bounced payload that are always copied through the
+// cache, the packet layout parser reads the headers right after the bounce
+#define NX_BOUNCE_CACHED_HEADER_BYTES 128
+
 NxBounceBufferPool::~NxBounceBufferPool(
     void
     )
@@ -23,11 +33,16 @@ NxBounceBufferPool::Initialize(
     NET_CLIENT_DISPATCH const &ClientDispatch,
     NET_DATAPATH_DESCRIPTOR const *Descriptor,
     NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES &DatapathCapabilities,
-    size_t NumberOfBuffers
+    size_t NumberOfBuffers,
+    size_t StreamingCopyThreshold,
+    bool TrackHoldTime
     )
 {
+    m_copyEngine.Initialize(StreamingCopyThreshold);
+
     m_descriptor = Descriptor;
     m_bufferSize = DatapathCapabilities.MaximumTxFragmentSize;
+    m_maximumNumberOfBuffers = max(static_cast<UINT32>(DatapathCapabilities.MaximumNumberOfTxFragments), 1u);
 
     NET_CLIENT_BUFFER_POOL_CONFIG bufferPoolConfig = {
         &DatapathCapabilities.TxMemoryConstraints,
@@ -36,7 +51,7 @@ NxBounceBufferPool::Initialize(
         DatapathCapabilities.TxPayloadBackfill,
         0,
         MM_ANY_NODE_OK,
-        NET_CLIENT_BUFFER_POOL_FLAGS_NONE
+        TrackHoldTime ? NET_CLIENT_BUFFER_POOL_FLAGS_TRACK_HOLD_TIME : NET_CLIENT_BUFFER_POOL_FLAGS_NONE
     };
 
     CX_RETURN_IF_NOT_NT_SUCCESS(
@@ -51,18 +66,22 @@ _Use_decl_annotations_
 bool
 NxBounceBufferPool::BounceNetBuffer(
     NET_BUFFER const &NetBuffer,
-    NET_PACKET &NetPacket
+    NET_PACKET &NetPacket,
+    NxBounceChecksum *Checksum
     )
 /*
 
 Description:
 
-    This routine tries to allocate a buffer from the buffer pool and bounce
-    the payload described by NetBuffer into *one* NET_PACKET_FRAGMENT.
+    This routine tries to allocate buffers from the buffer pool and bounce
+    the payload described by NetBuffer into as many NET_PACKET_FRAGMENTs
+    as it takes, up to MaximumNumberOfTxFragments.
 
 Return value:
 
-    true - Bounce operation was successful. NetPacket has one fragment.
+    true - Bounce operation was successful. NetPacket has one fragment per
+           bounce buffer. If Checksum is not null, Checksum->Written tells
+           whether the TCP checksum was computed in the copy.
     false - Bounce operation was unsuccessful. NetPacket has no fragments.
 
 Remarks:
@@ -74,40 +93,112 @@ Remarks:
     auto& fragmentRing = *NET_DATAPATH_DESCRIPTOR_GET_FRAGMENT_RING_BUFFER(m_descriptor);
     auto availableFragments = NetRbFragmentRange::OsRange(fragmentRing);
 
-    if (availableFragments.Count() == 0)
+    UINT32 numberOfFragments;
+
+    auto const result = BounceMdlChain(
+        *NET_BUFFER_CURRENT_MDL(&NetBuffer),
+        NET_BUFFER_CURRENT_MDL_OFFSET(&NetBuffer),
+        NET_BUFFER_DATA_LENGTH(&NetBuffer),
+        availableFragments,
+        Checksum,
+        numberOfFragments);
+
+    if (result == NxBounceResult::CannotBounce)
+    {
+        NetPacket.IgnoreThisPacket = TRUE;
+        NetPacket.FragmentCount = 0;
+        return false;
+    }
+
+    if (result != NxBounceResult::Success)
     {
         return false;
     }
 
-    auto& fragment = *availableFragments.begin();
-    RtlZeroMemory(&fragment, NetPacketFragmentGetSize());
+    // Attach the fragment chain to the packet
+    NetPacket.FragmentCount = static_cast<UINT16>(numberOfFragments);
+    NetPacket.FragmentOffset = availableFragments.begin().GetIndex();
+    fragmentRing.EndIndex = availableFragments.GetIterator(numberOfFragments).GetIndex();
+
+    return true;
+}
+
+_Use_decl_annotations_
+NxBounceResult
+NxBounceBufferPool::BounceMdlChain(
+    MDL const &Mdl,
+    size_t MdlOffset,
+    size_t BytesToCopy,
+    NetRbFragmentRange const &Fragments,
+    NxBounceChecksum *Checksum,
+    UINT32 &NumberOfFragments
+    )
+/*
+
+Description:
+
+    This routine allocates as many buffers as BytesToCopy takes from the
+    buffer pool into the first fragments of Fragments, and copies BytesToCopy
+    bytes of the MDL chain, starting MdlOffset bytes into Mdl, into them.
+    Every buffer but the last one is filled up to the pool's buffer size.
 
-    auto allocatedCount = m_bufferPoolDispatch->NetClientAllocateBuffers(
-        m_bufferPool,
-        &fragment,
-        1);
+    If Checksum is not null the bytes past the layer 4 header offset are
+    checksummed in the same pass as they are copied, and the checksum is
+    written into the copy of the header if that is in the first buffer.
 
-    if (allocatedCount != 1)
+Return value:
+
+    Success - NumberOfFragments fragments hold the copy. They are not
+              attached to any packet yet.
+    InsufficientResources - There are not enough fragments or buffers at
+              the moment.
+    CannotBounce - The payload is empty, needs more than
+              MaximumNumberOfTxFragments buffers or the MDL chain ended
+              early.
+
+*/
+{
+    NumberOfFragments = 0;
+
+    if (Checksum != nullptr)
     {
-        return false;
+        Checksum->Written = false;
     }
 
-    fragment.OsReserved_Bounced = TRUE;
+    if (BytesToCopy == 0)
+    {
+        return NxBounceResult::CannotBounce;
+    }
 
-    PMDL mdl = NET_BUFFER_CURRENT_MDL(&NetBuffer);
-    size_t mdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(&NetBuffer);
-    auto bytesToCopy = NET_BUFFER_DATA_LENGTH(&NetBuffer);
+    auto const numberOfBuffers = static_cast<UINT32>((BytesToCopy + m_bufferSize - 1) / m_bufferSize);
 
-    if (bytesToCopy == 0 || bytesToCopy > m_bufferSize)
+    if (numberOfBuffers > m_maximumNumberOfBuffers)
     {
-        NetPacket.IgnoreThisPacket = TRUE;
-        NetPacket.FragmentCount = 0;
-        return false;
+        return NxBounceResult::CannotBounce;
+    }
+
+    if (Fragments.Count() < numberOfBuffers)
+    {
+        return NxBounceResult::InsufficientResources;
+    }
+
+    auto const bounceFragments = NetRbFragmentRange(Fragments.begin(), Fragments.GetIterator(numberOfBuffers));
+
+    if (!AllocateBuffers(bounceFragments))
+    {
+        return NxBounceResult::InsufficientResources;
     }
 
-    size_t currentFragmentOffset = fragment.Offset;
-    auto baseFragmentVa = static_cast<UCHAR *>(fragment.VirtualAddress);
-    for (size_t remain = bytesToCopy; remain > 0; mdl = mdl->Next)
+    // The NIC is the only one reading past the headers of a large payload,
+    // don't pull that part through the cache
+    auto const stream = m_copyEngine.ShouldStream(BytesToCopy);
+
+    auto fragmentIt = bounceFragments.begin();
+    auto mdl = const_cast<MDL *>(&Mdl);
+    size_t remain = BytesToCopy;
+    size_t copied = 0;
+    NxOnesComplementSum checksum;
+    for (; remain > 0 && mdl != nullptr; mdl = mdl->Next)
     {
         size_t const mdlByteCount = MmGetMdlByteCount(mdl);
         if (mdlByteCount == 0)
@@ -115,38 +206,151 @@ Remarks:
             continue;
         }
 
-        NT_ASSERT(mdlByteCount > mdlOffset);
+        NT_ASSERT(mdlByteCount > MdlOffset);
 
-        size_t const copySize = min(remain, mdlByteCount - mdlOffset);
+        size_t mdlRemain = min(remain, mdlByteCount - MdlOffset);
+        auto sourceBuffer = static_cast<UCHAR *>(MmGetSystemAddressForMdlSafe(mdl, LowPagePriority | MdlMappingNoExecute)) + MdlOffset;
 
-        void *sourceBuffer = static_cast<UCHAR *>(MmGetSystemAddressForMdlSafe(mdl, LowPagePriority | MdlMappingNoExecute)) + mdlOffset;
-        void *destinationBuffer = baseFragmentVa + currentFragmentOffset;
+        remain -= mdlRemain;
 
-        // If we make the parsing code optional or parse the packets in
-        // batches we might benefit from using RtlCopyMemoryNonTemporal
-        RtlCopyMemory(
-            destinationBuffer,
-            sourceBuffer,
-            copySize);
+        while (mdlRemain > 0)
+        {
+            if (fragmentIt->ValidLength == m_bufferSize)
+            {
+                fragmentIt++;
+            }
+
+            auto& fragment = *fragmentIt;
+            size_t copySize = min(mdlRemain, m_bufferSize - static_cast<size_t>(fragment.ValidLength));
+            auto hint = NxCopyHint::Cached;
+
+            if (stream)
+            {
+                if (copied < NX_BOUNCE_CACHED_HEADER_BYTES)
+                {
+                    copySize = min(copySize, NX_BOUNCE_CACHED_HEADER_BYTES - copied);
+                }
+                else
+                {
+                    hint = NxCopyHint::Streaming;
+                }
+            }
+
+            if (Checksum != nullptr && copied < Checksum->Layer4Offset)
+            {
+                copySize = min(copySize, Checksum->Layer4Offset - copied);
+            }
+
+            auto destinationBuffer = static_cast<UCHAR *>(fragment.VirtualAddress) + fragment.Offset + fragment.ValidLength;
+
+            if (Checksum != nullptr && copied >= Checksum->Layer4Offset)
+            {
+                m_copyEngine.CopyAndChecksum(
+                    destinationBuffer,
+                    sourceBuffer,
+                    copySize,
+                    checksum);
+            }
+            else
+            {
+                m_copyEngine.Copy(
+                    destinationBuffer,
+                    sourceBuffer,
+                    copySize,
+                    hint);
+            }
+
+            fragment.ValidLength += copySize;
+            sourceBuffer += copySize;
+            mdlRemain -= copySize;
+            copied += copySize;
+        }
 
-        fragment.ValidLength += copySize;
+        MdlOffset = 0;
+    }
 
-        mdlOffset = 0;
-        remain -= copySize;
-        currentFragmentOffset += copySize;
+    if (remain != 0)
+    {
+        // The fragments are not attached to a packet, so the buffers would
+        // not be freed on completion
+        FreeBounceBuffers(bounceFragments);
+        return NxBounceResult::CannotBounce;
     }
 
-    if (fragment.ValidLength != bytesToCopy)
+    if (Checksum != nullptr)
     {
-        NetPacket.IgnoreThisPacket = TRUE;
-        NetPacket.FragmentCount = 0;
-        return false;
+        auto const& header = *bounceFragments.begin();
+        auto const fieldOffset = Checksum->Layer4Offset + Checksum->ChecksumFieldOffset;
+
+        // Otherwise the NIC is left to compute the checksum
+        if (fieldOffset + sizeof(UINT16) <= header.ValidLength)
+        {
+            auto field = reinterpret_cast<UINT16 UNALIGNED *>(
+                static_cast<UCHAR *>(header.VirtualAddress) + header.Offset + fieldOffset);
+
+            *field = static_cast<UINT16>(~checksum.Fold());
+            Checksum->Written = true;
+        }
     }
 
-    // Attach the fragment chain to the packet
-    NetPacket.FragmentCount = 1;
-    NetPacket.FragmentOffset = availableFragments.begin().GetIndex();
-    fragmentRing.EndIndex = NetRingBufferIncrementIndex(&fragmentRing, fragmentRing.EndIndex);
+    NumberOfFragments = numberOfBuffers;
+
+    return NxBounceResult::Success;
+}
+
+_Use_decl_annotations_
+bool
+NxBounceBufferPool::AllocateBuffers(
+    NetRbFragmentRange const &Fragments
+    )
+/*
+
+Description:
+
+    Allocates one buffer into each fragment of Fragments. The buffer pool
+    can't write into the fragment ring directly since ring elements are not
+    laid out as an array of NET_PACKET_FRAGMENT, so the buffers are allocated
+    into a local array first, in batches of up to
+    NX_BOUNCE_BUFFER_BATCH_SIZE buffers.
+
+    Either all fragments get a buffer or none does.
+
+*/
+{
+    NET_PACKET_FRAGMENT batch[NX_BOUNCE_BUFFER_BATCH_SIZE];
+    UINT32 allocated = 0;
+
+    while (allocated < Fragments.Count())
+    {
+        auto const batchSize = min(Fragments.Count() - allocated, UINT32{ NX_BOUNCE_BUFFER_BATCH_SIZE });
+
+        RtlZeroMemory(batch, sizeof(batch));
+
+        auto const batchAllocated = m_bufferPoolDispatch->NetClientAllocateBuffers(
+            m_bufferPool,
+            batch,
+            batchSize);
+
+        for (UINT32 i = 0; i < batchAllocated; i++)
+        {
+            auto& fragment = *Fragments.GetIterator(allocated + i);
+
+            RtlZeroMemory(&fragment, NetPacketFragmentGetSize());
+            fragment.VirtualAddress = batch[i].VirtualAddress;
+            fragment.Mapping = batch[i].Mapping;
+            fragment.Offset = batch[i].Offset;
+            fragment.Capacity = batch[i].Capacity;
+            fragment.OsReserved_Bounced = TRUE;
+        }
+
+        allocated += batchAllocated;
+
+        if (batchAllocated != batchSize)
+        {
+            FreeBounceBuffers(NetRbFragmentRange(Fragments.begin(), Fragments.GetIterator(allocated)));
+            return false;
+        }
+    }
 
     return true;
 }
@@ -154,25 +358,112 @@ Remarks:
 _Use_decl_annotations_
 void
 NxBounceBufferPool::FreeBounceBuffers(
-    NET_PACKET &NetPacket
+    NetRbFragmentRange const &Fragments
     )
 {
-    if (NetPacket.IgnoreThisPacket)
+    PVOID batch[NX_BOUNCE_BUFFER_BATCH_SIZE];
+    ULONG batchSize = 0;
+
+    for (auto& fragment : Fragments)
     {
-        return;
+        NT_ASSERT(fragment.OsReserved_Bounced);
+
+        batch[batchSize++] = fragment.VirtualAddress;
+        fragment.OsReserved_Bounced = FALSE;
+
+        if (batchSize == NX_BOUNCE_BUFFER_BATCH_SIZE)
+        {
+            m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool, batch, batchSize);
+            batchSize = 0;
+        }
+    }
+
+    if (batchSize > 0)
+    {
+        m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool, batch, batchSize);
     }
+}
+
+_Use_decl_annotations_
+void
+NxBounceBufferPool::FreeBounceBuffers(
+    NetRbPacketRange const &Packets
+    )
+{
+    // Buffers of all the packets go back to the pool together, instead of
+    // one call per packet
+    PVOID batch[NX_BOUNCE_BUFFER_FREE_BATCH_SIZE];
+    ULONG batchSize = 0;
 
-    for (size_t i = 0; i < NetPacket.FragmentCount; i++)
+    auto const spans = Packets.Spans();
+
+    for (UINT32 s = 0; s < spans.Count; s++)
     {
-        auto fragment = NET_PACKET_GET_FRAGMENT(&NetPacket, m_descriptor, i);
+        auto const &span = spans.Span[s];
+        auto packet = span.First();
 
-        if (fragment->OsReserved_Bounced)
+        for (UINT32 i = 0; i < span.Count(); i++, packet = span.Next(packet))
         {
-            m_bufferPoolDispatch->NetClientFreeBuffers(
-                m_bufferPool,
-                &fragment->VirtualAddress,
-                1);
+            if (packet->IgnoreThisPacket)
+            {
+                continue;
+            }
+
+            for (size_t f = 0; f < packet->FragmentCount; f++)
+            {
+                auto fragment = NET_PACKET_GET_FRAGMENT(packet, m_descriptor, f);
+
+                if (fragment->OsReserved_Bounced)
+                {
+                    batch[batchSize++] = fragment->VirtualAddress;
+
+                    if (batchSize == NX_BOUNCE_BUFFER_FREE_BATCH_SIZE)
+                    {
+                        m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool, batch, batchSize);
+                        batchSize = 0;
+                    }
+                }
+            }
         }
     }
+
+    if (batchSize > 0)
+    {
+        m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool, batch, batchSize);
+    }
 }
 
+_Use_decl_annotations_
+NET_CLIENT_BUFFER_POOL_COUNTERS
+NxBounceBufferPool::GetCounters(
+    void
+    ) const
+{
+    NET_CLIENT_BUFFER_POOL_COUNTERS counters = {};
+
+    if (m_bufferPool)
+    {
+        m_bufferPoolDispatch->NetClientGetBufferPoolCounters(m_bufferPool, &counters);
+    }
+
+    return counters;
+}
+
+void
+NxBounceBufferPool::ResetCounters(
+    void
+    )
+{
+    if (m_bufferPool)
+    {
+        m_bufferPoolDispatch->NetClientResetBufferPoolCounters(m_bufferPool);
+    }
+}
+
+NxCopyEngine &
+NxBounceBufferPool::GetCopyEngine(
+    void
+    )
+{
+    return m_copyEngine;
+}
@@ -2,6 +2,24 @@
 #pragma once
 
 #include "NxRingBufferRange.hpp"
+#include "NxCopyEngine.hpp"
+
+enum class NxBounceResult
+{
+    Success,
+    InsufficientResources,
+    CannotBounce
+};
+
+// Asks a bounce to compute the TCP checksum while copying the payload and to
+// write it into the bounced header. As for checksum offload the checksum
+// field is expected to hold the pseudo-header checksum.
+struct NxBounceChecksum
+{
+    size_t Layer4Offset = 0; // from the start of the payload
+    size_t ChecksumFieldOffset = 0; // from the start of the layer 4 header
+    bool Written = false; // set by the bounce
+};
 
 class NxBounceBufferPool
 {
@@ -16,26 +34,71 @@ public:
         _In_ NET_CLIENT_DISPATCH const &ClientDispatch,
         _In_ NET_DATAPATH_DESCRIPTOR const *Descriptor,
         _In_ NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES &DatapathCapabilities,
-        _In_ size_t NumberOfBuffers
+        _In_ size_t NumberOfBuffers,
+        _In_ size_t StreamingCopyThreshold,
+        _In_ bool TrackHoldTime
         );
 
     bool
     BounceNetBuffer(
         _In_ NET_BUFFER const &NetBuffer,
-        _Inout_ NET_PACKET &NetPacket
+        _Inout_ NET_PACKET &NetPacket,
+        _Inout_opt_ NxBounceChecksum *Checksum
         );
 
+    NxBounceResult
+    BounceMdlChain(
+        _In_ MDL const &Mdl,
+        _In_ size_t MdlOffset,
+        _In_ size_t BytesToCopy,
+        _In_ NetRbFragmentRange const &Fragments,
+        _Inout_opt_ NxBounceChecksum *Checksum,
+        _Out_ UINT32 &NumberOfFragments
+        );
+
+    // Frees the buffers of every bounced fragment of the packets
+    void
+    FreeBounceBuffers(
+        _In_ NetRbPacketRange const &Packets
+        );
+
+    // Frees the buffers of fragments that were not attached to a packet
     void
     FreeBounceBuffers(
-        _Inout_ NET_PACKET &NetPacket
+        _In_ NetRbFragmentRange const &Fragments
+        );
+
+    NET_CLIENT_BUFFER_POOL_COUNTERS
+    GetCounters(
+        void
+        ) const;
+
+    // Starts a new report interval for the pool counters
+    void
+    ResetCounters(
+        void
+        );
+
+    NxCopyEngine &
+    GetCopyEngine(
+        void
         );
 
 private:
 
+    bool
+    AllocateBuffers(
+        _In_ NetRbFragmentRange const &Fragments
+        );
+
     NET_CLIENT_BUFFER_POOL m_bufferPool = nullptr;
     NET_CLIENT_BUFFER_POOL_DISPATCH const *m_bufferPoolDispatch = nullptr;
 
     NET_DATAPATH_DESCRIPTOR const *m_descriptor = nullptr;
 
     size_t m_bufferSize = 0;
+
+    UINT32 m_maximumNumberOfBuffers = 1;
+
+    NxCopyEngine m_copyEngine;
 };
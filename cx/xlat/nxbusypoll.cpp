@@ -0,0 +1,160 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Busy-poll policy for translator execution contexts.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxBusyPoll.tmh"
+#include "NxBusyPoll.hpp"
+
+// The packet rate used by the adaptive mode is measured over windows of
+// this many milliseconds.
+#define BUSY_POLL_RATE_WINDOW_MS 1
+
+void
+NxBusyPoll::Initialize(
+    ULONG BudgetInMicroseconds,
+    ULONG BudgetInIterations,
+    ULONG AdaptivePacketRateThreshold
+    )
+{
+    m_enabled = BudgetInMicroseconds != 0 || BudgetInIterations != 0;
+
+    if (!m_enabled)
+    {
+        return;
+    }
+
+    m_rateWindowStart = NxQueryPerformanceCounter(&m_frequency);
+    m_budgetInTicks = BudgetInMicroseconds * m_frequency / 1000000;
+    m_budgetInIterations = BudgetInIterations;
+
+    m_packetRateThreshold = AdaptivePacketRateThreshold;
+    m_packetRateAboveThreshold = m_packetRateThreshold == 0;
+}
+
+bool
+NxBusyPoll::ShouldPoll(
+    ULONG64 Packets
+    )
+{
+    if (!m_enabled)
+    {
+        return false;
+    }
+
+    auto const now = NxQueryPerformanceCounter(nullptr);
+
+    if (m_packetRateThreshold != 0)
+    {
+        UpdatePacketRate(now, Packets);
+    }
+
+    if (Packets != 0)
+    {
+        if (m_pollStart != 0)
+        {
+            m_counters.PollsWithWork++;
+            m_pollStart = 0;
+        }
+
+        m_budgetExhausted = false;
+        return false;
+    }
+
+    // Once the budget is spent the EC goes to sleep, don't start polling
+    // again until it finds work
+    if (m_budgetExhausted)
+    {
+        return false;
+    }
+
+    if (!m_packetRateAboveThreshold)
+    {
+        m_counters.SuppressedByPacketRate++;
+        return false;
+    }
+
+    if (m_pollStart == 0)
+    {
+        m_pollStart = now;
+        m_pollIterations = 0;
+    }
+
+    m_pollIterations++;
+
+    auto const outOfIterations = m_budgetInIterations != 0 && m_pollIterations > m_budgetInIterations;
+    auto const outOfTime = m_budgetInTicks != 0 && now - m_pollStart > m_budgetInTicks;
+
+    if (outOfIterations || outOfTime)
+    {
+        m_counters.BudgetExhausted++;
+        m_pollStart = 0;
+        m_budgetExhausted = true;
+        return false;
+    }
+
+    m_counters.Polls++;
+
+    return true;
+}
+
+void
+NxBusyPoll::UpdatePacketRate(
+    ULONG64 Now,
+    ULONG64 Packets
+    )
+{
+    m_rateWindowPackets += Packets;
+
+    auto const elapsed = Now - m_rateWindowStart;
+
+    if (elapsed < m_frequency * BUSY_POLL_RATE_WINDOW_MS / 1000)
+    {
+        return;
+    }
+
+    m_packetRate = m_rateWindowPackets * m_frequency / elapsed;
+    m_packetRateAboveThreshold = m_packetRate >= m_packetRateThreshold;
+
+    m_rateWindowStart = Now;
+    m_rateWindowPackets = 0;
+}
+
+bool
+NxBusyPoll::IsEnabled(
+    void
+    ) const
+{
+    return m_enabled;
+}
+
+ULONG64
+NxBusyPoll::GetPacketRate(
+    void
+    ) const
+{
+    return m_packetRate;
+}
+
+NxBusyPollCounters
+NxBusyPoll::GetCounters(
+    void
+    ) const
+{
+    return m_counters;
+}
+
+void
+NxBusyPoll::ResetCounters(
+    void
+    )
+{
+    m_counters = {};
+}
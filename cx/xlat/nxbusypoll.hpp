@@ -0,0 +1,94 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Busy-poll policy for translator execution contexts.
+
+    When an EC iteration makes no progress the EC normally arms its
+    notifications and parks, and the next packet pays for a full wake up.
+    With a busy-poll budget the EC instead keeps running iterations (which
+    advance the NIC and poll the NBL queue) until it finds work or the
+    budget runs out. In adaptive mode polling is only allowed while the
+    queue's packet rate is above a threshold.
+
+--*/
+
+#pragma once
+
+struct NxBusyPollCounters
+{
+    ULONG64 Polls = 0; // idle iterations that polled instead of parking
+    ULONG64 PollsWithWork = 0; // polling runs that found work
+    ULONG64 BudgetExhausted = 0; // polling runs that ended in arming notifications
+    ULONG64 SuppressedByPacketRate = 0; // idle iterations not polled because of the adaptive threshold
+};
+
+class NxBusyPoll
+{
+public:
+
+    void
+    Initialize(
+        _In_ ULONG BudgetInMicroseconds,
+        _In_ ULONG BudgetInIterations,
+        _In_ ULONG AdaptivePacketRateThreshold
+        );
+
+    // Called once per EC iteration with the number of packets it moved.
+    // Returns true if the EC should run another iteration instead of arming
+    // notifications and going to sleep.
+    bool
+    ShouldPoll(
+        _In_ ULONG64 Packets
+        );
+
+    bool
+    IsEnabled(
+        void
+        ) const;
+
+    ULONG64
+    GetPacketRate(
+        void
+        ) const;
+
+    NxBusyPollCounters
+    GetCounters(
+        void
+        ) const;
+
+    void
+    ResetCounters(
+        void
+        );
+
+private:
+
+    void
+    UpdatePacketRate(
+        _In_ ULONG64 Now,
+        _In_ ULONG64 Packets
+        );
+
+    bool m_enabled = false;
+
+    ULONG64 m_frequency = 1;
+    ULONG64 m_budgetInTicks = 0;
+    ULONG m_budgetInIterations = 0;
+
+    // current polling run, m_pollStart is zero when not polling
+    ULONG64 m_pollStart = 0;
+    ULONG m_pollIterations = 0;
+    bool m_budgetExhausted = false;
+
+    // adaptive mode
+    ULONG m_packetRateThreshold = 0;
+    bool m_packetRateAboveThreshold = true;
+    ULONG64 m_rateWindowStart = 0;
+    ULONG64 m_rateWindowPackets = 0;
+    ULONG64 m_packetRate = 0;
+
+    NxBusyPollCounters m_counters;
+};
@@ -0,0 +1,239 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Copy engine used by the translators for bulk payload copies.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxCopyEngine.tmh"
+#include "NxCopyEngine.hpp"
+
+// Kernel code may only use the XMM registers without saving the extended
+// processor state on x64
+#if defined(_M_AMD64)
+#  include <emmintrin.h>
+#  define NX_COPY_ENGINE_STREAMING 1
+#endif
+
+#ifdef NX_COPY_ENGINE_STREAMING
+
+static
+void
+CopyMemoryStreaming(
+    _Out_writes_bytes_(Length) void * Destination,
+    _In_reads_bytes_(Length) void const * Source,
+    _In_ size_t Length
+    )
+{
+    auto destination = static_cast<UCHAR *>(Destination);
+    auto source = static_cast<UCHAR const *>(Source);
+
+    // Non-temporal stores need an aligned destination, copy up to the
+    // first 16 byte boundary with regular stores
+    size_t const head = min(Length, (16 - (reinterpret_cast<ULONG_PTR>(destination) & 15)) & 15);
+
+    RtlCopyMemory(destination, source, head);
+    destination += head;
+    source += head;
+    Length -= head;
+
+    for (; Length >= 64; Length -= 64, destination += 64, source += 64)
+    {
+        auto const x0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(source));
+        auto const x1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(source + 16));
+        auto const x2 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(source + 32));
+        auto const x3 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(source + 48));
+
+        _mm_stream_si128(reinterpret_cast<__m128i *>(destination), x0);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(destination + 16), x1);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(destination + 32), x2);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(destination + 48), x3);
+    }
+
+    for (; Length >= 16; Length -= 16, destination += 16, source += 16)
+    {
+        _mm_stream_si128(
+            reinterpret_cast<__m128i *>(destination),
+            _mm_loadu_si128(reinterpret_cast<__m128i const *>(source)));
+    }
+
+    RtlCopyMemory(destination, source, Length);
+
+    // Non-temporal stores are weakly ordered, make sure they are visible
+    // before the NIC is told about the buffer
+    _mm_sfence();
+}
+
+#endif
+
+_Use_decl_annotations_
+void
+NxCopyEngine::Initialize(
+    size_t StreamingThreshold
+    )
+{
+    m_streamingThreshold = StreamingThreshold;
+    m_variant = NxCopyEngineVariant::Cached;
+
+#ifdef NX_COPY_ENGINE_STREAMING
+#if _KERNEL_MODE
+    auto const sse2 = ExIsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#else
+    auto const sse2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+
+    if (sse2 && m_streamingThreshold != 0)
+    {
+        m_variant = NxCopyEngineVariant::Streaming;
+    }
+#endif
+}
+
+_Use_decl_annotations_
+bool
+NxCopyEngine::ShouldStream(
+    size_t Length
+    ) const
+{
+    return m_variant == NxCopyEngineVariant::Streaming && Length >= m_streamingThreshold;
+}
+
+_Use_decl_annotations_
+void
+NxCopyEngine::Copy(
+    void * Destination,
+    void const * Source,
+    size_t Length,
+    NxCopyHint Hint
+    )
+{
+#ifdef NX_COPY_ENGINE_STREAMING
+    if (Hint == NxCopyHint::Streaming && m_variant == NxCopyEngineVariant::Streaming)
+    {
+        CopyMemoryStreaming(Destination, Source, Length);
+        m_counters.StreamedBytes += Length;
+        return;
+    }
+#else
+    UNREFERENCED_PARAMETER(Hint);
+#endif
+
+    RtlCopyMemory(Destination, Source, Length);
+    m_counters.CachedBytes += Length;
+}
+
+static
+UINT16
+FoldChecksum(
+    _In_ ULONG64 Sum
+    )
+{
+    while (Sum >> 16)
+    {
+        Sum = (Sum & 0xffff) + (Sum >> 16);
+    }
+
+    return static_cast<UINT16>(Sum);
+}
+
+_Use_decl_annotations_
+void
+NxOnesComplementSum::Add(
+    ULONG64 PartialSum,
+    size_t Length
+    )
+{
+    auto folded = FoldChecksum(PartialSum);
+
+    // The piece starts on the high byte of a word, every one of its bytes
+    // weighs 256 times what the partial sum assumed
+    if (m_odd)
+    {
+        folded = static_cast<UINT16>((folded << 8) | (folded >> 8));
+    }
+
+    m_sum += folded;
+    m_odd = m_odd != ((Length & 1) != 0);
+}
+
+UINT16
+NxOnesComplementSum::Fold(
+    void
+    ) const
+{
+    return FoldChecksum(m_sum);
+}
+
+_Use_decl_annotations_
+void
+NxCopyEngine::CopyAndChecksum(
+    void * Destination,
+    void const * Source,
+    size_t Length,
+    NxOnesComplementSum & Sum
+    )
+{
+    auto destination = static_cast<UCHAR *>(Destination);
+    auto source = static_cast<UCHAR const *>(Source);
+    auto remain = Length;
+
+    // Two 32-bit halves per 8 byte load, the 64-bit accumulator can't
+    // overflow for anything close to a packet
+    ULONG64 sum = 0;
+
+    for (; remain >= 8; remain -= 8, destination += 8, source += 8)
+    {
+        auto const value = *reinterpret_cast<UINT64 UNALIGNED const *>(source);
+        *reinterpret_cast<UINT64 UNALIGNED *>(destination) = value;
+
+        sum += (value & 0xffffffff) + (value >> 32);
+    }
+
+    for (; remain >= 2; remain -= 2, destination += 2, source += 2)
+    {
+        auto const value = *reinterpret_cast<UINT16 UNALIGNED const *>(source);
+        *reinterpret_cast<UINT16 UNALIGNED *>(destination) = value;
+
+        sum += value;
+    }
+
+    if (remain > 0)
+    {
+        *destination = *source;
+        sum += *source;
+    }
+
+    Sum.Add(sum, Length);
+
+    m_counters.CachedBytes += Length;
+    m_counters.ChecksummedBytes += Length;
+}
+
+NxCopyEngineVariant
+NxCopyEngine::GetVariant(
+    void
+    ) const
+{
+    return m_variant;
+}
+
+NxCopyEngineCounters
+NxCopyEngine::GetCounters(
+    void
+    ) const
+{
+    return m_counters;
+}
+
+void
+NxCopyEngine::ResetCounters(
+    void
+    )
+{
+    m_counters = {};
+}
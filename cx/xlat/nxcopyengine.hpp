@@ -0,0 +1,135 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Copy engine used by the translators for bulk payload copies.
+
+    Two kinds of copies are available and the caller picks one per copy:
+
+        Cached      Plain RtlCopyMemory. Meant for data the CPU reads next,
+                    such as packet headers the layout parser looks at right
+                    after a bounce.
+
+        Streaming   Non-temporal SSE2 stores that bypass the cache on the
+                    destination. Meant for large payloads only the NIC
+                    reads, copying them through the cache evicts data the
+                    datapath is about to use.
+
+    The engine is selected at initialization from the processor features.
+    When streaming copies are not supported every copy is a cached one.
+
+    CopyAndChecksum is a cached copy that also accumulates the Internet
+    checksum of the data it moves, so that a payload that is bounced and
+    checksummed in software is only read once.
+
+--*/
+
+#pragma once
+
+enum class NxCopyEngineVariant : UINT32
+{
+    Cached = 0,
+    Streaming,
+};
+
+enum class NxCopyHint
+{
+    Cached,
+    Streaming,
+};
+
+struct NxCopyEngineCounters
+{
+    ULONG64 CachedBytes = 0;
+    ULONG64 StreamedBytes = 0;
+    ULONG64 ChecksummedBytes = 0;
+};
+
+// Ones' complement sum (RFC 1071) accumulated over consecutive pieces of
+// data. Pieces may have any length, the sum keeps track of which byte of
+// a 16-bit word the next piece starts at.
+class NxOnesComplementSum
+{
+public:
+
+    // Adds the sum of Length bytes, computed as if they started on a word
+    // boundary, by adding them in native byte order
+    void
+    Add(
+        _In_ ULONG64 PartialSum,
+        _In_ size_t Length
+        );
+
+    // The folded sum in native byte order. Stored as is, it reads correctly
+    // in network byte order
+    UINT16
+    Fold(
+        void
+        ) const;
+
+private:
+
+    ULONG64 m_sum = 0;
+
+    // An odd number of bytes has been added so far
+    bool m_odd = false;
+};
+
+class NxCopyEngine
+{
+public:
+
+    // A zero threshold disables streaming copies
+    void
+    Initialize(
+        _In_ size_t StreamingThreshold
+        );
+
+    // True if a payload of Length bytes is large enough for the part the
+    // CPU won't read again to be streamed
+    bool
+    ShouldStream(
+        _In_ size_t Length
+        ) const;
+
+    void
+    Copy(
+        _Out_writes_bytes_(Length) void * Destination,
+        _In_reads_bytes_(Length) void const * Source,
+        _In_ size_t Length,
+        _In_ NxCopyHint Hint
+        );
+
+    void
+    CopyAndChecksum(
+        _Out_writes_bytes_(Length) void * Destination,
+        _In_reads_bytes_(Length) void const * Source,
+        _In_ size_t Length,
+        _Inout_ NxOnesComplementSum & Sum
+        );
+
+    NxCopyEngineVariant
+    GetVariant(
+        void
+        ) const;
+
+    NxCopyEngineCounters
+    GetCounters(
+        void
+        ) const;
+
+    void
+    ResetCounters(
+        void
+        );
+
+private:
+
+    NxCopyEngineVariant m_variant = NxCopyEngineVariant::Cached;
+
+    size_t m_streamingThreshold = 0;
+
+    NxCopyEngineCounters m_counters;
+};
@@ -0,0 +1,591 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Implements a pool of per-processor workers that run translator queues
+    as schedulable tasks.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxDatapathScheduler.tmh"
+#include "NxDatapathScheduler.hpp"
+
+static EC_START_ROUTINE NetAdapterDatapathWorkerThread;
+
+static
+EC_RETURN
+NetAdapterDatapathWorkerThread(
+    PVOID StartContext
+    )
+{
+    reinterpret_cast<NxDatapathWorker*>(StartContext)->WorkerThread();
+    return EC_RETURN();
+}
+
+_Use_decl_annotations_
+NxDatapathTask::NxDatapathTask(
+    NxDatapathScheduler & Scheduler,
+    INxExecutionContextQueue & Queue,
+    NxExecutionContext & Context,
+    ULONG HomeWorker
+    ) :
+    m_scheduler(Scheduler),
+    m_queue(Queue),
+    m_context(Context),
+    m_homeWorker(HomeWorker)
+{
+}
+
+void
+NxDatapathTask::SignalWork()
+{
+    auto state = m_state;
+
+    while (true)
+    {
+        LONG newState;
+
+        switch (state)
+        {
+
+        case TaskState::Idle:
+            newState = TaskState::Queued;
+            break;
+
+        case TaskState::Running:
+            newState = TaskState::RunningSignaled;
+            break;
+
+        default:
+            // Already going to run
+            return;
+
+        }
+
+        auto const priorState = InterlockedCompareExchange(&m_state, newState, state);
+
+        if (priorState == state)
+        {
+            if (newState == TaskState::Queued)
+            {
+                m_scheduler.Schedule(*this);
+            }
+
+            return;
+        }
+
+        state = priorState;
+    }
+}
+
+_Use_decl_annotations_
+void
+NxDatapathTask::SetGroupAffinity(
+    GROUP_AFFINITY const & GroupAffinity
+    )
+{
+    // Move the task rather than the worker running it, it is picked up by
+    // its new home worker the next time it is queued
+    ULONG homeWorker;
+
+    if (m_scheduler.FindWorker(GroupAffinity, homeWorker))
+    {
+        m_homeWorker = homeWorker;
+    }
+}
+
+ULONG
+NxDatapathTask::GetExecutionContextIdentifier() const
+{
+    return m_executionContextIdentifier;
+}
+
+void
+NxDatapathTask::Release()
+{
+    // The queue has been stopped, but a late notification may still have
+    // the task queued or running
+    while (InterlockedCompareExchange(&m_state, TaskState::Removed, TaskState::Idle) != TaskState::Idle)
+    {
+        YieldProcessor();
+    }
+
+    InterlockedDecrement(&m_scheduler.m_numberOfTasks);
+
+    delete this;
+}
+
+bool
+NxDatapathTask::Run()
+{
+    // Mirrors the loop of a dedicated EC: start, then iterate, halt if no
+    // progress was made, and check for wind down after every wake up
+    if (! m_started)
+    {
+        if (! m_context.IsRunning())
+        {
+            return false;
+        }
+
+        m_queue.EcStart();
+        m_started = true;
+        m_halted = false;
+    }
+    else
+    {
+        if (m_halted)
+        {
+            m_queue.EcResumeFromHalt();
+            m_halted = false;
+        }
+
+        if (m_queue.EcWindDown())
+        {
+            m_started = false;
+            return false;
+        }
+    }
+
+    m_queue.EcRunIteration();
+
+    if (m_queue.EcPrepareToHalt())
+    {
+        m_halted = true;
+        return false;
+    }
+
+    return true;
+}
+
+_Use_decl_annotations_
+NxDatapathWorker::NxDatapathWorker(
+    NxDatapathScheduler & Scheduler,
+    ULONG Index
+    ) :
+    m_scheduler(Scheduler),
+    m_index(Index)
+{
+#if _KERNEL_MODE
+    (void)KeGetProcessorNumberFromIndex(Index, &m_processor);
+#endif
+}
+
+NxDatapathWorker::~NxDatapathWorker()
+{
+    // Waits until the EC completely exits
+    m_executionContext.Terminate();
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxDatapathWorker::Initialize(
+    NET_LUID NetworkInterface
+    )
+{
+    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+        m_executionContext.Initialize(this, NetAdapterDatapathWorkerThread),
+        "Failed to start datapath worker. NxDatapathWorker=%p", this);
+
+    m_executionContext.SetDebugNameHint(L"Datapath worker", m_index, NetworkInterface);
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+ULONG
+NxDatapathWorker::Push(
+    NxDatapathTask & Task
+    )
+{
+    KAcquireSpinLock lock(m_lock);
+
+    NT_ASSERT(m_count < NX_DATAPATH_SCHEDULER_MAX_TASKS);
+
+    m_deque[(m_top + m_count) % NX_DATAPATH_SCHEDULER_MAX_TASKS] = &Task;
+    m_count++;
+
+    return m_count;
+}
+
+// The owner runs its tasks round-robin so that a queue that keeps making
+// progress can't starve the others homed on the same worker
+_Use_decl_annotations_
+NxDatapathTask *
+NxDatapathWorker::Pop()
+{
+    KAcquireSpinLock lock(m_lock);
+
+    if (m_count == 0)
+    {
+        return nullptr;
+    }
+
+    auto task = m_deque[m_top];
+
+    m_top = (m_top + 1) % NX_DATAPATH_SCHEDULER_MAX_TASKS;
+    m_count--;
+
+    return task;
+}
+
+// A thief takes the task the owner would get to last
+_Use_decl_annotations_
+NxDatapathTask *
+NxDatapathWorker::Steal()
+{
+    KAcquireSpinLock lock(m_lock);
+
+    if (m_count == 0)
+    {
+        return nullptr;
+    }
+
+    m_count--;
+
+    return m_deque[(m_top + m_count) % NX_DATAPATH_SCHEDULER_MAX_TASKS];
+}
+
+void
+NxDatapathWorker::WorkerThread()
+{
+    m_scheduler.SetupWorkerThreadProperties(*this);
+
+    while (! m_executionContext.IsTerminated())
+    {
+        while (true)
+        {
+            auto task = m_scheduler.FindTask(*this);
+
+            if (! task)
+            {
+                if (m_executionContext.IsStopping())
+                {
+                    m_executionContext.SignalStopped();
+                    break;
+                }
+
+                // Advertise as idle before looking once more, a task queued
+                // after this point is either found now or wakes this worker
+                m_scheduler.SetWorkerIdle(*this, true);
+
+                task = m_scheduler.FindTask(*this);
+
+                if (! task)
+                {
+                    m_executionContext.WaitForWork();
+                }
+
+                m_scheduler.SetWorkerIdle(*this, false);
+
+                if (! task)
+                {
+                    continue;
+                }
+            }
+
+            m_scheduler.RunTask(*this, *task);
+        }
+    }
+}
+
+NxDatapathScheduler::~NxDatapathScheduler()
+{
+    NT_ASSERT(m_numberOfTasks == 0);
+
+    // Workers look at each other's deques, so all of them are stopped
+    // before any is destroyed
+    for (auto & worker : m_workers)
+    {
+        if (worker->m_started)
+        {
+            worker->m_executionContext.Cancel();
+        }
+    }
+
+    for (auto & worker : m_workers)
+    {
+        if (worker->m_started)
+        {
+            worker->m_executionContext.Stop();
+            worker->m_started = false;
+        }
+    }
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxDatapathScheduler::Initialize(
+    ULONG NumberOfWorkers,
+    ULONG ThreadPriority,
+    NET_LUID NetworkInterface
+    )
+{
+    m_threadPriority = ThreadPriority;
+
+#if _KERNEL_MODE
+    ULONG const numberOfProcessors = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#else
+    ULONG const numberOfProcessors = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+#endif
+
+    auto numberOfWorkers = NumberOfWorkers;
+
+    if (numberOfWorkers > numberOfProcessors)
+    {
+        numberOfWorkers = numberOfProcessors;
+    }
+
+    if (numberOfWorkers > NX_DATAPATH_SCHEDULER_MAX_WORKERS)
+    {
+        numberOfWorkers = NX_DATAPATH_SCHEDULER_MAX_WORKERS;
+    }
+
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_workers.reserve(numberOfWorkers));
+
+    for (ULONG i = 0; i < numberOfWorkers; i++)
+    {
+        auto worker = wil::make_unique_nothrow<NxDatapathWorker>(*this, i);
+
+        CX_RETURN_NTSTATUS_IF(
+            STATUS_INSUFFICIENT_RESOURCES,
+            ! worker);
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(
+            worker->Initialize(NetworkInterface));
+
+        NT_FRE_ASSERT(m_workers.append(wistd::move(worker)));
+    }
+
+    // Workers steal from each other, so none starts before all exist
+    for (auto & worker : m_workers)
+    {
+        worker->m_executionContext.Start();
+        worker->m_started = true;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxDatapathScheduler::AddQueue(
+    INxExecutionContextQueue & Queue,
+    NxExecutionContext & QueueContext
+    )
+{
+    NT_ASSERT(m_workers.count() != 0);
+
+    if (InterlockedIncrement(&m_numberOfTasks) > NX_DATAPATH_SCHEDULER_MAX_TASKS)
+    {
+        InterlockedDecrement(&m_numberOfTasks);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // Spread the queues over the workers until they are given an affinity
+    auto const homeWorker =
+        static_cast<ULONG>(InterlockedIncrement(&m_nextHomeWorker) - 1) % m_workers.count();
+
+    auto task = wil::make_unique_nothrow<NxDatapathTask>(*this, Queue, QueueContext, homeWorker);
+
+    if (! task)
+    {
+        InterlockedDecrement(&m_numberOfTasks);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // From now on the task is owned by the queue's EC, which releases it
+    // when terminated
+    QueueContext.InitializeShared(*task.release());
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+void
+NxDatapathScheduler::Schedule(
+    NxDatapathTask & Task
+    )
+{
+    auto & homeWorker = *m_workers[Task.m_homeWorker];
+
+    (void)homeWorker.Push(Task);
+    homeWorker.m_executionContext.SignalWork();
+
+    // If the home worker is busy let an idle one steal the task
+    if (! IsWorkerIdle(homeWorker.m_index))
+    {
+        WakeIdleWorker();
+    }
+}
+
+_Use_decl_annotations_
+void
+NxDatapathScheduler::RunTask(
+    NxDatapathWorker & Worker,
+    NxDatapathTask & Task
+    )
+{
+    // Queued tasks can't change state, SignalWork has nothing to do and
+    // Release waits for them to go idle
+    auto const priorState = InterlockedExchange(&Task.m_state, NxDatapathTask::Running);
+    UNREFERENCED_PARAMETER(priorState);
+    NT_ASSERT(priorState == NxDatapathTask::Queued);
+
+    Task.m_executionContextIdentifier = Worker.m_executionContext.GetExecutionContextIdentifier();
+
+    if (! Task.Run())
+    {
+        // Go idle unless a notification came in while running, the
+        // equivalent of a dedicated EC waking up right after it halted
+        auto const state = InterlockedCompareExchange(
+            &Task.m_state,
+            NxDatapathTask::Idle,
+            NxDatapathTask::Running);
+
+        if (state == NxDatapathTask::Running)
+        {
+            return;
+        }
+
+        NT_ASSERT(state == NxDatapathTask::RunningSignaled);
+    }
+
+    (void)InterlockedExchange(&Task.m_state, NxDatapathTask::Queued);
+
+    if (Task.m_homeWorker != Worker.m_index)
+    {
+        Schedule(Task);
+        return;
+    }
+
+    // The home worker is running and picks the task up again once it gets
+    // through the rest of its deque, only another task waiting behind it
+    // is worth waking an idle worker for. Waking one for the task alone
+    // would move a hot queue away from its processor on every iteration.
+    if (Worker.Push(Task) > 1)
+    {
+        WakeIdleWorker();
+    }
+}
+
+_Use_decl_annotations_
+NxDatapathTask *
+NxDatapathScheduler::FindTask(
+    NxDatapathWorker & Worker
+    )
+{
+    auto task = Worker.Pop();
+
+    if (task)
+    {
+        return task;
+    }
+
+    auto const numberOfWorkers = m_workers.count();
+
+    for (size_t i = 1; i < numberOfWorkers; i++)
+    {
+        task = m_workers[(Worker.m_index + i) % numberOfWorkers]->Steal();
+
+        if (task)
+        {
+            return task;
+        }
+    }
+
+    return nullptr;
+}
+
+void
+NxDatapathScheduler::WakeIdleWorker()
+{
+    ULONG index;
+    auto idleWorkers = static_cast<ULONG64>(m_idleWorkers);
+
+    while (BitScanForward64(&index, idleWorkers))
+    {
+        // Claim the worker so that concurrent calls wake different ones
+        if (InterlockedBitTestAndReset64(&m_idleWorkers, index))
+        {
+            m_workers[index]->m_executionContext.SignalWork();
+            return;
+        }
+
+        idleWorkers = static_cast<ULONG64>(m_idleWorkers);
+    }
+}
+
+_Use_decl_annotations_
+void
+NxDatapathScheduler::SetWorkerIdle(
+    NxDatapathWorker const & Worker,
+    bool Idle
+    )
+{
+    auto const mask = static_cast<LONG64>(1ULL << Worker.m_index);
+
+    if (Idle)
+    {
+        (void)InterlockedOr64(&m_idleWorkers, mask);
+    }
+    else
+    {
+        (void)InterlockedAnd64(&m_idleWorkers, ~mask);
+    }
+}
+
+_Use_decl_annotations_
+bool
+NxDatapathScheduler::IsWorkerIdle(
+    ULONG Index
+    ) const
+{
+    return (static_cast<ULONG64>(m_idleWorkers) & (1ULL << Index)) != 0;
+}
+
+_Use_decl_annotations_
+bool
+NxDatapathScheduler::FindWorker(
+    GROUP_AFFINITY const & GroupAffinity,
+    ULONG & Index
+    ) const
+{
+    for (ULONG i = 0; i < m_workers.count(); i++)
+    {
+        auto const & processor = m_workers[i]->m_processor;
+
+        if (processor.Group == GroupAffinity.Group &&
+            (GroupAffinity.Mask & AFFINITY_MASK(processor.Number)) != 0)
+        {
+            Index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+_Use_decl_annotations_
+void
+NxDatapathScheduler::SetupWorkerThreadProperties(
+    NxDatapathWorker const & Worker
+    ) const
+{
+#if _KERNEL_MODE
+    KeSetBasePriorityThread(KeGetCurrentThread(), m_threadPriority - (LOW_REALTIME_PRIORITY + LOW_PRIORITY) / 2);
+
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = Worker.m_processor.Group;
+    affinity.Mask = AFFINITY_MASK(Worker.m_processor.Number);
+
+    KeSetSystemGroupAffinityThread(&affinity, nullptr);
+#else
+    UNREFERENCED_PARAMETER(Worker);
+#endif
+}
@@ -0,0 +1,279 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Defines a pool of per-processor workers that run translator queues as
+    schedulable tasks instead of giving every queue its own thread.
+
+    Each queue's EC is hosted by an NxDatapathTask. A task is queued on the
+    deque of its home worker whenever one of the queue's notifications
+    fires, and re-queued after an iteration that made progress. A worker
+    runs the tasks on its own deque round-robin and, once that is empty,
+    steals the most recently queued task of another worker, so that a
+    worker busy with a hot queue does not hold back the other queues homed
+    on it while processors sit idle.
+
+    A task is run by at most one worker at a time, which preserves the
+    single-threaded execution every queue relies on.
+
+--*/
+
+#pragma once
+
+#include <KArray.h>
+#include <KSpinLock.h>
+
+#include "NxQueueScheduler.hpp"
+
+// The idle worker set is a 64-bit mask
+#define NX_DATAPATH_SCHEDULER_MAX_WORKERS 64
+
+// Every task is queued on at most one deque at a time, so a deque never
+// holds more than the number of tasks
+#define NX_DATAPATH_SCHEDULER_MAX_TASKS 128
+
+class NxDatapathScheduler;
+class NxDatapathWorker;
+
+class NxDatapathTask :
+    public INxExecutionContextHost,
+    public NxNonpagedAllocation<'tSdN'>
+{
+    friend class NxDatapathScheduler;
+
+public:
+
+    NxDatapathTask(
+        _In_ NxDatapathScheduler & Scheduler,
+        _In_ INxExecutionContextQueue & Queue,
+        _In_ NxExecutionContext & Context,
+        _In_ ULONG HomeWorker
+        );
+
+    //
+    // INxExecutionContextHost
+    //
+
+    virtual
+    void
+    SignalWork(
+        void
+        );
+
+    virtual
+    void
+    SetGroupAffinity(
+        _In_ GROUP_AFFINITY const & GroupAffinity
+        );
+
+    virtual
+    ULONG
+    GetExecutionContextIdentifier(
+        void
+        ) const;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    virtual
+    void
+    Release(
+        void
+        );
+
+private:
+
+    enum TaskState : LONG
+    {
+        Idle,
+        Queued,
+        Running,
+        // Signalled while running, runs again once the current run is over
+        RunningSignaled,
+        Removed,
+    };
+
+    // Runs one step of the queue. Returns true if the task should be
+    // queued again right away, false if it can wait for a notification.
+    bool
+    Run(
+        void
+        );
+
+    NxDatapathScheduler & m_scheduler;
+    INxExecutionContextQueue & m_queue;
+    NxExecutionContext & m_context;
+
+    _Interlocked_ volatile
+    LONG m_state = TaskState::Idle;
+
+    // Worker whose deque the task is queued on
+    volatile ULONG m_homeWorker;
+
+    // Thread id of the worker that ran the task last
+    ULONG m_executionContextIdentifier = 0;
+
+    // Only touched by the worker running the task
+    bool m_started = false;
+    bool m_halted = false;
+};
+
+class NxDatapathWorker :
+    public NxNonpagedAllocation<'wSdN'>
+{
+    friend class NxDatapathScheduler;
+
+public:
+
+    NxDatapathWorker(
+        _In_ NxDatapathScheduler & Scheduler,
+        _In_ ULONG Index
+        );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    ~NxDatapathWorker(
+        void
+        );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    Initialize(
+        _In_ NET_LUID NetworkInterface
+        );
+
+    void
+    WorkerThread(
+        void
+        );
+
+private:
+
+    // Returns the number of tasks on the deque, including this one
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    ULONG
+    Push(
+        _In_ NxDatapathTask & Task
+        );
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NxDatapathTask *
+    Pop(
+        void
+        );
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NxDatapathTask *
+    Steal(
+        void
+        );
+
+    NxDatapathScheduler & m_scheduler;
+    ULONG const m_index;
+    PROCESSOR_NUMBER m_processor = {};
+
+    KSpinLock m_lock;
+    NxDatapathTask * m_deque[NX_DATAPATH_SCHEDULER_MAX_TASKS] = {};
+    ULONG m_top = 0;
+    ULONG m_count = 0;
+
+    NxExecutionContext m_executionContext;
+    bool m_started = false;
+};
+
+class NxDatapathScheduler :
+    public INxQueueScheduler,
+    public NxNonpagedAllocation<'hSdN'>
+{
+    friend class NxDatapathTask;
+    friend class NxDatapathWorker;
+
+public:
+
+    /// All hosted queues must have been destroyed
+    _IRQL_requires_(PASSIVE_LEVEL)
+    ~NxDatapathScheduler(
+        void
+        );
+
+    /// Starts one worker per processor, up to NumberOfWorkers
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    Initialize(
+        _In_ ULONG NumberOfWorkers,
+        _In_ ULONG ThreadPriority,
+        _In_ NET_LUID NetworkInterface
+        );
+
+    //
+    // INxQueueScheduler
+    //
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    virtual
+    NTSTATUS
+    AddQueue(
+        _In_ INxExecutionContextQueue & Queue,
+        _Inout_ NxExecutionContext & QueueContext
+        );
+
+private:
+
+    // Queues a task that was moved to the Queued state
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    Schedule(
+        _In_ NxDatapathTask & Task
+        );
+
+    void
+    RunTask(
+        _In_ NxDatapathWorker & Worker,
+        _In_ NxDatapathTask & Task
+        );
+
+    NxDatapathTask *
+    FindTask(
+        _In_ NxDatapathWorker & Worker
+        );
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    WakeIdleWorker(
+        void
+        );
+
+    void
+    SetWorkerIdle(
+        _In_ NxDatapathWorker const & Worker,
+        _In_ bool Idle
+        );
+
+    bool
+    IsWorkerIdle(
+        _In_ ULONG Index
+        ) const;
+
+    bool
+    FindWorker(
+        _In_ GROUP_AFFINITY const & GroupAffinity,
+        _Out_ ULONG & Index
+        ) const;
+
+    void
+    SetupWorkerThreadProperties(
+        _In_ NxDatapathWorker const & Worker
+        ) const;
+
+    Rtl::KArray<wistd::unique_ptr<NxDatapathWorker>, NonPagedPoolNx> m_workers;
+
+    ULONG m_threadPriority = 0;
+
+    _Interlocked_ volatile
+    LONG64 m_idleWorkers = 0;
+
+    _Interlocked_ volatile
+    LONG m_numberOfTasks = 0;
+
+    _Interlocked_ volatile
+    LONG m_nextHomeWorker = 0;
+};
@@ -9,10 +9,8 @@
 
 _Use_decl_annotations_
 DmaContext::DmaContext(
-    void *SGBuffer,
     void *DmaContext
     ) :
-    ScatterGatherBuffer(SGBuffer),
     DmaTransferContext(DmaContext)
 {
 
@@ -90,6 +88,30 @@ NxDmaAdapter::NxDmaAdapter(
 {
 }
 
+NxDmaAdapter::~NxDmaAdapter(
+    void
+    )
+{
+    if (!m_scatterGatherListArena)
+    {
+        return;
+    }
+
+    // A packet whose translation failed and that was never given to the
+    // NIC might still hold a block, return it before the arena goes away
+    auto const counters = m_scatterGatherListArena->GetCounters();
+
+    if (counters.SmallBlocksInUse + counters.LargeBlocksInUse == 0)
+    {
+        return;
+    }
+
+    for (auto i = 0u; i < m_packetRingSize; i++)
+    {
+        FreeScatterGatherBuffer(GetDmaContextForPacket(i));
+    }
+}
+
 _Use_decl_annotations_
 NTSTATUS
 NxDmaAdapter::Initialize(
@@ -123,8 +145,9 @@ NxDmaAdapter::Initialize(
         return STATUS_SUCCESS;
     }
 
-    // Calculate the size of our preallocated scatter gather list. Note that this size is
-    // not always guaranteed to fit the SGL of a mapped NET_PACKET
+    // Calculate the size of the scatter gather list of an MTU sized packet, used for small
+    // arena blocks. Note that this size is not always guaranteed to fit the SGL of a mapped
+    // NET_PACKET
     ULONG ulMaximumPacketSize;
     CX_RETURN_IF_NOT_NT_SUCCESS(
         RtlSizeTToULong(
@@ -140,22 +163,46 @@ NxDmaAdapter::Initialize(
             &m_scatterGatherListSize,
             nullptr));
 
-    // Calculate and allocate the memory needed to hold our preallocated Scatter/Gather lists
-    size_t allocationSize;
+    ULONG largeScatterGatherListSize;
+    CX_RETURN_IF_NOT_NT_SUCCESS(
+        m_dmaAdapter->DmaOperations->CalculateScatterGatherList(
+            m_dmaAdapter,
+            nullptr,
+            ULongToPtr(PAGE_SIZE - 1),
+            max(ulMaximumPacketSize, ULONG{ NX_DMA_LARGE_PACKET_SIZE }),
+            &largeScatterGatherListSize,
+            nullptr));
+
+    // Scatter/Gather lists used to be preallocated with the MTU sized list above for every
+    // packet of the ring. They are now built in arena blocks allocated when a packet is
+    // mapped, at most one block per packet is in use at any time and the arena takes no
+    // more memory than the preallocation did
     CX_RETURN_IF_NOT_NT_SUCCESS(
         RtlSizeTMult(
             m_packetRingSize,
             m_scatterGatherListSize,
-            &allocationSize));
+            &m_preallocatedScatterGatherListBytes));
+
+    ULONG ulPacketRingSize;
+    CX_RETURN_IF_NOT_NT_SUCCESS(
+        RtlSizeTToULong(
+            m_packetRingSize,
+            &ulPacketRingSize));
 
-    m_scatterGatherListBuffer = MakeSizedPoolPtr<UCHAR>('mDxN', allocationSize);
+    m_scatterGatherListArena = wil::make_unique_nothrow<NxScatterGatherListArena>();
 
-    if (!m_scatterGatherListBuffer)
+    if (!m_scatterGatherListArena)
     {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
+    m_scatterGatherListArena->Initialize(
+        m_scatterGatherListSize,
+        largeScatterGatherListSize,
+        ulPacketRingSize);
+
     // Calculate and allocate the memory needed to hold a DMA transfer context for each NET_PACKET
+    size_t allocationSize;
     CX_RETURN_IF_NOT_NT_SUCCESS(
         RtlSizeTMult(
             m_packetRingSize,
@@ -169,7 +216,7 @@ NxDmaAdapter::Initialize(
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    // Initialize each NET_PACKET DMA context with their SGL and DMA transfer pointers
+    // Initialize each NET_PACKET DMA context with their DMA transfer pointers
     CX_RETURN_IF_NOT_NT_SUCCESS(m_dmaContext.Initialize(sizeof(DmaContext)));
 
     for (auto i = 0u; i < m_packetRingSize; i++)
@@ -177,10 +224,23 @@ NxDmaAdapter::Initialize(
         auto &dmaPacketContext = GetDmaContextForPacket(i);
 
         new (&dmaPacketContext) DmaContext(
-            m_scatterGatherListBuffer.get() + i * m_scatterGatherListSize,
             m_dmaTransferBuffer.get() + i * DMA_TRANSFER_CONTEXT_SIZE_V1);
     }
 
+    auto const mappingCachePages = ClientDispatch.NetClientQueryDriverConfigurationUlong(DRIVER_CONFIG_ENUM::TX_DMA_MAPPING_CACHE_PAGES);
+
+    if (mappingCachePages != 0)
+    {
+        m_mappingCache = wil::make_unique_nothrow<NxDmaMappingCache>(*m_dmaAdapter, *m_physicalDeviceObject);
+
+        if (!m_mappingCache)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(m_mappingCache->Initialize(mappingCachePages));
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -226,6 +286,33 @@ NxDmaAdapter::AlwaysBounce(
     return m_alwaysBounce;
 }
 
+NxDmaMappingCache *
+NxDmaAdapter::GetMappingCache(
+    void
+    ) const
+{
+    return m_mappingCache.get();
+}
+
+_Use_decl_annotations_
+void
+NxDmaAdapter::GetScatterGatherListMemoryUsage(
+    size_t &AllocatedBytes,
+    LONG64 &SavedBytes
+    ) const
+{
+    AllocatedBytes = 0;
+    SavedBytes = 0;
+
+    if (m_scatterGatherListArena)
+    {
+        AllocatedBytes = m_scatterGatherListArena->GetCounters().AllocatedBytes;
+        SavedBytes =
+            static_cast<LONG64>(m_preallocatedScatterGatherListBytes) -
+            static_cast<LONG64>(AllocatedBytes);
+    }
+}
+
 _Use_decl_annotations_
 NTSTATUS
 NxDmaAdapter::BuildScatterGatherListEx(
@@ -250,22 +337,80 @@ NxDmaAdapter::BuildScatterGatherListEx(
 
     auto& dmaContext = DmaTransfer.GetTransferContext();
 
-    return m_dmaAdapter->DmaOperations->BuildScatterGatherListEx(
-        m_dmaAdapter,
-        m_physicalDeviceObject,
-        dmaContext.DmaTransferContext,
-        FirstMdl,
-        ulMdlOffset,
-        ulSize,
-        DMA_SYNCHRONOUS_CALLBACK,
-        nullptr, // ExecutionRoutine
-        nullptr, // Context
-        TRUE,
-        dmaContext.ScatterGatherBuffer,
-        m_scatterGatherListSize,
-        nullptr, // DmaCompletionRoutine
-        nullptr, // CompletionContext
-        ScatterGatherList);
+    // Failed attempts to map the packet return their block
+    NT_ASSERT(dmaContext.ScatterGatherBuffer == nullptr);
+
+    auto large = Size > m_maximumPacketSize;
+
+    while (true)
+    {
+        dmaContext.ScatterGatherBuffer = m_scatterGatherListArena->Allocate(
+            large,
+            dmaContext.ScatterGatherBufferSize);
+
+        if (dmaContext.ScatterGatherBuffer == nullptr)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        auto const status = m_dmaAdapter->DmaOperations->BuildScatterGatherListEx(
+            m_dmaAdapter,
+            m_physicalDeviceObject,
+            dmaContext.DmaTransferContext,
+            FirstMdl,
+            ulMdlOffset,
+            ulSize,
+            DMA_SYNCHRONOUS_CALLBACK,
+            nullptr, // ExecutionRoutine
+            nullptr, // Context
+            TRUE,
+            dmaContext.ScatterGatherBuffer,
+            dmaContext.ScatterGatherBufferSize,
+            nullptr, // DmaCompletionRoutine
+            nullptr, // CompletionContext
+            ScatterGatherList);
+
+        if (status == STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        FreeScatterGatherBuffer(dmaContext);
+
+        // An MTU sized packet spread over more pages than expected might still fit a large block
+        if (status != STATUS_BUFFER_TOO_SMALL || large || !m_scatterGatherListArena->HasLargeBlocks())
+        {
+            return status;
+        }
+
+        large = true;
+    }
+}
+
+_Use_decl_annotations_
+void
+NxDmaAdapter::FreeScatterGatherBuffer(
+    NxDmaTransfer const &DmaTransfer
+    ) const
+{
+    FreeScatterGatherBuffer(DmaTransfer.GetTransferContext());
+}
+
+_Use_decl_annotations_
+void
+NxDmaAdapter::FreeScatterGatherBuffer(
+    DmaContext &Context
+    ) const
+{
+    if (Context.ScatterGatherBuffer != nullptr)
+    {
+        m_scatterGatherListArena->Free(
+            Context.ScatterGatherBuffer,
+            Context.ScatterGatherBufferSize);
+
+        Context.ScatterGatherBuffer = nullptr;
+        Context.ScatterGatherBufferSize = 0;
+    }
 }
 
 _Use_decl_annotations_
@@ -342,11 +487,41 @@ NxDmaAdapter::CleanupNetPacket(
         return;
     }
 
-    auto& dmaContext = GetDmaContextForPacket(Packet);
+    CleanupDmaContext(GetDmaContextForPacket(Packet));
+}
 
-    if (dmaContext.UnmapMdlChain)
+_Use_decl_annotations_
+void
+NxDmaAdapter::CleanupNetPackets(
+    NetRbPacketRange const &PacketRange
+    ) const
+{
+    if (BypassHal() || AlwaysBounce())
     {
-        for (auto& mdl : dmaContext.MdlChain)
+        // Nothing to cleanup
+        return;
+    }
+
+    auto const spans = PacketRange.Spans();
+
+    for (UINT32 s = 0; s < spans.Count; s++)
+    {
+        for (UINT32 i = 0; i < spans.Span[s].Count(); i++)
+        {
+            CleanupDmaContext(GetDmaContextForPacket(static_cast<size_t>(spans.Span[s].GetIndex() + i)));
+        }
+    }
+}
+
+_Use_decl_annotations_
+void
+NxDmaAdapter::CleanupDmaContext(
+    DmaContext &Context
+    ) const
+{
+    if (Context.UnmapMdlChain)
+    {
+        for (auto& mdl : Context.MdlChain)
         {
             NT_ASSERT(mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
 
@@ -356,14 +531,23 @@ NxDmaAdapter::CleanupNetPacket(
         }
     }
 
-    dmaContext.UnmapMdlChain = false;
-    dmaContext.MdlChain = nullptr;
+    Context.UnmapMdlChain = false;
+    Context.MdlChain = nullptr;
+
+    for (UINT32 i = 0; i < Context.NumberOfCachedMappings; i++)
+    {
+        m_mappingCache->Release(*Context.CachedMappings[i]);
+    }
+
+    Context.NumberOfCachedMappings = 0;
 
-    if (dmaContext.ScatterGatherList != nullptr)
+    if (Context.ScatterGatherList != nullptr)
     {
-        PutScatterGatherList(dmaContext.ScatterGatherList);
-        dmaContext.ScatterGatherList = nullptr;
+        PutScatterGatherList(Context.ScatterGatherList);
+        Context.ScatterGatherList = nullptr;
     }
+
+    FreeScatterGatherBuffer(Context);
 }
 
 void
@@ -374,12 +558,17 @@ NxDmaAdapter::FlushIoBuffers(
     if (!m_flushIoBuffers)
         return;
 
-    for (auto& packet : PacketRange)
+    auto const spans = PacketRange.Spans();
+
+    for (UINT32 s = 0; s < spans.Count; s++)
     {
-        auto& dmaContext = GetDmaContextForPacket(packet);
-        KeFlushIoBuffers(
-            dmaContext.MdlChain,
-            FALSE,
-            TRUE);
+        for (UINT32 i = 0; i < spans.Span[s].Count(); i++)
+        {
+            auto& dmaContext = GetDmaContextForPacket(static_cast<size_t>(spans.Span[s].GetIndex() + i));
+            KeFlushIoBuffers(
+                dmaContext.MdlChain,
+                FALSE,
+                TRUE);
+        }
     }
 }
@@ -2,20 +2,36 @@
 #pragma once
 
 #include "NxContextBuffer.hpp"
+#include "NxDmaMappingCache.hpp"
+#include "NxScatterGatherListArena.hpp"
+
+// A 64KB packet that does not start on a page boundary spans 17 pages,
+// larger packets are mapped through HAL
+#define NX_DMA_MAPPING_CACHE_MAX_PAGES_PER_PACKET 17
+
+// Packets larger than the MTU are mapped using large scatter/gather list
+// blocks, sized for the largest LSO packet
+#define NX_DMA_LARGE_PACKET_SIZE 0x10000
 
 class NxDmaAdapter;
 
 struct DmaContext
 {
-    void * const ScatterGatherBuffer = nullptr;
     void * const DmaTransferContext = nullptr;
 
+    // Arena block HAL built the packet's scatter/gather list in
+    void *ScatterGatherBuffer = nullptr;
+    ULONG ScatterGatherBufferSize = 0;
+
     SCATTER_GATHER_LIST *ScatterGatherList = nullptr;
     MDL *MdlChain = nullptr;
     bool UnmapMdlChain = false;
 
+    // Mappings referenced by a packet mapped from the mapping cache
+    NxDmaMappingCacheEntry *CachedMappings[NX_DMA_MAPPING_CACHE_MAX_PAGES_PER_PACKET] = {};
+    UINT32 NumberOfCachedMappings = 0;
+
     DmaContext(
-        _In_ void *SGBuffer,
         _In_ void *DmaContext
         );
 };
@@ -78,6 +94,10 @@ public:
         _In_ NxRingBuffer const &PacketRing
         ) noexcept;
 
+    ~NxDmaAdapter(
+        void
+        );
+
     NTSTATUS
     Initialize(
         _In_ NET_CLIENT_DISPATCH const &ClientDispatch
@@ -98,6 +118,20 @@ public:
         void
         ) const;
 
+    // nullptr unless the mapping cache is enabled
+    NxDmaMappingCache *
+    GetMappingCache(
+        void
+        ) const;
+
+    // Bytes allocated for scatter/gather lists, and bytes saved compared to
+    // preallocating an MTU sized list for every packet of the ring
+    void
+    GetScatterGatherListMemoryUsage(
+        _Out_ size_t &AllocatedBytes,
+        _Out_ LONG64 &SavedBytes
+        ) const;
+
     NxDmaTransfer
     InitializeDmaTransfer(
         _In_ NET_PACKET const &Packet
@@ -117,6 +151,13 @@ public:
         _In_ SCATTER_GATHER_LIST *ScatterGatherList
         ) const;
 
+    // Returns the block of a transfer that failed after its list was built,
+    // the list must have been put already
+    void
+    FreeScatterGatherBuffer(
+        _In_ NxDmaTransfer const &DmaTransfer
+        ) const;
+
     MDL *
     GetMappedMdl(
         _In_ SCATTER_GATHER_LIST *ScatterGatherList,
@@ -133,6 +174,11 @@ public:
         _In_ NET_PACKET const &Packet
         ) const;
 
+    void
+    CleanupNetPackets(
+        _In_ NetRbPacketRange const &PacketRange
+        ) const;
+
     void
     FlushIoBuffers(
         _In_ NetRbPacketRange const &PacketRange
@@ -145,6 +191,16 @@ private:
         _In_ size_t const &Index
         ) const;
 
+    void
+    FreeScatterGatherBuffer(
+        _Inout_ DmaContext &Context
+        ) const;
+
+    void
+    CleanupDmaContext(
+        _Inout_ DmaContext &Context
+        ) const;
+
 private:
 
     DMA_ADAPTER *m_dmaAdapter = nullptr;
@@ -158,8 +214,14 @@ private:
     size_t m_maximumPacketSize = 0;
 
     ULONG m_scatterGatherListSize = 0;
-    KPoolPtr<UCHAR> m_scatterGatherListBuffer;
+
+    // What preallocating m_scatterGatherListSize bytes per ring slot takes
+    size_t m_preallocatedScatterGatherListBytes = 0;
+    wistd::unique_ptr<NxScatterGatherListArena> m_scatterGatherListArena;
     KPoolPtr<UCHAR> m_dmaTransferBuffer;
 
     NxContextBuffer m_dmaContext;
+
+    // Declared last, so that it is flushed before the rest goes away
+    wistd::unique_ptr<NxDmaMappingCache> m_mappingCache;
 };
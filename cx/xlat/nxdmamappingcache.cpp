@@ -0,0 +1,419 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Cache of long-lived DMA mappings for transmit pages.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxDmaMappingCache.tmh"
+
+#include "NxDmaMappingCache.hpp"
+
+_Use_decl_annotations_
+NxDmaMappingCache::NxDmaMappingCache(
+    DMA_ADAPTER & DmaAdapter,
+    DEVICE_OBJECT & PhysicalDeviceObject
+    ) :
+    m_dmaAdapter(DmaAdapter),
+    m_physicalDeviceObject(PhysicalDeviceObject)
+{
+    InitializeListHead(&m_idleEntries);
+}
+
+NxDmaMappingCache::~NxDmaMappingCache(
+    void
+    )
+{
+    Flush();
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxDmaMappingCache::Initialize(
+    ULONG NumberOfPages
+    )
+{
+    CX_RETURN_IF_NOT_NT_SUCCESS(
+        m_dmaAdapter.DmaOperations->CalculateScatterGatherList(
+            &m_dmaAdapter,
+            nullptr,
+            nullptr,
+            PAGE_SIZE,
+            &m_scatterGatherListSize,
+            nullptr));
+
+    // Every entry has its own single page MDL, DMA transfer context and
+    // scatter/gather list buffer, laid out back to back
+    size_t const mdlSize = ALIGN_UP(MmSizeOfMdl(nullptr, PAGE_SIZE), PVOID);
+    size_t const transferContextSize = ALIGN_UP(DMA_TRANSFER_CONTEXT_SIZE_V1, PVOID);
+    size_t const mappingSize = mdlSize + transferContextSize + m_scatterGatherListSize;
+
+    size_t allocationSize;
+    CX_RETURN_IF_NOT_NT_SUCCESS(
+        RtlSizeTMult(
+            NumberOfPages,
+            mappingSize,
+            &allocationSize));
+
+    m_mappingBuffer = MakeSizedPoolPtr<UCHAR>('cMxN', allocationSize);
+
+    if (!m_mappingBuffer)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    CX_RETURN_IF_NOT_NT_SUCCESS(
+        RtlSizeTMult(
+            NumberOfPages,
+            sizeof(NxDmaMappingCacheEntry),
+            &allocationSize));
+
+    m_entryBuffer = MakeSizedPoolPtr<UCHAR>('cMxN', allocationSize);
+
+    if (!m_entryBuffer)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // A power of two number of buckets, at least as many as entries
+    ULONG numberOfBuckets = 1;
+
+    while (numberOfBuckets < NumberOfPages)
+    {
+        numberOfBuckets <<= 1;
+    }
+
+    m_bucketBuffer = MakeSizedPoolPtr<UCHAR>('cMxN', numberOfBuckets * sizeof(NxDmaMappingCacheEntry *));
+
+    if (!m_bucketBuffer)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    m_buckets = reinterpret_cast<NxDmaMappingCacheEntry **>(m_bucketBuffer.get());
+    m_bucketMask = numberOfBuckets - 1;
+
+    m_recentPageBuffer = MakeSizedPoolPtr<UCHAR>('cMxN', numberOfBuckets * sizeof(PFN_NUMBER));
+
+    if (!m_recentPageBuffer)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    m_recentPages = reinterpret_cast<PFN_NUMBER *>(m_recentPageBuffer.get());
+
+    auto entries = reinterpret_cast<NxDmaMappingCacheEntry *>(m_entryBuffer.get());
+
+    for (ULONG i = 0; i < NumberOfPages; i++)
+    {
+        auto mapping = m_mappingBuffer.get() + i * mappingSize;
+        auto entry = new (&entries[i]) NxDmaMappingCacheEntry();
+
+        entry->Mdl = reinterpret_cast<MDL *>(mapping);
+        entry->DmaTransferContext = mapping + mdlSize;
+        entry->ScatterGatherBuffer = mapping + mdlSize + transferContextSize;
+
+        entry->Next = m_freeEntries;
+        m_freeEntries = entry;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+ULONG
+NxDmaMappingCache::GetBucketIndex(
+    PFN_NUMBER PageFrameNumber
+    ) const
+{
+    // Neighbouring pages are the common case, spread them over the buckets
+    auto const hash = PageFrameNumber ^ (PageFrameNumber >> 7);
+
+    return static_cast<ULONG>(hash & m_bucketMask);
+}
+
+_Use_decl_annotations_
+NxDmaMappingCacheEntry **
+NxDmaMappingCache::GetBucket(
+    PFN_NUMBER PageFrameNumber
+    ) const
+{
+    return &m_buckets[GetBucketIndex(PageFrameNumber)];
+}
+
+_Use_decl_annotations_
+bool
+NxDmaMappingCache::Admit(
+    PFN_NUMBER PageFrameNumber
+    )
+{
+    auto & recentPage = m_recentPages[GetBucketIndex(PageFrameNumber)];
+
+    if (recentPage == PageFrameNumber)
+    {
+        return true;
+    }
+
+    recentPage = PageFrameNumber;
+
+    return false;
+}
+
+_Use_decl_annotations_
+NxDmaMappingCacheEntry *
+NxDmaMappingCache::Lookup(
+    PFN_NUMBER PageFrameNumber
+    ) const
+{
+    for (auto entry = *GetBucket(PageFrameNumber); entry != nullptr; entry = entry->Next)
+    {
+        if (entry->PageFrameNumber == PageFrameNumber)
+        {
+            return entry;
+        }
+    }
+
+    return nullptr;
+}
+
+_Use_decl_annotations_
+NxDmaMappingCacheEntry *
+NxDmaMappingCache::Acquire(
+    PFN_NUMBER PageFrameNumber,
+    void * PageVirtualAddress
+    )
+{
+    auto entry = Lookup(PageFrameNumber);
+
+    if (entry != nullptr)
+    {
+        m_counters.Hits++;
+
+        if (entry->RefCount++ == 0)
+        {
+            RemoveEntryList(&entry->IdleLink);
+        }
+
+        return entry;
+    }
+
+    m_counters.Misses++;
+
+    if (!Admit(PageFrameNumber))
+    {
+        m_counters.NotAdmitted++;
+        return nullptr;
+    }
+
+    entry = m_freeEntries;
+
+    if (entry != nullptr)
+    {
+        m_freeEntries = entry->Next;
+    }
+    else
+    {
+        entry = EvictLeastRecentlyUsed();
+
+        if (entry == nullptr)
+        {
+            m_counters.CacheFull++;
+            return nullptr;
+        }
+    }
+
+    if (!Map(*entry, PageFrameNumber, PageVirtualAddress))
+    {
+        m_counters.MapFailures++;
+
+        entry->Next = m_freeEntries;
+        m_freeEntries = entry;
+
+        return nullptr;
+    }
+
+    auto bucket = GetBucket(PageFrameNumber);
+    entry->Next = *bucket;
+    *bucket = entry;
+
+    entry->RefCount = 1;
+
+    return entry;
+}
+
+_Use_decl_annotations_
+void
+NxDmaMappingCache::Release(
+    NxDmaMappingCacheEntry & Entry
+    )
+{
+    NT_ASSERT(Entry.RefCount > 0);
+
+    if (--Entry.RefCount == 0)
+    {
+        InsertHeadList(&m_idleEntries, &Entry.IdleLink);
+    }
+}
+
+NxDmaMappingCacheEntry *
+NxDmaMappingCache::EvictLeastRecentlyUsed(
+    void
+    )
+{
+    if (IsListEmpty(&m_idleEntries))
+    {
+        return nullptr;
+    }
+
+    auto entry = CONTAINING_RECORD(RemoveTailList(&m_idleEntries), NxDmaMappingCacheEntry, IdleLink);
+
+    // Unlink from the hash bucket
+    for (auto link = GetBucket(entry->PageFrameNumber); *link != nullptr; link = &(*link)->Next)
+    {
+        if (*link == entry)
+        {
+            *link = entry->Next;
+            break;
+        }
+    }
+
+    Unmap(*entry);
+    m_counters.Evictions++;
+
+    return entry;
+}
+
+void
+NxDmaMappingCache::Flush(
+    void
+    )
+{
+    while (auto entry = EvictLeastRecentlyUsed())
+    {
+        entry->Next = m_freeEntries;
+        m_freeEntries = entry;
+    }
+}
+
+_Use_decl_annotations_
+bool
+NxDmaMappingCache::Map(
+    NxDmaMappingCacheEntry & Entry,
+    PFN_NUMBER PageFrameNumber,
+    void * PageVirtualAddress
+    )
+{
+    // Lock the page through the entry's own MDL, the MDL of the packet it
+    // was seen in is gone by the time the mapping is reused. The packet
+    // keeps the page resident, so this is valid at dispatch level.
+    MmInitializeMdl(Entry.Mdl, PageVirtualAddress, PAGE_SIZE);
+
+    __try
+    {
+        MmProbeAndLockPages(Entry.Mdl, KernelMode, IoReadAccess);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        return false;
+    }
+
+    auto unlockPage = wil::scope_exit([&Entry]()
+    {
+        MmUnlockPages(Entry.Mdl);
+    });
+
+    if (MmGetMdlPfnArray(Entry.Mdl)[0] != PageFrameNumber)
+    {
+        return false;
+    }
+
+    auto const dmaOperations = m_dmaAdapter.DmaOperations;
+
+    if (dmaOperations->InitializeDmaTransferContext(&m_dmaAdapter, Entry.DmaTransferContext) != STATUS_SUCCESS)
+    {
+        return false;
+    }
+
+    SCATTER_GATHER_LIST *sgl = nullptr;
+
+    auto const status = dmaOperations->BuildScatterGatherListEx(
+        &m_dmaAdapter,
+        &m_physicalDeviceObject,
+        Entry.DmaTransferContext,
+        Entry.Mdl,
+        0,
+        PAGE_SIZE,
+        DMA_SYNCHRONOUS_CALLBACK,
+        nullptr, // ExecutionRoutine
+        nullptr, // Context
+        TRUE,
+        Entry.ScatterGatherBuffer,
+        m_scatterGatherListSize,
+        nullptr, // DmaCompletionRoutine
+        nullptr, // CompletionContext
+        &sgl);
+
+    dmaOperations->FreeAdapterObject(&m_dmaAdapter, DeallocateObjectKeepRegisters);
+
+    if (status != STATUS_SUCCESS)
+    {
+        return false;
+    }
+
+    // The page must be mapped in place, as one logically contiguous
+    // element. A double buffered page would be sent from a stale copy.
+    MDL *mappedMdl = nullptr;
+
+    auto const mappedInPlace =
+        sgl->NumberOfElements == 1 &&
+        dmaOperations->BuildMdlFromScatterGatherList(&m_dmaAdapter, sgl, Entry.Mdl, &mappedMdl) == STATUS_SUCCESS &&
+        mappedMdl == Entry.Mdl;
+
+    if (!mappedInPlace)
+    {
+        dmaOperations->PutScatterGatherList(&m_dmaAdapter, sgl, TRUE);
+        return false;
+    }
+
+    Entry.PageFrameNumber = PageFrameNumber;
+    Entry.LogicalAddress = sgl->Elements[0].Address;
+    Entry.ScatterGatherList = sgl;
+
+    // Released by Unmap
+    unlockPage.release();
+
+    return true;
+}
+
+_Use_decl_annotations_
+void
+NxDmaMappingCache::Unmap(
+    NxDmaMappingCacheEntry & Entry
+    )
+{
+    NT_ASSERT(Entry.RefCount == 0);
+
+    m_dmaAdapter.DmaOperations->PutScatterGatherList(
+        &m_dmaAdapter,
+        Entry.ScatterGatherList,
+        TRUE);
+
+    MmUnlockPages(Entry.Mdl);
+
+    Entry.ScatterGatherList = nullptr;
+    Entry.PageFrameNumber = 0;
+    Entry.LogicalAddress = {};
+}
+
+NxDmaMappingCacheCounters
+NxDmaMappingCache::GetCounters(
+    void
+    ) const
+{
+    return m_counters;
+}
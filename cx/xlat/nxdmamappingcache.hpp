@@ -0,0 +1,177 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Cache of long-lived DMA mappings for transmit pages.
+
+    Mapping a packet through HAL costs a scatter/gather list build and, on
+    completion, a PutScatterGatherList. With an IOMMU that is a map, an unmap
+    and an IOTLB invalidation per packet. Pages the stack transmits from over
+    and over (socket buffers, registered I/O buffers) pay that again for
+    every packet.
+
+    The cache keeps a bounded number of single page mappings, keyed by page
+    frame number, and hands them out to packets whose pages are all cached.
+    Every packet holds a reference on the mappings it uses. Only mappings no
+    in-flight packet references are kept on the LRU list, and only those are
+    ever unmapped, either to make room for another page or when the cache is
+    flushed.
+
+    Every cached page is locked by the cache itself, through the entry's own
+    MDL, while the page is seen in a packet and its system address is still
+    valid. The page can't be freed and reused while the cache maps it, even
+    after the NBL it was seen in has been completed. The lock is released
+    with the mapping, on eviction or when the queue stops and flushes the
+    cache.
+
+    A page is only mapped the second time it is seen. Pages the stack does
+    not send again are left to the per packet HAL path, which is cheaper
+    than mapping them here and unmapping them on eviction.
+
+    A page whose mapping HAL had to double buffer is never cached, the
+    mapping would keep pointing at a stale copy of the data.
+
+--*/
+
+#pragma once
+
+struct NxDmaMappingCacheEntry
+{
+    // Links the entry on the LRU list while no packet references it
+    LIST_ENTRY IdleLink;
+
+    // Next entry in the same hash bucket, or in the free list
+    NxDmaMappingCacheEntry * Next = nullptr;
+
+    PFN_NUMBER PageFrameNumber = 0;
+
+    // Logical address of the start of the page
+    PHYSICAL_ADDRESS LogicalAddress = {};
+
+    ULONG RefCount = 0;
+
+    MDL * Mdl = nullptr;
+    void * DmaTransferContext = nullptr;
+    void * ScatterGatherBuffer = nullptr;
+    SCATTER_GATHER_LIST * ScatterGatherList = nullptr;
+};
+
+struct NxDmaMappingCacheCounters
+{
+    ULONG64 Hits = 0;
+    ULONG64 Misses = 0;
+    ULONG64 Evictions = 0;
+    ULONG64 MapFailures = 0; // pages that could not be mapped or can't be cached
+    ULONG64 CacheFull = 0; // misses with every cached mapping in use
+    ULONG64 NotAdmitted = 0; // misses on pages not seen recently, left to HAL
+};
+
+class NxDmaMappingCache : public NxNonpagedAllocation<'cMxN'>
+{
+public:
+
+    NxDmaMappingCache(
+        _In_ DMA_ADAPTER & DmaAdapter,
+        _In_ DEVICE_OBJECT & PhysicalDeviceObject
+        );
+
+    // All references must have been released
+    ~NxDmaMappingCache(
+        void
+        );
+
+    NTSTATUS
+    Initialize(
+        _In_ ULONG NumberOfPages
+        );
+
+    // Returns a referenced mapping of the page, mapping it if it is not
+    // cached yet and was seen recently. Returns nullptr if the page can't be
+    // cached right now.
+    NxDmaMappingCacheEntry *
+    Acquire(
+        _In_ PFN_NUMBER PageFrameNumber,
+        _In_ void * PageVirtualAddress
+        );
+
+    void
+    Release(
+        _In_ NxDmaMappingCacheEntry & Entry
+        );
+
+    // Unmaps and unlocks every page not referenced by a packet
+    void
+    Flush(
+        void
+        );
+
+    NxDmaMappingCacheCounters
+    GetCounters(
+        void
+        ) const;
+
+private:
+
+    NxDmaMappingCacheEntry *
+    Lookup(
+        _In_ PFN_NUMBER PageFrameNumber
+        ) const;
+
+    ULONG
+    GetBucketIndex(
+        _In_ PFN_NUMBER PageFrameNumber
+        ) const;
+
+    NxDmaMappingCacheEntry **
+    GetBucket(
+        _In_ PFN_NUMBER PageFrameNumber
+        ) const;
+
+    bool
+    Admit(
+        _In_ PFN_NUMBER PageFrameNumber
+        );
+
+    NxDmaMappingCacheEntry *
+    EvictLeastRecentlyUsed(
+        void
+        );
+
+    bool
+    Map(
+        _Inout_ NxDmaMappingCacheEntry & Entry,
+        _In_ PFN_NUMBER PageFrameNumber,
+        _In_ void * PageVirtualAddress
+        );
+
+    void
+    Unmap(
+        _Inout_ NxDmaMappingCacheEntry & Entry
+        );
+
+    DMA_ADAPTER & m_dmaAdapter;
+    DEVICE_OBJECT & m_physicalDeviceObject;
+
+    ULONG m_scatterGatherListSize = 0;
+
+    KPoolPtr<UCHAR> m_entryBuffer;
+    KPoolPtr<UCHAR> m_mappingBuffer;
+
+    ULONG m_bucketMask = 0;
+    KPoolPtr<UCHAR> m_bucketBuffer;
+    NxDmaMappingCacheEntry ** m_buckets = nullptr;
+
+    // Last page seen missing in each bucket, a page is admitted when it
+    // misses twice in a row
+    KPoolPtr<UCHAR> m_recentPageBuffer;
+    PFN_NUMBER * m_recentPages = nullptr;
+
+    NxDmaMappingCacheEntry * m_freeEntries = nullptr;
+
+    // Most recently used first
+    LIST_ENTRY m_idleEntries;
+
+    NxDmaMappingCacheCounters m_counters;
+};
@@ -58,6 +58,16 @@ NxExecutionContext::Initialize(PVOID context, EC_START_ROUTINE *callback)
     return STATUS_SUCCESS;
 }
 
+void
+NxExecutionContext::InitializeShared(
+    _In_ INxExecutionContextHost & Host
+    )
+{
+    WIN_ASSERT(! m_workerThreadObject);
+
+    m_host = &Host;
+}
+
 NxExecutionContext::EcState
 NxExecutionContext::SetState(EcState newState)
 {
@@ -130,6 +140,12 @@ NxExecutionContext::Terminate()
 
 #endif
     }
+
+    if (m_host)
+    {
+        m_host->Release();
+        m_host = nullptr;
+    }
 }
 
 void
@@ -169,12 +185,21 @@ NxExecutionContext::Stop()
 void
 NxExecutionContext::SignalWork()
 {
-    m_work.Set();
+    if (m_host)
+    {
+        m_host->SignalWork();
+    }
+    else
+    {
+        m_work.Ring();
+    }
 }
 
 void
 NxExecutionContext::WaitForWork()
 {
+    WIN_ASSERT(! m_host);
+
     m_work.Wait();
 }
 
@@ -190,18 +215,34 @@ NxExecutionContext::IsStopping() const
 bool
 NxExecutionContext::IsTerminated()
 {
+    WIN_ASSERT(! m_host);
+
     SignalWork();
     m_changed.Wait();
 
     return m_ecState == EcState::Terminated;
 }
 
+bool
+NxExecutionContext::IsRunning() const
+{
+    auto const state = m_ecState;
+
+    return state == EcState::Started || state == EcState::Stopping;
+}
+
 void
 NxExecutionContext::SetDebugNameHint(
     _In_ PCWSTR usage,
     _In_ size_t index,
     _In_ NET_LUID networkInterface)
 {
+    // A hosted EC has no thread of its own to name
+    if (m_host)
+    {
+        return;
+    }
+
     MIB_IF_ROW2 mib;
     mib.InterfaceLuid = networkInterface;
 
@@ -235,6 +276,24 @@ NxExecutionContext::SetDebugNameHint(
 #endif
 }
 
+void
+NxExecutionContext::SetGroupAffinity(
+    _In_ GROUP_AFFINITY const & GroupAffinity
+    )
+{
+    if (m_host)
+    {
+        m_host->SetGroupAffinity(GroupAffinity);
+        return;
+    }
+
+#ifdef _KERNEL_MODE
+    KeSetSystemGroupAffinityThread(const_cast<GROUP_AFFINITY *>(&GroupAffinity), NULL);
+#else
+    UNREFERENCED_PARAMETER(GroupAffinity);
+#endif
+}
+
 void
 NxExecutionContext::UpdateCounters(
     _In_ bool IsIdleIteration
@@ -292,5 +351,10 @@ NxExecutionContext::GetExecutionContextCounters() const
 ULONG
 NxExecutionContext::GetExecutionContextIdentifier() const
 {
+    if (m_host)
+    {
+        return m_host->GetExecutionContextIdentifier();
+    }
+
     return m_ecIdentifier;
 }
@@ -34,12 +34,18 @@ Usage:
             ec.Stop();
             ec.WaitForStopComplete();
 
+    An EC can also be hosted instead of owning a thread, see
+    NxSharedExecutionContext and NxDatapathScheduler. A hosted EC keeps its
+    own state machine but forwards work signals to its host.
+
 --*/
 
 #pragma once
 
 #include <KWaitEvent.h>
 
+#include "NxSignal.hpp"
+
 #if _KERNEL_MODE
 
 inline void DereferenceObject(PVOID object)
@@ -60,6 +66,40 @@ using EC_START_ROUTINE = wistd::remove_pointer<PTHREAD_START_ROUTINE>::type;
 using EC_RETURN = DWORD;
 #endif
 
+/// Implemented by whatever runs a hosted EC in place of a dedicated thread
+class INxExecutionContextHost
+{
+public:
+
+    /// Wakes up the host to run the hosted EC, may be called at DISPATCH_LEVEL
+    virtual
+    void
+    SignalWork(
+        void
+        ) = 0;
+
+    /// Called by code running in the hosted EC to move it to other processors
+    virtual
+    void
+    SetGroupAffinity(
+        _In_ GROUP_AFFINITY const & GroupAffinity
+        ) = 0;
+
+    virtual
+    ULONG
+    GetExecutionContextIdentifier(
+        void
+        ) const = 0;
+
+    /// Called once the hosted EC is terminated, the host must not touch
+    /// the EC afterwards
+    virtual
+    void
+    Release(
+        void
+        ) = 0;
+};
+
 struct NxExecutionContextCounters
 {
     ULONG64 IterationCount = 0; // # of times polling loop runs
@@ -85,6 +125,12 @@ public:
         EC_START_ROUTINE * callback
         );
 
+    /// Makes this EC run on Host instead of creating its own thread.
+    void
+    InitializeShared(
+        _In_ INxExecutionContextHost & Host
+        );
+
     void
     Start(
         void
@@ -138,6 +184,12 @@ public:
         void
         );
 
+    /// Returns true between Start and SignalStopped
+    bool
+    IsRunning(
+        void
+        ) const;
+
     void
     SetDebugNameHint(
         _In_ PCWSTR usage,
@@ -145,6 +197,12 @@ public:
         _In_ NET_LUID networkInterface
         );
 
+    /// Called only by code running in the EC.
+    void
+    SetGroupAffinity(
+        _In_ GROUP_AFFINITY const & GroupAffinity
+        );
+
     void
     UpdateCounters(
         _In_ bool IsIdleIteration
@@ -190,7 +248,8 @@ private:
         void
         );
 
-    KAutoEvent m_work;
+    // Producers only pay for an event set when the EC is about to sleep
+    NxDoorbell m_work;
     KAutoEvent m_stopped;
     KAutoEvent m_changed;
 
@@ -204,4 +263,7 @@ private:
 #endif
 
     ULONG m_ecIdentifier = 0;
+
+    // Set when this EC is hosted instead of owning a thread
+    INxExecutionContextHost * m_host = nullptr;
 };
@@ -0,0 +1,308 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Sampled per-packet latency tracing for a translator queue.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxLatencyTracker.tmh"
+#include "NxLatencyTracker.hpp"
+
+static_assert(sizeof(ULONG64) <= FIELD_SIZE(NET_BUFFER_LIST, MiniportReserved),
+              "the enqueue stamp does not fit in the space on the NBL reserved for miniport");
+
+static
+ULONG
+MostSignificantBit(
+    ULONG64 Value
+    )
+{
+    ULONG bit;
+
+    if (Value >> 32)
+    {
+        BitScanReverse(&bit, static_cast<ULONG>(Value >> 32));
+        return bit + 32;
+    }
+
+    BitScanReverse(&bit, static_cast<ULONG>(Value));
+    return bit;
+}
+
+void
+NxLatencyHistogram::Record(
+    ULONG64 Nanoseconds
+    )
+{
+    ULONG bucket;
+
+    if (Nanoseconds < NX_LATENCY_HISTOGRAM_SUB_BUCKETS)
+    {
+        bucket = static_cast<ULONG>(Nanoseconds);
+    }
+    else
+    {
+        // (shift + 1) selects the power of two, the top bits below the most
+        // significant one select the linear sub-bucket inside it
+        auto const shift = MostSignificantBit(Nanoseconds) - NX_LATENCY_HISTOGRAM_SUB_BUCKET_BITS;
+        bucket = (shift + 1) * NX_LATENCY_HISTOGRAM_SUB_BUCKETS +
+            static_cast<ULONG>(Nanoseconds >> shift) - NX_LATENCY_HISTOGRAM_SUB_BUCKETS;
+        bucket = min(bucket, NX_LATENCY_HISTOGRAM_BUCKETS - 1);
+    }
+
+    Buckets[bucket]++;
+    NumberOfSamples++;
+    Maximum = max(Maximum, Nanoseconds);
+}
+
+ULONG64
+NxLatencyHistogram::GetPercentile(
+    ULONG PerMille
+    ) const
+{
+    if (NumberOfSamples == 0)
+    {
+        return 0;
+    }
+
+    auto const rank = (NumberOfSamples * PerMille + 999) / 1000;
+    ULONG64 samplesSeen = 0;
+
+    for (ULONG i = 0; i < NX_LATENCY_HISTOGRAM_BUCKETS; i++)
+    {
+        samplesSeen += Buckets[i];
+
+        if (samplesSeen >= rank)
+        {
+            if (i < NX_LATENCY_HISTOGRAM_SUB_BUCKETS)
+            {
+                return i;
+            }
+
+            auto const shift = i / NX_LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+            auto const mantissa = ULONG64{ i % NX_LATENCY_HISTOGRAM_SUB_BUCKETS + NX_LATENCY_HISTOGRAM_SUB_BUCKETS };
+
+            return min(((mantissa + 1) << shift) - 1, Maximum);
+        }
+    }
+
+    return Maximum;
+}
+
+void
+NxLatencyHistogram::GetReportedPercentiles(
+    ULONG64 (&Percentiles)[NX_LATENCY_PERCENTILES]
+    ) const
+{
+    Percentiles[0] = GetPercentile(500);
+    Percentiles[1] = GetPercentile(900);
+    Percentiles[2] = GetPercentile(990);
+    Percentiles[3] = GetPercentile(999);
+}
+
+NxLatencyTracker::NxLatencyTracker(
+    NxRingBuffer const & PacketRing,
+    ULONG SamplingInterval
+    ) :
+    m_packetRing(PacketRing),
+    m_stamps(PacketRing)
+{
+    // Sample at power of two ring positions, and at least once per ring
+    ULONG bit = 0;
+    BitScanReverse(&bit, max(SamplingInterval, 1ul));
+
+    m_samplingInterval = min(1u << bit, PacketRing.Count());
+    m_samplingMask = m_samplingInterval - 1;
+}
+
+NTSTATUS
+NxLatencyTracker::Initialize(
+    void
+    )
+{
+    CX_RETURN_IF_NOT_NT_SUCCESS(
+        m_stamps.Initialize(sizeof(NxPacketLatencyStamps)));
+
+    (void)NxQueryPerformanceCounter(&m_frequency);
+
+    return STATUS_SUCCESS;
+}
+
+ULONG64
+NxLatencyTracker::QueryTimestamp(
+    void
+    )
+{
+    return NxQueryPerformanceCounter(nullptr);
+}
+
+void
+NxLatencyTracker::StampEnqueue(
+    NET_BUFFER_LIST * NblChain
+    )
+{
+    auto const now = QueryTimestamp();
+
+    for (auto nbl = NblChain; nbl; nbl = nbl->Next)
+    {
+        *reinterpret_cast<ULONG64 UNALIGNED *>(&NET_BUFFER_LIST_MINIPORT_RESERVED(nbl)[0]) = now;
+    }
+}
+
+ULONG64
+NxLatencyTracker::GetEnqueueStamp(
+    NET_BUFFER_LIST const * Nbl
+    )
+{
+    return *reinterpret_cast<ULONG64 const UNALIGNED *>(&NET_BUFFER_LIST_MINIPORT_RESERVED(Nbl)[0]);
+}
+
+void
+NxLatencyTracker::Reset(
+    void
+    )
+{
+    m_postIndex = m_packetRing.Get()->EndIndex;
+    m_returnIndex = m_packetRing.Get()->BeginIndex;
+    m_numberOfHeldSamples = 0;
+}
+
+void
+NxLatencyTracker::StampPosted(
+    void
+    )
+{
+    auto const rb = m_packetRing.Get();
+    auto const now = QueryTimestamp();
+
+    ForEachSample(NetRbPacketRange{ *rb, m_postIndex, rb->EndIndex },
+        [this, now](NxPacketLatencyStamps & Stamps, UINT32)
+    {
+        Stamps.Post = now;
+        Stamps.Return = 0;
+
+        RecordInterval(NxLatencyInterval::EnqueueToTranslate, Stamps.Enqueue, Stamps.Translate);
+        RecordInterval(NxLatencyInterval::TranslateToPost, Stamps.Translate, Stamps.Post);
+    });
+
+    m_postIndex = rb->EndIndex;
+}
+
+void
+NxLatencyTracker::StampReturned(
+    void
+    )
+{
+    auto const rb = m_packetRing.Get();
+    auto const now = QueryTimestamp();
+
+    ForEachSample(NetRbPacketRange{ *rb, m_returnIndex, rb->BeginIndex },
+        [this, now](NxPacketLatencyStamps & Stamps, UINT32)
+    {
+        Stamps.Return = now;
+
+        RecordInterval(NxLatencyInterval::PostToReturn, Stamps.Post, Stamps.Return);
+    });
+
+    m_returnIndex = rb->BeginIndex;
+}
+
+void
+NxLatencyTracker::StampCompleted(
+    NetRbPacketRange const & Range
+    )
+{
+    auto const now = QueryTimestamp();
+
+    ForEachSample(Range,
+        [this, now](NxPacketLatencyStamps & Stamps, UINT32)
+    {
+        RecordInterval(NxLatencyInterval::ReturnToCompletion, Stamps.Return, now);
+        RecordInterval(NxLatencyInterval::EnqueueToCompletion, Stamps.Enqueue, now);
+
+        Stamps = {};
+    });
+}
+
+void
+NxLatencyTracker::HoldCompleted(
+    NetRbPacketRange const & Range
+    )
+{
+    ForEachSample(Range,
+        [this](NxPacketLatencyStamps & Stamps, UINT32)
+    {
+        if (m_numberOfHeldSamples < ARRAYSIZE(m_heldSamples))
+        {
+            m_heldSamples[m_numberOfHeldSamples++] = Stamps;
+        }
+
+        Stamps = {};
+    });
+}
+
+void
+NxLatencyTracker::StampHeldCompleted(
+    void
+    )
+{
+    if (m_numberOfHeldSamples == 0)
+    {
+        return;
+    }
+
+    auto const now = QueryTimestamp();
+
+    for (UINT32 i = 0; i < m_numberOfHeldSamples; i++)
+    {
+        RecordInterval(NxLatencyInterval::ReturnToCompletion, m_heldSamples[i].Return, now);
+        RecordInterval(NxLatencyInterval::EnqueueToCompletion, m_heldSamples[i].Enqueue, now);
+    }
+
+    m_numberOfHeldSamples = 0;
+}
+
+NxLatencyHistogram const &
+NxLatencyTracker::GetHistogram(
+    NxLatencyInterval Interval
+    ) const
+{
+    return m_histograms[static_cast<size_t>(Interval)];
+}
+
+void
+NxLatencyTracker::ResetHistograms(
+    void
+    )
+{
+    for (auto & histogram : m_histograms)
+    {
+        histogram = {};
+    }
+}
+
+void
+NxLatencyTracker::RecordInterval(
+    NxLatencyInterval Interval,
+    ULONG64 Start,
+    ULONG64 End
+    )
+{
+    // Either hand-off was not observed for this sample
+    if (Start == 0 || End < Start)
+    {
+        return;
+    }
+
+    auto const ticks = End - Start;
+    auto const nanoseconds =
+        (ticks / m_frequency) * 1000000000ull +
+        (ticks % m_frequency) * 1000000000ull / m_frequency;
+
+    m_histograms[static_cast<size_t>(Interval)].Record(nanoseconds);
+}
@@ -0,0 +1,228 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Sampled per-packet latency tracing for a translator queue.
+
+    A packet is sampled when its ring index is a multiple of the sampling
+    interval, so each stage finds the sampled packets of the range it just
+    processed by stepping through it instead of visiting every packet. The
+    time stamps of each sampled packet live in a NxContextBuffer slot and
+    the delay between consecutive hand-offs is aggregated in per-queue HDR
+    histograms.
+
+--*/
+
+#pragma once
+
+#include "NxRingBuffer.hpp"
+#include "NxContextBuffer.hpp"
+
+// Each power of two is split in 2^NX_LATENCY_HISTOGRAM_SUB_BUCKET_BITS linear
+// buckets, bounding the relative error of a reported value to 12.5%.
+#define NX_LATENCY_HISTOGRAM_SUB_BUCKET_BITS 3
+#define NX_LATENCY_HISTOGRAM_SUB_BUCKETS (1u << NX_LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+
+// Latencies of 2^NX_LATENCY_HISTOGRAM_MAX_BITS ns (about a minute) or more
+// are accounted in the last bucket.
+#define NX_LATENCY_HISTOGRAM_MAX_BITS 36
+#define NX_LATENCY_HISTOGRAM_BUCKETS \
+    ((NX_LATENCY_HISTOGRAM_MAX_BITS - NX_LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 1) * NX_LATENCY_HISTOGRAM_SUB_BUCKETS)
+
+// Percentiles computed at report time: p50, p90, p99 and p99.9
+#define NX_LATENCY_PERCENTILES 4
+
+// Sampled packets whose completion can be held back at once, further
+// samples are dropped until the held ones are completed
+#define NX_LATENCY_MAX_HELD_SAMPLES 64
+
+struct NxLatencyHistogram
+{
+    ULONG64 Buckets[NX_LATENCY_HISTOGRAM_BUCKETS] = {};
+    ULONG64 NumberOfSamples = 0;
+    ULONG64 Maximum = 0;
+
+    void
+    Record(
+        _In_ ULONG64 Nanoseconds
+        );
+
+    // Returns the upper bound of the bucket holding the given percentile,
+    // expressed in tenths of a percent.
+    ULONG64
+    GetPercentile(
+        _In_ ULONG PerMille
+        ) const;
+
+    void
+    GetReportedPercentiles(
+        _Out_ ULONG64 (&Percentiles)[NX_LATENCY_PERCENTILES]
+        ) const;
+};
+
+// Hand-off times of a sampled packet, in performance counter ticks. A zero
+// stamp means the packet did not go through that hand-off since it was last
+// sampled (Rx packets are never enqueued or translated).
+struct NxPacketLatencyStamps
+{
+    ULONG64 Enqueue;
+    ULONG64 Translate;
+    ULONG64 Post;
+    ULONG64 Return;
+};
+
+enum class NxLatencyInterval
+{
+    EnqueueToTranslate,
+    TranslateToPost,
+    PostToReturn,
+    ReturnToCompletion,
+    EnqueueToCompletion,
+    Count
+};
+
+class NxLatencyTracker :
+    public NxNonpagedAllocation<'tLxN'>
+{
+public:
+
+    NxLatencyTracker(
+        _In_ NxRingBuffer const & PacketRing,
+        _In_ ULONG SamplingInterval
+        );
+
+    NTSTATUS
+    Initialize(
+        void
+        );
+
+    static
+    ULONG64
+    QueryTimestamp(
+        void
+        );
+
+    // Tx only: stamps every NBL of the chain with the time it was queued.
+    static
+    void
+    StampEnqueue(
+        _In_ NET_BUFFER_LIST * NblChain
+        );
+
+    static
+    ULONG64
+    GetEnqueueStamp(
+        _In_ NET_BUFFER_LIST const * Nbl
+        );
+
+    // Must be called after the queue is (re)started
+    void
+    Reset(
+        void
+        );
+
+    template <typename lambda>
+    void
+    ForEachSample(
+        _In_ NetRbPacketRange const & Range,
+        _In_ lambda f
+        )
+    {
+        auto const count = Range.Count();
+        auto const begin = Range.begin().GetIndex();
+
+        // distance from the start of the range to the first sampled index
+        auto offset = (m_samplingInterval - (begin & m_samplingMask)) & m_samplingMask;
+
+        for (; offset < count; offset += m_samplingInterval)
+        {
+            auto const index = Range.GetIterator(offset).GetIndex();
+            f(m_stamps.GetPacketContext<NxPacketLatencyStamps>(index), index);
+        }
+    }
+
+    // Stamps the packets given to the NIC since the last call, must be
+    // called right before the NIC driver is advanced.
+    void
+    StampPosted(
+        void
+        );
+
+    // Stamps the packets the NIC returned since the last call, must be
+    // called right after the NIC driver is advanced.
+    void
+    StampReturned(
+        void
+        );
+
+    // Stamps packets whose NBLs have been completed (Tx) or indicated (Rx)
+    void
+    StampCompleted(
+        _In_ NetRbPacketRange const & Range
+        );
+
+    // Tx only: saves the samples of packets whose NBLs are held back for a
+    // later completion, the packets themselves can be reused meanwhile
+    void
+    HoldCompleted(
+        _In_ NetRbPacketRange const & Range
+        );
+
+    // Tx only: stamps the samples saved by HoldCompleted, must be called
+    // when the held NBLs are completed
+    void
+    StampHeldCompleted(
+        void
+        );
+
+    NxLatencyHistogram const &
+    GetHistogram(
+        _In_ NxLatencyInterval Interval
+        ) const;
+
+    void
+    ResetHistograms(
+        void
+        );
+
+private:
+
+    void
+    RecordInterval(
+        _In_ NxLatencyInterval Interval,
+        _In_ ULONG64 Start,
+        _In_ ULONG64 End
+        );
+
+    NxRingBuffer const &
+        m_packetRing;
+
+    NxContextBuffer
+        m_stamps;
+
+    UINT32
+        m_samplingInterval;
+
+    UINT32
+        m_samplingMask;
+
+    ULONG64
+        m_frequency = 1;
+
+    UINT32
+        m_postIndex = 0;
+
+    UINT32
+        m_returnIndex = 0;
+
+    NxPacketLatencyStamps
+        m_heldSamples[NX_LATENCY_MAX_HELD_SAMPLES] = {};
+
+    UINT32
+        m_numberOfHeldSamples = 0;
+
+    NxLatencyHistogram
+        m_histograms[static_cast<size_t>(NxLatencyInterval::Count)];
+};
@@ -0,0 +1,131 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Software pipelined prefetch of the NBLs ahead of the one being
+    translated to NET_PACKETs.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxNblPrefetcher.tmh"
+
+#include "NxNblPrefetcher.hpp"
+
+_Use_decl_annotations_
+NxNblPrefetcher::NxNblPrefetcher(
+    NET_BUFFER_LIST const *CurrentNbl,
+    size_t Distance
+    ) :
+    m_enabled(Distance != 0)
+{
+    if (!m_enabled || CurrentNbl == nullptr)
+    {
+        return;
+    }
+
+    Distance = min(Distance, size_t{ NX_NBL_PREFETCH_MAX_DISTANCE });
+
+    // Fill the pipeline. The NBLs walked here are cold, but this is only
+    // paid once per batch of NBLs translated.
+    for (size_t s = 0; s < NumberOfStages; s++)
+    {
+        auto const stageDistance = max(size_t{ 1 }, Distance * (NumberOfStages - s) / NumberOfStages);
+
+        auto nbl = CurrentNbl;
+
+        for (size_t i = 0; i < stageDistance && nbl != nullptr; i++)
+        {
+            nbl = nbl->Next;
+        }
+
+        m_cursors[s] = nbl;
+
+        if (nbl != nullptr)
+        {
+            Prefetch(static_cast<Stage>(s), *nbl);
+        }
+    }
+}
+
+void
+NxNblPrefetcher::Advance(
+    void
+    )
+{
+    if (!m_enabled)
+    {
+        return;
+    }
+
+    for (size_t s = 0; s < NumberOfStages; s++)
+    {
+        if (m_cursors[s] != nullptr)
+        {
+            m_cursors[s] = m_cursors[s]->Next;
+
+            if (m_cursors[s] != nullptr)
+            {
+                Prefetch(static_cast<Stage>(s), *m_cursors[s]);
+            }
+        }
+    }
+}
+
+_Use_decl_annotations_
+void
+NxNblPrefetcher::Prefetch(
+    Stage PrefetchStage,
+    NET_BUFFER_LIST const &NetBufferList
+    )
+{
+    switch (PrefetchStage)
+    {
+    case Nbl:
+        // Next and FirstNetBuffer, then the OOB data translated into packet extensions
+        PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, &NetBufferList);
+        PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, &NetBufferList.NetBufferListInfo[TcpIpChecksumNetBufferListInfo]);
+        PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, &NetBufferList.NetBufferListInfo[TcpLargeSendNetBufferListInfo]);
+        break;
+
+    case NetBuffer:
+        if (auto const netBuffer = NetBufferList.FirstNetBuffer)
+        {
+            PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, netBuffer);
+        }
+        break;
+
+    case Mdl:
+        if (auto const netBuffer = NetBufferList.FirstNetBuffer)
+        {
+            if (auto const mdl = netBuffer->CurrentMdl)
+            {
+                PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, mdl);
+            }
+        }
+        break;
+
+    case Header:
+        if (auto const netBuffer = NetBufferList.FirstNetBuffer)
+        {
+            auto const mdl = netBuffer->CurrentMdl;
+
+            // Only look at buffers that already have a system address, mapping
+            // one is not worth it for a prefetch
+            if (mdl != nullptr && (mdl->MdlFlags & (MDL_MAPPED_TO_SYSTEM_VA | MDL_SOURCE_IS_NONPAGED_POOL)))
+            {
+                PreFetchCacheLine(
+                    PF_TEMPORAL_LEVEL_1,
+                    static_cast<UCHAR const *>(mdl->MappedSystemVa) + netBuffer->CurrentMdlOffset);
+            }
+        }
+        break;
+
+    default:
+        NT_ASSERT(false);
+        break;
+    }
+}
@@ -0,0 +1,68 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Software pipelined prefetch of the NBLs ahead of the one being
+    translated to NET_PACKETs.
+
+    NBLs are queued from any processor and are cold by the time the Tx EC
+    translates them. The prefetcher runs in stages, each one a fixed number
+    of NBLs ahead of the translation and each one only dereferencing what
+    the previous stage prefetched one NBL earlier:
+
+        Nbl         Distance        the NBL, its checksum and LSO info
+        NetBuffer   3/4 Distance    the NBL's first NET_BUFFER
+        Mdl         1/2 Distance    the NET_BUFFER's current MDL
+        Header      1/4 Distance    the first cache line of the frame
+
+    Stage distances are at least one NBL, so with a short distance several
+    stages run on the same NBL.
+
+--*/
+
+#pragma once
+
+// Prefetching further ahead than this only evicts lines before they are used
+#define NX_NBL_PREFETCH_MAX_DISTANCE 16
+
+class NxNblPrefetcher
+{
+public:
+
+    // A zero distance disables prefetching
+    NxNblPrefetcher(
+        _In_opt_ NET_BUFFER_LIST const *CurrentNbl,
+        _In_ size_t Distance
+        );
+
+    // Called every time translation moves on to the next NBL
+    void
+    Advance(
+        void
+        );
+
+private:
+
+    enum Stage
+    {
+        Nbl = 0,
+        NetBuffer,
+        Mdl,
+        Header,
+        NumberOfStages,
+    };
+
+    static
+    void
+    Prefetch(
+        _In_ Stage PrefetchStage,
+        _In_ NET_BUFFER_LIST const &NetBufferList
+        );
+
+    bool m_enabled = false;
+
+    // NBL each stage runs on, nullptr once past the end of the chain
+    NET_BUFFER_LIST const *m_cursors[NumberOfStages] = {};
+};
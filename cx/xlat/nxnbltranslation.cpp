@@ -9,6 +9,7 @@
 #include "NxPacketLayout.hpp"
 #include "NxChecksumInfo.hpp"
 #include "NxLargeSend.hpp"
+#include "NxNblPrefetcher.hpp"
 
 NxNblTranslator::NxNblTranslator(
     NxNblTranslationStats &Stats,
@@ -104,7 +105,8 @@ _Use_decl_annotations_
 NxNblTranslationStatus
 NxNblTranslator::TranslateNetBufferToNetPacket(
     NET_BUFFER & netBuffer,
-    NET_PACKET* netPacket
+    NET_PACKET* netPacket,
+    NxBounceBufferPool &BouncePool
     ) const
 {
     auto backfill = static_cast<ULONG>(m_datapathCapabilities.TxPayloadBackfill);
@@ -115,9 +117,14 @@ NxNblTranslator::TranslateNetBufferToNetPacket(
         // the client driver's required backfill
         if (backfill > NET_BUFFER_CURRENT_MDL_OFFSET(&netBuffer))
         {
-            // In the future we can try to bounce only the first fragment,
-            // for now bounce the whole packet
-            return NxNblTranslationStatus::BounceRequired;
+            // Bounce buffers come with the backfill reserved, so only bounce
+            // the current MDL and keep the rest of the chain as is
+            return TranslateMdlChainWithLeadingBounce(
+                *NET_BUFFER_CURRENT_MDL(&netBuffer),
+                NET_BUFFER_CURRENT_MDL_OFFSET(&netBuffer),
+                NET_BUFFER_DATA_LENGTH(&netBuffer),
+                *netPacket,
+                BouncePool);
         }
 
         // Retreat the used data in the current MDL so that any mapping operations
@@ -156,11 +163,28 @@ NxNblTranslator::TranslateNetBufferToNetPacket(
     size_t mdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(&netBuffer);
     auto bytesToCopy = NET_BUFFER_DATA_LENGTH(&netBuffer);
 
-    if (bytesToCopy == 0 || bytesToCopy > m_datapathCapabilities.MaximumTxFragmentSize)
+    if (bytesToCopy == 0)
     {
         return NxNblTranslationStatus::CannotTranslate;
     }
 
+    if (bytesToCopy > m_datapathCapabilities.MaximumTxFragmentSize)
+    {
+        // The zero-copy paths don't split MDLs to the fragment size limit,
+        // bounce the payload over as many buffers as it takes instead
+        return NxNblTranslationStatus::BounceRequired;
+    }
+
+    if (IsLeadingBufferUnaligned(*mdl, mdlOffset))
+    {
+        // Typically only the headers are in a separate, unaligned buffer,
+        // don't copy the whole payload because of them. The bounce buffer
+        // has its own backfill, leave the NET_BUFFER's out.
+        m_stats.Packet.UnalignedBuffer += 1;
+
+        return TranslateMdlChainWithLeadingBounce(*mdl, mdlOffset + backfill, bytesToCopy - backfill, *netPacket, BouncePool);
+    }
+
     auto& fragmentRing = *NET_DATAPATH_DESCRIPTOR_GET_FRAGMENT_RING_BUFFER(&m_datapathDescriptor);
     auto const availableFragments = NetRbFragmentRange::OsRange(fragmentRing);
 
@@ -229,6 +253,189 @@ NxNblTranslator::ShouldBounceFragment(
     return false;
 }
 
+_Use_decl_annotations_
+bool
+NxNblTranslator::IsLeadingBufferUnaligned(
+    MDL &Mdl,
+    size_t MdlOffset
+    ) const
+{
+    auto const alignment = m_datapathCapabilities.TxMemoryConstraints.AlignmentRequirement;
+
+    if (alignment <= 1)
+    {
+        return false;
+    }
+
+    // Don't map the buffer just to look at its address. A system address
+    // has the same offset within the page as the MDL's virtual address,
+    // which is all that matters for alignments up to a page. Anything
+    // coarser is still caught by ShouldBounceFragment.
+    auto va = static_cast<UCHAR *>(MmGetMdlVirtualAddress(&Mdl));
+
+    // Same address ShouldBounceFragment checks later on: fragments of DMA
+    // mapped NICs start at the data, the others at the start of the MDL
+    if (RequiresDmaMapping())
+    {
+        va += MdlOffset;
+    }
+
+    return !IsAddressAligned(va, min(alignment, static_cast<decltype(alignment)>(PAGE_SIZE)));
+}
+
+_Use_decl_annotations_
+NxNblTranslationStatus
+NxNblTranslator::TranslateMdlChainWithLeadingBounce(
+    MDL &Mdl,
+    size_t MdlOffset,
+    size_t BytesToCopy,
+    NET_PACKET &Packet,
+    NxBounceBufferPool &BouncePool
+    ) const
+/*
+
+Description:
+
+    Bounces the part of the payload held by the leading MDL into as few
+    fragments as it fits in and translates the rest of the MDL chain as
+    usual, so that a bad leading buffer does not cost a copy of the whole
+    packet.
+
+    BounceRequired is returned if the rest of the chain can't be translated
+    either, the caller then falls back to bouncing the whole packet.
+
+*/
+{
+    size_t const mdlByteCount = MmGetMdlByteCount(&Mdl);
+
+    if (MdlOffset >= mdlByteCount)
+    {
+        return NxNblTranslationStatus::BounceRequired;
+    }
+
+    size_t const leadingBytes = min(BytesToCopy, mdlByteCount - MdlOffset);
+    size_t const remainingBytes = BytesToCopy - leadingBytes;
+
+    if (remainingBytes > 0 && Mdl.Next == nullptr)
+    {
+        return NxNblTranslationStatus::BounceRequired;
+    }
+
+    auto& fragmentRing = *NET_DATAPATH_DESCRIPTOR_GET_FRAGMENT_RING_BUFFER(&m_datapathDescriptor);
+    auto const availableFragments = NetRbFragmentRange::OsRange(fragmentRing);
+
+    UINT32 leadingCount;
+
+    switch (BouncePool.BounceMdlChain(Mdl, MdlOffset, leadingBytes, availableFragments, nullptr, leadingCount))
+    {
+    case NxBounceResult::InsufficientResources:
+        return NxNblTranslationStatus::InsufficientResources;
+
+    case NxBounceResult::CannotBounce:
+        return NxNblTranslationStatus::BounceRequired;
+
+    case NxBounceResult::Success:
+        break;
+    }
+
+    auto const leadingFragments = NetRbFragmentRange(availableFragments.begin(), availableFragments.GetIterator(leadingCount));
+    auto numberOfFragments = leadingCount;
+
+    if (remainingBytes > 0)
+    {
+        auto const remainingFragments = NetRbFragmentRange(leadingFragments.end(), availableFragments.end());
+
+        auto const result = RequiresDmaMapping() ?
+            TranslateMdlChainToDmaMappedFragmentRange(*Mdl.Next, 0, remainingBytes, Packet, remainingFragments) :
+            TranslateMdlChainToFragmentRangeKvmOnly(*Mdl.Next, 0, remainingBytes, remainingFragments);
+
+        auto status = result.Status;
+
+        if (status == NxNblTranslationStatus::Success &&
+            result.FragmentChain.Count() + leadingCount > m_datapathCapabilities.MaximumNumberOfTxFragments)
+        {
+            // Too many fragments because of the bounce buffers
+            if (m_dmaAdapter)
+            {
+                m_dmaAdapter->CleanupNetPacket(Packet);
+            }
+
+            status = NxNblTranslationStatus::BounceRequired;
+        }
+
+        if (status != NxNblTranslationStatus::Success)
+        {
+            BouncePool.FreeBounceBuffers(leadingFragments);
+            return status;
+        }
+
+        numberOfFragments += result.FragmentChain.Count();
+    }
+
+    auto const fragmentChain = NetRbFragmentRange(availableFragments.begin(), availableFragments.GetIterator(numberOfFragments));
+
+    // Commit the fragment chain to the packet
+    Packet.FragmentCount = static_cast<UINT16>(fragmentChain.Count());
+    Packet.FragmentOffset = fragmentChain.begin().GetIndex();
+    fragmentRing.EndIndex = fragmentChain.end().GetIndex();
+
+    m_stats.Packet.PartialBounce += 1;
+
+    return NxNblTranslationStatus::Success;
+}
+
+_Use_decl_annotations_
+bool
+NxNblTranslator::GetBounceChecksum(
+    NET_BUFFER_LIST const &NetBufferList,
+    NET_BUFFER const &NetBuffer,
+    NxBounceChecksum &Checksum
+    ) const
+{
+    if (!m_bounceChecksum)
+    {
+        return false;
+    }
+
+    // Large sends are checksummed per segment by the NIC
+    if (NetBufferList.NetBufferListInfo[TcpLargeSendNetBufferListInfo] != nullptr)
+    {
+        return false;
+    }
+
+    auto const &checksumInfo =
+        *(NDIS_TCP_IP_CHECKSUM_NET_BUFFER_LIST_INFO*)
+        &NetBufferList.NetBufferListInfo[TcpIpChecksumNetBufferListInfo];
+
+    if (!checksumInfo.Transmit.TcpChecksum)
+    {
+        return false;
+    }
+
+    Checksum = {};
+    Checksum.Layer4Offset = checksumInfo.Transmit.TcpHeaderOffset;
+    Checksum.ChecksumFieldOffset = FIELD_OFFSET(TCP_HDR, th_sum);
+
+    return Checksum.Layer4Offset + sizeof(TCP_HDR) <= NET_BUFFER_DATA_LENGTH(&NetBuffer);
+}
+
+_Use_decl_annotations_
+bool
+NxNblTranslator::ShouldCopyBreak(
+    NET_BUFFER const &NetBuffer
+    ) const
+{
+    // Bounce buffers come from a pool that is mapped once and for all, so
+    // below the threshold copying the payload is cheaper than setting up a
+    // DMA transfer and building a scatter/gather list
+    auto const dataLength = NET_BUFFER_DATA_LENGTH(&NetBuffer);
+
+    return m_copyBreakThreshold != 0 &&
+        RequiresDmaMapping() &&
+        dataLength != 0 &&
+        dataLength <= m_copyBreakThreshold;
+}
+
 _Use_decl_annotations_
 MdlTranlationResult
 NxNblTranslator::TranslateMdlChainToFragmentRangeKvmOnly(
@@ -347,6 +554,21 @@ NxNblTranslator::TranslateMdlChainToDmaMappedFragmentRange(
     }
     else
     {
+        if (m_dmaAdapter->GetMappingCache() != nullptr)
+        {
+            auto const result = TranslateMdlChainToDmaMappedFragmentRangeUseCache(
+                Mdl,
+                MdlOffset,
+                BytesToCopy,
+                Packet,
+                AvailableFragments);
+
+            if (result.Status == NxNblTranslationStatus::Success)
+            {
+                return result;
+            }
+        }
+
         auto dmaTransfer = m_dmaAdapter->InitializeDmaTransfer(Packet);
 
         if (!dmaTransfer)
@@ -363,6 +585,125 @@ NxNblTranslator::TranslateMdlChainToDmaMappedFragmentRange(
     }
 }
 
+_Use_decl_annotations_
+MdlTranlationResult
+NxNblTranslator::TranslateMdlChainToDmaMappedFragmentRangeUseCache(
+    MDL &Mdl,
+    size_t MdlOffset,
+    size_t BytesToCopy,
+    NET_PACKET const &Packet,
+    NetRbFragmentRange const &AvailableFragments
+    ) const
+/*
+
+Description:
+
+    Translates the MDL chain into one fragment per page, using cached page
+    mappings only. The packet keeps a reference on every mapping it uses
+    until CleanupNetPacket.
+
+Return value:
+
+    CannotTranslate if some page could not be served from the cache, no
+    mapping is then referenced and the caller should map the packet through
+    HAL.
+
+*/
+{
+    auto& mappingCache = *m_dmaAdapter->GetMappingCache();
+    auto& dmaContext = m_dmaAdapter->GetDmaContextForPacket(Packet);
+
+    NT_ASSERT(dmaContext.NumberOfCachedMappings == 0);
+
+    auto releaseMappings = wil::scope_exit([&mappingCache, &dmaContext]()
+    {
+        for (UINT32 i = 0; i < dmaContext.NumberOfCachedMappings; i++)
+        {
+            mappingCache.Release(*dmaContext.CachedMappings[i]);
+        }
+
+        dmaContext.NumberOfCachedMappings = 0;
+    });
+
+    auto it = AvailableFragments.begin();
+    size_t remain = BytesToCopy;
+
+    for (auto mdl = &Mdl; remain > 0 && mdl != nullptr; mdl = mdl->Next)
+    {
+        size_t const mdlByteCount = MmGetMdlByteCount(mdl);
+        if (mdlByteCount == 0)
+        {
+            continue;
+        }
+
+        NT_ASSERT(MdlOffset < mdlByteCount);
+
+        auto const kvm = reinterpret_cast<ULONG_PTR>(MmGetSystemAddressForMdlSafe(mdl, LowPagePriority | MdlMappingNoExecute));
+        auto const pages = MmGetMdlPfnArray(mdl);
+        size_t const copySize = min(remain, mdlByteCount - MdlOffset);
+
+        auto const vaStart = kvm + MdlOffset;
+        auto const vaEnd = vaStart + copySize;
+
+        for (auto va = vaStart; va < vaEnd; va = reinterpret_cast<ULONG_PTR>(PAGE_ALIGN(va)) + PAGE_SIZE)
+        {
+            auto const numberOfFragments = NetRbFragmentRange(AvailableFragments.begin(), it).Count();
+
+            if (it == AvailableFragments.end() ||
+                numberOfFragments == m_datapathCapabilities.MaximumNumberOfTxFragments ||
+                dmaContext.NumberOfCachedMappings == NX_DMA_MAPPING_CACHE_MAX_PAGES_PER_PACKET)
+            {
+                return { NxNblTranslationStatus::CannotTranslate, EmptyFragmentRange() };
+            }
+
+            // The system VA maps the MDL's pages in order
+            auto const pageIndex =
+                (reinterpret_cast<ULONG_PTR>(PAGE_ALIGN(va)) - reinterpret_cast<ULONG_PTR>(PAGE_ALIGN(kvm))) / PAGE_SIZE;
+
+            auto const mapping = mappingCache.Acquire(pages[pageIndex], PAGE_ALIGN(va));
+
+            if (mapping == nullptr)
+            {
+                return { NxNblTranslationStatus::CannotTranslate, EmptyFragmentRange() };
+            }
+
+            dmaContext.CachedMappings[dmaContext.NumberOfCachedMappings++] = mapping;
+
+            auto const fragmentLength = min(PAGE_SIZE - BYTE_OFFSET(va), vaEnd - va);
+
+            auto& currentFragment = *(it++);
+            RtlZeroMemory(&currentFragment, NetPacketFragmentGetSize());
+
+            currentFragment.VirtualAddress = reinterpret_cast<void *>(va);
+            currentFragment.Mapping.DmaLogicalAddress.QuadPart = mapping->LogicalAddress.QuadPart + BYTE_OFFSET(va);
+            currentFragment.ValidLength = fragmentLength;
+            currentFragment.Capacity = fragmentLength;
+            currentFragment.Offset = 0;
+
+            if (ShouldBounceFragment(currentFragment))
+            {
+                return { NxNblTranslationStatus::CannotTranslate, EmptyFragmentRange() };
+            }
+        }
+
+        remain -= copySize;
+        MdlOffset = 0;
+    }
+
+    if (remain != 0)
+    {
+        return { NxNblTranslationStatus::CannotTranslate, EmptyFragmentRange() };
+    }
+
+    // Keep the references until the packet is cleaned up
+    releaseMappings.release();
+
+    dmaContext.MdlChain = &Mdl;
+    m_stats.DMA.MappedFromCache += 1;
+
+    return { NxNblTranslationStatus::Success, NetRbFragmentRange(AvailableFragments.begin(), it) };
+}
+
 static
 bool
 CanTranslateSglToNetPacket(
@@ -531,6 +872,13 @@ NxNblTranslator::TranslateMdlChainToDmaMappedFragmentRangeUseHal(
     NetRbFragmentRange const &AvailableFragments
     ) const
 {
+    // Declared before the list so that the list is put before its block is
+    // returned to the arena
+    auto freeScatterGatherBuffer = wil::scope_exit([this, &DmaTransfer]()
+    {
+        m_dmaAdapter->FreeScatterGatherBuffer(DmaTransfer);
+    });
+
     NxScatterGatherList sgl { *m_dmaAdapter };
 
     // Build the scatter/gather list using HAL
@@ -611,6 +959,7 @@ NxNblTranslator::TranslateMdlChainToDmaMappedFragmentRangeUseHal(
         // the packet's DMA context. When the packet is completed we will
         // call PutScatterGatherList
         dmaContext.ScatterGatherList = sgl.release();
+        freeScatterGatherBuffer.release();
     }
 
     return result;
@@ -757,83 +1106,137 @@ NxNblTranslator::TranslateNbls(
     NxBounceBufferPool &BouncePool
     ) const
 {
-    for (auto currentPacket = rb.begin(); currentPacket != rb.end(); currentPacket++)
+    NxNblPrefetcher prefetcher{ currentNbl, m_nblPrefetchDistance };
+
+    auto const spans = rb.Spans();
+
+    for (UINT32 s = 0; s < spans.Count; s++)
     {
-        switch (TranslateNetBufferToNetPacket(*currentNetBuffer, &(*currentPacket)))
+        auto const &span = spans.Span[s];
+        auto currentPacket = span.First();
+
+        for (UINT32 i = 0; i < span.Count(); i++, currentPacket = span.Next(currentPacket))
         {
-        case NxNblTranslationStatus::BounceRequired:
-            // The buffers in the NET_BUFFER's MDL chain cannot be transmitted as is. As such we need
-            // to bounce the packet
+            auto const currentIndex = span.GetIndex() + i;
+
+            auto status = NxNblTranslationStatus::CannotTranslate;
+
+            NxBounceChecksum bounceChecksum;
+            auto const checksum = GetBounceChecksum(*currentNbl, *currentNetBuffer, bounceChecksum) ?
+                &bounceChecksum :
+                nullptr;
 
-            if(!BouncePool.BounceNetBuffer(*currentNetBuffer, *currentPacket))
+            if (ShouldCopyBreak(*currentNetBuffer) && BouncePool.BounceNetBuffer(*currentNetBuffer, *currentPacket, checksum))
             {
-                if (currentPacket->IgnoreThisPacket)
+                m_stats.Packet.CopyBreak += 1;
+                status = NxNblTranslationStatus::Success;
+            }
+            else if (!currentPacket->IgnoreThisPacket)
+            {
+                // Either too large to copy-break or the bounce pool ran dry,
+                // in which case mapping the buffers is still an option
+                status = TranslateNetBufferToNetPacket(*currentNetBuffer, currentPacket, BouncePool);
+
+                if (status == NxNblTranslationStatus::Success && RequiresDmaMapping())
                 {
-                    // If it was not possible to bounce the NET_BUFFER and the
-                    // current packet was marked to be ignored we should *not*
-                    // try to translate it again.
-                    m_stats.Packet.CannotTranslate += 1;
-                    break;
+                    m_stats.Packet.DmaMapped += 1;
                 }
-                else
+            }
+
+            switch (status)
+            {
+            case NxNblTranslationStatus::BounceRequired:
+                // The buffers in the NET_BUFFER's MDL chain cannot be transmitted as is. As such we need
+                // to bounce the packet
+
+                if(!BouncePool.BounceNetBuffer(*currentNetBuffer, *currentPacket, checksum))
                 {
-                    // It was not possible to bounce the NET_BUFFER because we're
-                    // out of some resource. Try again later.
-                    m_stats.Packet.BounceFailure += 1;
-                    return currentPacket;
+                    if (currentPacket->IgnoreThisPacket)
+                    {
+                        // If it was not possible to bounce the NET_BUFFER and the
+                        // current packet was marked to be ignored we should *not*
+                        // try to translate it again.
+                        m_stats.Packet.CannotTranslate += 1;
+                        break;
+                    }
+                    else
+                    {
+                        // It was not possible to bounce the NET_BUFFER because we're
+                        // out of some resource. Try again later.
+                        m_stats.Packet.BounceFailure += 1;
+                        return NetRbPacketIterator{ rb.RingBuffer(), currentIndex };
+                    }
                 }
-            }
 
-            m_stats.Packet.BounceSuccess += 1;
-            __fallthrough;
+                m_stats.Packet.BounceSuccess += 1;
 
-        case NxNblTranslationStatus::Success:
-            currentPacket->Layout = NxGetPacketLayout(m_mediaType, &m_datapathDescriptor, &(*currentPacket));
-            TranslateNetBufferListOOBDataToNetPacketExtensions(*currentNbl, &(*currentPacket));
-            break;
-        case NxNblTranslationStatus::InsufficientResources:
-            // There are not enough resources at the moment to translate the NET_BUFFER,
-            // stop processing here. Once there are enough resources available this will
-            // make forward progress
-            return currentPacket;
-
-        case NxNblTranslationStatus::CannotTranslate:
-            // For some reason we won't ever be able to translate the NET_BUFFER,
-            // mark the corresponding NET_PACKET to be dropped.
-            currentPacket->IgnoreThisPacket = true;
-            currentPacket->FragmentCount = 0;
-            m_stats.Packet.CannotTranslate += 1;
-            break;
-        }
+                if (currentPacket->FragmentCount > 1)
+                {
+                    m_stats.Packet.MultiBufferBounce += 1;
+                }
+                __fallthrough;
 
-        if (currentNetBuffer->Next)
-        {
-            currentNetBuffer = currentNetBuffer->Next;
-        }
-        else
-        {
-            // This is the final NB in the NBL, so let's bundle the NBL
-            // up with the NET_PACKET.  We'll find it later when completing packets.
+            case NxNblTranslationStatus::Success:
+                currentPacket->Layout = NxGetPacketLayout(m_mediaType, &m_datapathDescriptor, currentPacket);
+                TranslateNetBufferListOOBDataToNetPacketExtensions(*currentNbl, currentPacket);
 
-            auto &currentPacketExtension = m_contextBuffer.GetPacketContext<PacketContext>(*currentPacket);
-            currentPacketExtension.NetBufferListToComplete = currentNbl;
+                if (checksum != nullptr && checksum->Written)
+                {
+                    // The bounce already filled in the TCP checksum
+                    m_stats.Packet.SoftwareChecksum += 1;
 
-            // Now let's advance to the next NBL.
-            currentNbl = currentNbl->Next;
+                    if (IsPacketChecksumEnabled())
+                    {
+                        NetPacketGetPacketChecksum(currentPacket, m_netPacketChecksumOffset)->Layer4 =
+                            NET_PACKET_TX_CHECKSUM_PASSTHROUGH;
+                    }
+                }
+                break;
+            case NxNblTranslationStatus::InsufficientResources:
+                // There are not enough resources at the moment to translate the NET_BUFFER,
+                // stop processing here. Once there are enough resources available this will
+                // make forward progress
+                return NetRbPacketIterator{ rb.RingBuffer(), currentIndex };
+
+            case NxNblTranslationStatus::CannotTranslate:
+                // For some reason we won't ever be able to translate the NET_BUFFER,
+                // mark the corresponding NET_PACKET to be dropped.
+                currentPacket->IgnoreThisPacket = true;
+                currentPacket->FragmentCount = 0;
+                m_stats.Packet.CannotTranslate += 1;
+                break;
+            }
+
+            if (currentNetBuffer->Next)
+            {
+                currentNetBuffer = currentNetBuffer->Next;
+            }
+            else
+            {
+                // This is the final NB in the NBL, so let's bundle the NBL
+                // up with the NET_PACKET.  We'll find it later when completing packets.
+
+                auto &currentPacketExtension = m_contextBuffer.GetPacketContext<PacketContext>(currentIndex);
+                currentPacketExtension.NetBufferListToComplete = currentNbl;
 
-            // If this was the last NBL, we're done for now.  Remember which packet is next.
-            if (!currentNbl)
-                return ++currentPacket;
+                // Now let's advance to the next NBL.
+                currentNbl = currentNbl->Next;
+                prefetcher.Advance();
 
-            currentNetBuffer = currentNbl->FirstNetBuffer;
+                // If this was the last NBL, we're done for now.  Remember which packet is next.
+                if (!currentNbl)
+                    return NetRbPacketIterator{ rb.RingBuffer(), currentIndex }.GetNext();
+
+                currentNetBuffer = currentNbl->FirstNetBuffer;
 
 #if defined(DBG) && defined(_KERNEL_MODE)
-            // We're trying to avoid writing to the NBL now, but that means it will
-            // temporarily hold a stale pointer.  Scribble a bogus value here to
-            // ensure nobody tries to dereference it until the NBL is completed and
-            // a correct value is written here.
-            currentPacketExtension.NetBufferListToComplete->Next = (NET_BUFFER_LIST*)MM_BAD_POINTER;
+                // We're trying to avoid writing to the NBL now, but that means it will
+                // temporarily hold a stale pointer.  Scribble a bogus value here to
+                // ensure nobody tries to dereference it until the NBL is completed and
+                // a correct value is written here.
+                currentPacketExtension.NetBufferListToComplete->Next = (NET_BUFFER_LIST*)MM_BAD_POINTER;
 #endif
+            }
         }
     }
 
@@ -847,41 +1250,16 @@ ReusePackets(
     _In_ NetRbPacketRange &packets
     )
 {
-    if (packets.Count() == 0)
-        return;
-
-    auto const beginIndex = packets.begin().GetIndex();
-    auto const endIndex = packets.end().GetIndex();
-
-    auto pRb = const_cast<NET_RING_BUFFER *>(&packets.RingBuffer());
+    // If the range wrapped around there are two spans to clean
+    auto const spans = packets.Spans();
 
-    if (beginIndex < endIndex)
+    for (UINT32 s = 0; s < spans.Count; s++)
     {
-        // We didn't wrap around this time, so we can do it in one go.
         NetPacketReuseMany(
             descriptor,
-            packets.At(0),
-            pRb->ElementStride,
-            packets.Count());
-    }
-    else
-    {
-        // Wraparound: clean the first few packets, then the last few packets.
-
-        if (endIndex > 0)
-        {
-            NetPacketReuseMany(
-                descriptor,
-                NetRingBufferGetPacketAtIndex(pRb, 0),
-                pRb->ElementStride,
-                endIndex);
-        }
-
-        NetPacketReuseMany(
-            descriptor,
-            NetRingBufferGetPacketAtIndex(pRb, beginIndex),
-            pRb->ElementStride,
-            (pRb->NumberOfElements - beginIndex));
+            spans.Span[s].First(),
+            spans.Span[s].Stride(),
+            spans.Span[s].Count());
     }
 }
 
@@ -945,40 +1323,86 @@ NxNblTranslator::CompletePackets(
     NxBounceBufferPool &BouncePool
     ) const
 {
-    TxPacketCompletionStatus result{ rb.begin() };
+    TxPacketCompletionStatus result{ rb.end() };
+
+    // Completion is done in passes over the whole range, each touching one
+    // kind of resource, rather than releasing everything packet by packet
 
-    for (; result.CompletedTo != rb.end(); ++result.CompletedTo)
+    // Release any DMA resources allocated for the packets
+    if (m_dmaAdapter)
     {
-        auto &extension = m_contextBuffer.GetPacketContext<PacketContext>(*result.CompletedTo);
+        m_dmaAdapter->CleanupNetPackets(rb);
+    }
 
-        // Release any DMA resources allocated for this packet
-        if (m_dmaAdapter)
-        {
-            m_dmaAdapter->CleanupNetPacket(*result.CompletedTo);
-        }
+    // Return the bounce buffers of all the packets to the pool in bulk
+    BouncePool.FreeBounceBuffers(rb);
+
+    // Chain the NBLs to complete. Fragments are detached from the packets
+    // here and released from the fragment ring at once afterwards.
+    auto fragmentRing = NET_DATAPATH_DESCRIPTOR_GET_FRAGMENT_RING_BUFFER(&m_datapathDescriptor);
+    UINT32 numberOfFragments = 0;
 
-        // Free any bounce buffers allocated for this packet
-        BouncePool.FreeBounceBuffers(*result.CompletedTo);
+    auto const spans = rb.Spans();
+
+    for (UINT32 s = 0; s < spans.Count; s++)
+    {
+        auto const &span = spans.Span[s];
+        auto packet = span.First();
 
-        if (auto completedNbl = extension.NetBufferListToComplete)
+        for (UINT32 i = 0; i < span.Count(); i++, packet = span.Next(packet))
         {
-            extension.NetBufferListToComplete = nullptr;
+            auto &extension = m_contextBuffer.GetPacketContext<PacketContext>(span.GetIndex() + i);
+
+            if (i + 1 < span.Count())
+            {
+                // The next NBL was last touched when it was translated and
+                // is likely out of the cache by now
+                auto const nextNbl = m_contextBuffer.GetPacketContext<PacketContext>(span.GetIndex() + i + 1).NetBufferListToComplete;
+
+                if (nextNbl != nullptr)
+                {
+                    PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, nextNbl);
+                    PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, &nextNbl->Status);
+                }
+            }
+
+            if (auto completedNbl = extension.NetBufferListToComplete)
+            {
+                extension.NetBufferListToComplete = nullptr;
 
-            completedNbl->Status = NDIS_STATUS_SUCCESS;
+                completedNbl->Status = NDIS_STATUS_SUCCESS;
 
-            completedNbl->Next = result.CompletedChain;
-            result.CompletedChain = completedNbl;
+                if (result.CompletedChain == nullptr)
+                {
+                    result.CompletedChainTail = completedNbl;
+                }
 
-            TranslateNetPacketExtensionsCompletionToNetBufferList(
-                &(*result.CompletedTo),
-                completedNbl);
+                completedNbl->Next = result.CompletedChain;
+                result.CompletedChain = completedNbl;
 
-            result.NumCompletedNbls += 1;
-        }
+                TranslateNetPacketExtensionsCompletionToNetBufferList(
+                    packet,
+                    completedNbl);
+
+                result.NumCompletedNbls += 1;
+            }
+
+            if (!packet->IgnoreThisPacket)
+            {
+                NT_ASSERT(packet->FragmentOffset == NetRingBufferIncrementIndexByCount(fragmentRing, fragmentRing->BeginIndex, numberOfFragments));
+
+                numberOfFragments += packet->FragmentCount;
 
-        DetachFragmentsFromPacket(*result.CompletedTo, m_datapathDescriptor);
+                packet->FragmentCount = 0;
+                packet->FragmentOffset = 0;
+            }
+        }
     }
 
+    NT_ASSERT(numberOfFragments <= NetRingBufferGetNumberOfElementsInRange(fragmentRing, fragmentRing->BeginIndex, fragmentRing->EndIndex));
+
+    fragmentRing->BeginIndex = NetRingBufferIncrementIndexByCount(fragmentRing, fragmentRing->BeginIndex, numberOfFragments);
+
     NetRbPacketRange completed{ rb.begin(), result.CompletedTo };
 
     ReusePackets(&m_datapathDescriptor, completed);
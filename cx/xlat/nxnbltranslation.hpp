@@ -16,6 +16,11 @@ struct NxNblTranslationStats
         UINT64 BounceFailure = 0;
         UINT64 CannotTranslate = 0;
         UINT64 UnalignedBuffer = 0;
+        UINT64 CopyBreak = 0;
+        UINT64 PartialBounce = 0;
+        UINT64 MultiBufferBounce = 0;
+        UINT64 SoftwareChecksum = 0;
+        UINT64 DmaMapped = 0;
     } Packet;
 
     struct
@@ -25,6 +30,7 @@ struct NxNblTranslationStats
         UINT64 CannotMapSglToFragments = 0;
         UINT64 PhysicalAddressTooLarge = 0;
         UINT64 OtherErrors = 0;
+        UINT64 MappedFromCache = 0;
     } DMA;
 };
 
@@ -46,6 +52,7 @@ struct TxPacketCompletionStatus
 {
     NetRbPacketIterator CompletedTo;
     NET_BUFFER_LIST *CompletedChain = nullptr;
+    NET_BUFFER_LIST *CompletedChainTail = nullptr;
     UINT32 NumCompletedNbls = 0;
 
     explicit TxPacketCompletionStatus(
@@ -113,6 +120,33 @@ class NONPAGED NxNblTranslator
         _In_ NET_PACKET_FRAGMENT const &Fragment
         ) const;
 
+    bool
+    ShouldCopyBreak(
+        _In_ NET_BUFFER const &NetBuffer
+        ) const;
+
+    bool
+    GetBounceChecksum(
+        _In_ NET_BUFFER_LIST const &NetBufferList,
+        _In_ NET_BUFFER const &NetBuffer,
+        _Out_ NxBounceChecksum &Checksum
+        ) const;
+
+    bool
+    IsLeadingBufferUnaligned(
+        _In_ MDL &Mdl,
+        _In_ size_t MdlOffset
+        ) const;
+
+    NxNblTranslationStatus
+    TranslateMdlChainWithLeadingBounce(
+        _In_ MDL &Mdl,
+        _In_ size_t MdlOffset,
+        _In_ size_t BytesToCopy,
+        _Inout_ NET_PACKET &Packet,
+        _In_ NxBounceBufferPool &BouncePool
+        ) const;
+
     MdlTranlationResult
     TranslateMdlChainToFragmentRangeKvmOnly(
         _In_ MDL &Mdl,
@@ -138,6 +172,15 @@ class NONPAGED NxNblTranslator
         _In_ NetRbFragmentRange const &AvailableFragments
         ) const;
 
+    MdlTranlationResult
+    TranslateMdlChainToDmaMappedFragmentRangeUseCache(
+        _In_ MDL &Mdl,
+        _In_ size_t MdlOffset,
+        _In_ size_t BytesToCopy,
+        _In_ NET_PACKET const &Packet,
+        _In_ NetRbFragmentRange const &AvailableFragments
+        ) const;
+
     MdlTranlationResult
     TranslateMdlChainToDmaMappedFragmentRangeUseHal(
         _In_ MDL &Mdl,
@@ -179,7 +222,8 @@ public:
     NxNblTranslationStatus
     TranslateNetBufferToNetPacket(
         _In_ NET_BUFFER &netBuffer,
-        _Inout_ NET_PACKET* netPacket
+        _Inout_ NET_PACKET* netPacket,
+        _In_ NxBounceBufferPool &BouncePool
         ) const;
 
     NetRbPacketIterator
@@ -199,4 +243,16 @@ public:
     // packet extension offsets
     size_t m_netPacketChecksumOffset = NET_PACKET_EXTENSION_INVALID_OFFSET;
     size_t m_netPacketLsoOffset = NET_PACKET_EXTENSION_INVALID_OFFSET;
+
+    // On DMA mapped NICs packets up to this size are copied into a bounce
+    // buffer instead of being mapped, 0 disables copy-break
+    size_t m_copyBreakThreshold = 0;
+
+    // Bounced TCP packets that ask for checksum offload get their checksum
+    // computed while they are copied instead of by the NIC
+    bool m_bounceChecksum = false;
+
+    // Number of NBLs ahead of the one being translated that are
+    // prefetched, 0 disables prefetching
+    size_t m_nblPrefetchDistance = 0;
 };
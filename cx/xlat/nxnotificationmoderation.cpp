@@ -0,0 +1,253 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Adaptive notification moderation for translator execution contexts.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxNotificationModeration.tmh"
+#include "NxNotificationModeration.hpp"
+
+// Number of packets expected within one latency budget above which the
+// queue coalesces or polls. A mode is left once the expected number of
+// packets drops below half of its threshold, so that a rate close to a
+// threshold does not flip the mode on every window.
+#define NOTIFICATION_MODERATION_COALESCE_PACKETS 2
+#define NOTIFICATION_MODERATION_POLL_PACKETS 32
+
+NxNotificationModeration::~NxNotificationModeration()
+{
+    CancelCoalescingTimer();
+}
+
+_Use_decl_annotations_
+void
+NxNotificationModeration::Initialize(
+    ULONG LatencyBudgetInMicroseconds,
+    NxExecutionContext & ExecutionContext
+    )
+{
+    m_enabled = LatencyBudgetInMicroseconds != 0;
+
+    if (!m_enabled)
+    {
+        return;
+    }
+
+    m_executionContext = &ExecutionContext;
+    m_budgetInMicroseconds = LatencyBudgetInMicroseconds;
+    m_rateWindowStart = NxQueryPerformanceCounter(&m_frequency);
+    m_budgetInTicks = LatencyBudgetInMicroseconds * m_frequency / 1000000;
+
+#ifdef _KERNEL_MODE
+    KeInitializeTimer(&m_coalescingTimer);
+    KeInitializeDpc(&m_coalescingDpc, NxNotificationModeration::CoalescingDpcRoutine, this);
+    m_timerInitialized = true;
+#endif
+}
+
+bool
+NxNotificationModeration::ShouldPoll(
+    ULONG64 TotalPackets,
+    ULONG64 Packets
+    )
+{
+    if (!m_enabled)
+    {
+        return false;
+    }
+
+    auto const now = NxQueryPerformanceCounter(nullptr);
+
+    UpdateMode(now, TotalPackets);
+
+    if (Packets != 0)
+    {
+        m_pollStart = 0;
+        m_pollExpired = false;
+        return false;
+    }
+
+    // Once a polling run found nothing within the budget the EC arms its
+    // notifications, don't start polling again until it finds work
+    if (m_mode != NxNotificationMode::Poll || m_pollExpired)
+    {
+        return false;
+    }
+
+    if (m_pollStart == 0)
+    {
+        m_pollStart = now;
+    }
+
+    if (now - m_pollStart > m_budgetInTicks)
+    {
+        m_counters.PollRunsExpired++;
+        m_pollStart = 0;
+        m_pollExpired = true;
+        return false;
+    }
+
+    m_counters.PollIterations++;
+
+    return true;
+}
+
+void
+NxNotificationModeration::UpdateMode(
+    ULONG64 Now,
+    ULONG64 TotalPackets
+    )
+{
+    auto const elapsed = Now - m_rateWindowStart;
+
+    if (elapsed < m_budgetInTicks || elapsed == 0)
+    {
+        return;
+    }
+
+    auto const windowRate = (TotalPackets - m_rateWindowStartPackets) * m_frequency / elapsed;
+
+    // Exponentially weighted, a single quiet or busy window only moves the
+    // rate a quarter of the way
+    m_packetRate = (m_packetRate * 3 + windowRate) / 4;
+
+    m_rateWindowStart = Now;
+    m_rateWindowStartPackets = TotalPackets;
+
+    auto const expectedPackets = m_packetRate * m_budgetInMicroseconds / 1000000;
+
+    auto pollThreshold = ULONG64{ NOTIFICATION_MODERATION_POLL_PACKETS };
+    auto coalesceThreshold = ULONG64{ NOTIFICATION_MODERATION_COALESCE_PACKETS };
+
+    if (m_mode == NxNotificationMode::Poll)
+    {
+        pollThreshold /= 2;
+    }
+
+    if (m_mode != NxNotificationMode::Interrupt)
+    {
+        coalesceThreshold /= 2;
+    }
+
+    auto mode = NxNotificationMode::Interrupt;
+
+    if (expectedPackets >= pollThreshold)
+    {
+        mode = NxNotificationMode::Poll;
+    }
+    else if (expectedPackets >= coalesceThreshold)
+    {
+        mode = NxNotificationMode::Coalesce;
+    }
+
+    if (mode != m_mode)
+    {
+        m_counters.ModeChanges++;
+        m_mode = mode;
+        m_pollStart = 0;
+        m_pollExpired = false;
+    }
+}
+
+bool
+NxNotificationModeration::ShouldCoalesce(
+    void
+    ) const
+{
+#ifdef _KERNEL_MODE
+    return m_enabled && m_mode == NxNotificationMode::Coalesce;
+#else
+    // There is no timer to wake the EC in user mode
+    return false;
+#endif
+}
+
+_Use_decl_annotations_
+void
+NxNotificationModeration::ArmCoalescingTimer(
+    void
+    )
+{
+    NT_ASSERT(m_enabled);
+
+    m_counters.CoalescingTimerArms++;
+
+#ifdef _KERNEL_MODE
+    LARGE_INTEGER dueTime;
+
+    // relative, in 100ns
+    dueTime.QuadPart = -10 * static_cast<LONGLONG>(m_budgetInMicroseconds);
+
+    KeSetTimer(&m_coalescingTimer, dueTime, &m_coalescingDpc);
+#endif
+}
+
+_Use_decl_annotations_
+void
+NxNotificationModeration::CancelCoalescingTimer(
+    void
+    )
+{
+#ifdef _KERNEL_MODE
+    if (m_timerInitialized)
+    {
+        KeCancelTimer(&m_coalescingTimer);
+        KeFlushQueuedDpcs();
+        m_timerInitialized = false;
+    }
+#endif
+}
+
+#ifdef _KERNEL_MODE
+_Use_decl_annotations_
+VOID
+NxNotificationModeration::CoalescingDpcRoutine(
+    _In_     struct _KDPC *Dpc,
+    _In_opt_ PVOID        DeferredContext,
+    _In_opt_ PVOID        SystemArgument1,
+    _In_opt_ PVOID        SystemArgument2
+    )
+{
+    UNREFERENCED_PARAMETER((Dpc, SystemArgument1, SystemArgument2));
+    auto moderation = static_cast<NxNotificationModeration *>(DeferredContext);
+    moderation->m_executionContext->SignalWork();
+}
+#endif
+
+NxNotificationMode
+NxNotificationModeration::GetMode(
+    void
+    ) const
+{
+    return m_mode;
+}
+
+ULONG64
+NxNotificationModeration::GetPacketRate(
+    void
+    ) const
+{
+    return m_packetRate;
+}
+
+NxNotificationModerationCounters
+NxNotificationModeration::GetCounters(
+    void
+    ) const
+{
+    return m_counters;
+}
+
+void
+NxNotificationModeration::ResetCounters(
+    void
+    )
+{
+    m_counters = {};
+}
@@ -0,0 +1,159 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Adaptive notification moderation for translator execution contexts.
+
+    Without moderation an EC arms its notifications as soon as an iteration
+    makes no progress. Under moderate load that means one NIC notification,
+    and one EC wake up, for every handful of packets. The moderation policy
+    tracks the queue's packet rate from its ring buffer counters and, given
+    a latency budget, picks how the EC waits for the next packets:
+
+        Interrupt   Fewer than a couple of packets are expected within the
+                    budget. Arm the NIC notification as usual, waiting
+                    would add latency without saving any wake up.
+
+        Coalesce    Several packets are expected within the budget. Leave
+                    the NIC notification disarmed and wake the EC from a
+                    timer once the budget has elapsed, so that it handles
+                    the whole batch in one go.
+
+        Poll        A batch is expected well within the budget. Keep
+                    iterating without arming anything for up to the budget,
+                    the next packets will be found before a notification
+                    could have been delivered.
+
+    The NIC client interface has no notion of interrupt moderation, so the
+    coalesced notification is implemented on the translator side.
+
+--*/
+
+#pragma once
+
+#include "NxExecutionContext.hpp"
+
+enum class NxNotificationMode : UINT32
+{
+    Interrupt = 0,
+    Coalesce,
+    Poll,
+};
+
+struct NxNotificationModerationCounters
+{
+    ULONG64 ModeChanges = 0;
+    ULONG64 PollIterations = 0; // idle iterations that polled instead of arming notifications
+    ULONG64 PollRunsExpired = 0; // polling runs that found no work within the latency budget
+    ULONG64 CoalescingTimerArms = 0; // halts that armed the coalescing timer instead of the NIC notification
+};
+
+class NxNotificationModeration
+{
+public:
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    ~NxNotificationModeration(
+        void
+        );
+
+    // A zero latency budget disables moderation, the queue then always
+    // runs in interrupt mode
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    Initialize(
+        _In_ ULONG LatencyBudgetInMicroseconds,
+        _In_ NxExecutionContext & ExecutionContext
+        );
+
+    // Called once per EC iteration with the queue's cumulative packet
+    // count and the number of packets the iteration moved. Updates the
+    // packet rate and the moderation mode. Returns true if the EC should
+    // run another iteration instead of arming notifications.
+    bool
+    ShouldPoll(
+        _In_ ULONG64 TotalPackets,
+        _In_ ULONG64 Packets
+        );
+
+    // True if the NIC side notification should be replaced by the
+    // coalescing timer for the coming halt
+    bool
+    ShouldCoalesce(
+        void
+        ) const;
+
+    // Wakes the EC once the latency budget has elapsed
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    ArmCoalescingTimer(
+        void
+        );
+
+    // Must be called before the EC is terminated
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    CancelCoalescingTimer(
+        void
+        );
+
+    NxNotificationMode
+    GetMode(
+        void
+        ) const;
+
+    ULONG64
+    GetPacketRate(
+        void
+        ) const;
+
+    NxNotificationModerationCounters
+    GetCounters(
+        void
+        ) const;
+
+    void
+    ResetCounters(
+        void
+        );
+
+private:
+
+    void
+    UpdateMode(
+        _In_ ULONG64 Now,
+        _In_ ULONG64 TotalPackets
+        );
+
+    NxExecutionContext * m_executionContext = nullptr;
+
+    bool m_enabled = false;
+
+    ULONG64 m_frequency = 1;
+    ULONG64 m_budgetInTicks = 0;
+    ULONG m_budgetInMicroseconds = 0;
+
+    NxNotificationMode m_mode = NxNotificationMode::Interrupt;
+
+    // packet rate, averaged over windows of one latency budget
+    ULONG64 m_rateWindowStart = 0;
+    ULONG64 m_rateWindowStartPackets = 0;
+    ULONG64 m_packetRate = 0;
+
+    // current polling run, m_pollStart is zero when not polling
+    ULONG64 m_pollStart = 0;
+    bool m_pollExpired = false;
+
+    NxNotificationModerationCounters m_counters;
+
+#ifdef _KERNEL_MODE
+    bool m_timerInitialized = false;
+    KTIMER m_coalescingTimer;
+    KDPC m_coalescingDpc;
+
+    static
+    KDEFERRED_ROUTINE CoalescingDpcRoutine;
+#endif
+};
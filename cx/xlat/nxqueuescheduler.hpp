@@ -0,0 +1,84 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Defines the interfaces between translator queues and the execution
+    contexts that can run several queues without a thread per queue.
+
+--*/
+
+#pragma once
+
+#include "NxExecutionContext.hpp"
+
+/// Implemented by queues whose datapath can be driven one iteration at a
+/// time by an execution context
+class INxExecutionContextQueue
+{
+public:
+
+    /// Applies the queue's priority and affinity settings to the current
+    /// thread
+    virtual
+    void
+    SetupThreadProperties(
+        void
+        ) = 0;
+
+    /// Called on the EC thread each time the queue's EC is started
+    virtual
+    void
+    EcStart(
+        void
+        ) = 0;
+
+    /// Runs one iteration of the datapath
+    virtual
+    void
+    EcRunIteration(
+        void
+        ) = 0;
+
+    /// Returns true if the queue made no progress and the notifications it
+    /// needs were armed on the previous iteration, that is, the EC may halt
+    /// on its behalf. Otherwise arms the notifications it needs and returns
+    /// false.
+    virtual
+    bool
+    EcPrepareToHalt(
+        void
+        ) = 0;
+
+    /// Called after the EC woke up from a halt
+    virtual
+    void
+    EcResumeFromHalt(
+        void
+        ) = 0;
+
+    /// Drives the wind down of a cancelled queue. Returns true once the
+    /// queue has stopped and signalled its EC.
+    virtual
+    bool
+    EcWindDown(
+        void
+        ) = 0;
+};
+
+/// Implemented by execution contexts that run queues on behalf of their
+/// own NxExecutionContext
+class INxQueueScheduler
+{
+public:
+
+    /// Hosts QueueContext, which must not have been initialized otherwise.
+    /// The queue's EC releases the host when it is terminated.
+    virtual
+    NTSTATUS
+    AddQueue(
+        _In_ INxExecutionContextQueue & Queue,
+        _Inout_ NxExecutionContext & QueueContext
+        ) = 0;
+};
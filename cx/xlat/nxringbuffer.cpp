@@ -24,14 +24,30 @@ NxRingBuffer::~NxRingBuffer()
 PAGED
 NTSTATUS
 NxRingBuffer::Initialize(
-    NET_RING_BUFFER * RingBuffer
+    NET_RING_BUFFER * RingBuffer,
+    bool IsolateIndices
     )
 {
     m_rb = RingBuffer;
+    m_isolateIndices = IsolateIndices;
+
+    m_nextOSIndex = m_isolateIndices
+        ? &m_localIndices.NextOSIndex
+        : reinterpret_cast<UINT32*>(&m_rb->OSReserved2[0]);
+
+    ResetLocalIndices();
 
     return STATUS_SUCCESS;
 }
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void
+NxRingBuffer::ResetLocalIndices()
+{
+    m_localIndices.NextOSIndex = m_rb->BeginIndex;
+    m_localIndices.CachedBeginIndex = m_rb->BeginIndex;
+}
+
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NET_PACKET *
 NxRingBuffer::GetNextPacketToGiveToNic()
@@ -59,7 +75,7 @@ NxRingBuffer::TakeNextPacketFromNic()
     auto &index = GetNextOSIndex();
 
     // We've processed all the packets.
-    if (index == m_rb->BeginIndex)
+    if (index == ReturnedPacketsEnd())
         return nullptr;
 
     auto packet = NetRingBufferGetPacketAtIndex(m_rb, index);
@@ -75,16 +91,84 @@ NxRingBuffer::Count() const
 }
 
 UINT32
-NxRingBuffer::GetRingbufferDepth() const
+NxRingBuffer::GetRingbufferDepth(
+    UINT32 BeginIndex
+    ) const
+{
+    return (m_rb->EndIndex - BeginIndex) & m_rb->ElementIndexMask;
+}
+
+void
+NxRingOccupancyHistogram::Record(
+    UINT32 Occupancy
+    )
+{
+    ULONG bucket = 0;
+
+    if (Occupancy != 0)
+    {
+        BitScanReverse(&bucket, Occupancy);
+        bucket = min(bucket + 1, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS - 1);
+    }
+
+    Buckets[bucket]++;
+    NumberOfSamples++;
+    Minimum = min(Minimum, Occupancy);
+    Maximum = max(Maximum, Occupancy);
+}
+
+UINT32
+NxRingOccupancyHistogram::GetPercentile(
+    UINT32 Percent
+    ) const
 {
-    return (m_rb->EndIndex + Count() - m_rb->BeginIndex) % Count();
+    if (NumberOfSamples == 0)
+    {
+        return 0;
+    }
+
+    auto const rank = (NumberOfSamples * Percent + 99) / 100;
+    ULONG64 samplesSeen = 0;
+
+    for (UINT32 i = 0; i < NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS; i++)
+    {
+        samplesSeen += Buckets[i];
+
+        if (samplesSeen >= rank)
+        {
+            UINT32 const upperBound = (i == 0) ? 0 : (1u << i) - 1;
+            return min(max(upperBound, Minimum), Maximum);
+        }
+    }
+
+    return Maximum;
+}
+
+void
+NxRingOccupancyHistogram::GetReportedPercentiles(
+    UINT32 (&Percentiles)[NX_RING_OCCUPANCY_PERCENTILES]
+    ) const
+{
+    Percentiles[0] = GetPercentile(50);
+    Percentiles[1] = GetPercentile(90);
+    Percentiles[2] = GetPercentile(99);
 }
 
 void
 NxRingBuffer::UpdateRingbufferDepthCounters()
 {
     m_rbCounters.IterationCountInLastInterval++;
-    const UINT32 depth = GetRingbufferDepth();
+
+    // With isolated indices sample the cached BeginIndex, reading the one
+    // the NIC driver writes would pull the shared header back in on every
+    // iteration. EndIndex is only written by the EC.
+    const UINT32 beginIndex = m_isolateIndices ? m_localIndices.CachedBeginIndex : m_rb->BeginIndex;
+    const UINT32 depth = GetRingbufferDepth(beginIndex);
+    const UINT32 returned = (beginIndex - GetNextOSIndex()) & m_rb->ElementIndexMask;
+
+    m_rbCounters.Occupancy.NicOwnedPackets.Record(depth);
+    m_rbCounters.Occupancy.ReturnedPackets.Record(returned);
+    m_rbCounters.Occupancy.OsOwnedPackets.Record(Count() - depth - returned);
 
     m_rbCounters.CumulativeRingBufferDepthInLastInterval += depth;
 
@@ -102,6 +186,17 @@ NxRingBuffer::UpdateRingbufferDepthCounters()
     }
 }
 
+void
+NxRingBuffer::UpdateFragmentRingOccupancyCounters(
+    NET_RING_BUFFER const &FragmentRing
+    )
+{
+    const UINT32 nicOwned = (FragmentRing.EndIndex - FragmentRing.BeginIndex) & FragmentRing.ElementIndexMask;
+
+    m_rbCounters.Occupancy.NicOwnedFragments.Record(nicOwned);
+    m_rbCounters.Occupancy.OsOwnedFragments.Record(FragmentRing.NumberOfElements - nicOwned);
+}
+
 void
 NxRingBuffer::UpdateRingbufferPacketCounters(
     _In_ NxRingBufferCounters const &Delta
@@ -125,4 +220,5 @@ NxRingBuffer::ResetRingbufferCounters()
     m_rbCounters.RingbufferEmptyCount = 0;
     m_rbCounters.RingbufferFullyOccupiedCount = 0;
     m_rbCounters.RingbufferPartiallyOccupiedCount = 0;
+    m_rbCounters.Occupancy = {};
 }
@@ -13,6 +13,52 @@ Abstract:
 
 #include "NxRingBufferRange.hpp"
 
+// Bucket 0 counts empty samples, bucket n counts occupancies in
+// [2^(n-1), 2^n - 1] and the last bucket absorbs anything larger.
+#define NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS 17
+
+// Percentiles computed at report time: p50, p90 and p99
+#define NX_RING_OCCUPANCY_PERCENTILES 3
+
+struct NxRingOccupancyHistogram
+{
+    ULONG64 Buckets[NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS] = {};
+    ULONG64 NumberOfSamples = 0;
+    UINT32 Minimum = MAXUINT32;
+    UINT32 Maximum = 0;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    Record(
+        _In_ UINT32 Occupancy
+        );
+
+    // Returns an upper bound of the given percentile, taken from the bucket
+    // that holds it and clamped to the observed minimum and maximum.
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    UINT32
+    GetPercentile(
+        _In_ UINT32 Percent
+        ) const;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    GetReportedPercentiles(
+        _Out_ UINT32 (&Percentiles)[NX_RING_OCCUPANCY_PERCENTILES]
+        ) const;
+};
+
+// Per-interval occupancy of each region of the packet and fragment rings,
+// sampled once per EC iteration.
+struct NxRingOccupancyCounters
+{
+    NxRingOccupancyHistogram OsOwnedPackets;
+    NxRingOccupancyHistogram NicOwnedPackets;
+    NxRingOccupancyHistogram ReturnedPackets;
+    NxRingOccupancyHistogram OsOwnedFragments;
+    NxRingOccupancyHistogram NicOwnedFragments;
+};
+
 struct NxRingBufferCounters
 {
     ULONG64 NumberOfNetPacketsProduced = 0;
@@ -22,6 +68,19 @@ struct NxRingBufferCounters
     ULONG64 RingbufferFullyOccupiedCount = 0;
     ULONG64 RingbufferEmptyCount = 0;
     ULONG64 RingbufferPartiallyOccupiedCount = 0;
+    NxRingOccupancyCounters Occupancy;
+};
+
+// Ring indices owned by the translator. The NET_RING_BUFFER header keeps
+// BeginIndex and EndIndex next to each other and is written by both the NIC
+// driver and the EC thread, so when isolated indices are enabled the OS next
+// index is kept here instead of in OSReserved2[0], together with a cached copy
+// of BeginIndex that is refreshed only once the cached view has been consumed.
+// Nothing in this structure is ever touched by the NIC driver.
+struct NxRingBufferLocalIndices
+{
+    UINT32 NextOSIndex = 0;
+    UINT32 CachedBeginIndex = 0;
 };
 
 /// Encapsulates a NET_RING_BUFFER
@@ -33,9 +92,15 @@ public:
 
     PAGED NTSTATUS
     Initialize(
-        NET_RING_BUFFER * RingBuffer
+        NET_RING_BUFFER * RingBuffer,
+        bool IsolateIndices = false
         );
 
+    // Resynchronizes the translator owned indices with the NET_RING_BUFFER
+    // header. Must be called after the queue has been (re)started.
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void ResetLocalIndices();
+
     _IRQL_requires_max_(DISPATCH_LEVEL)
     NET_RING_BUFFER *Get() { return m_rb; }
 
@@ -93,13 +158,33 @@ public:
     _IRQL_requires_max_(DISPATCH_LEVEL)
     NetRbPacketRange ReturnedPackets()
     {
-        return NetRbPacketRange{ Next(), Begin() };
+        return NetRbPacketRange{ *m_rb, GetNextOSIndex(), ReturnedPacketsEnd() };
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    bool AnyReturnedPackets()
+    {
+        return GetNextOSIndex() != ReturnedPacketsEnd();
     }
 
+    // Returns the index one past the last packet returned by the NIC. With
+    // isolated indices this is the cached copy of BeginIndex, which is only
+    // re-read from the shared header when every packet up to it has been
+    // consumed.
     _IRQL_requires_max_(DISPATCH_LEVEL)
-    bool AnyReturnedPackets() const
+    UINT32 ReturnedPacketsEnd()
     {
-        return GetNextOSIndex() != m_rb->BeginIndex;
+        if (! m_isolateIndices)
+        {
+            return m_rb->BeginIndex;
+        }
+
+        if (m_localIndices.NextOSIndex == m_localIndices.CachedBeginIndex)
+        {
+            m_localIndices.CachedBeginIndex = ReadULongNoFence(reinterpret_cast<ULONG volatile *>(&m_rb->BeginIndex));
+        }
+
+        return m_localIndices.CachedBeginIndex;
     }
 
     // Returns the next NET_PACKET that will be given to the NIC.
@@ -160,10 +245,10 @@ public:
     }
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
-    UINT32 &GetNextOSIndex() { return *reinterpret_cast<UINT32*>(&m_rb->OSReserved2[0]); }
+    UINT32 &GetNextOSIndex() { return *m_nextOSIndex; }
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
-    UINT32 const &GetNextOSIndex() const { return *reinterpret_cast<UINT32 const*>(&m_rb->OSReserved2[0]); }
+    UINT32 const &GetNextOSIndex() const { return *m_nextOSIndex; }
 
     _IRQL_requires_max_(DISPATCH_LEVEL)
     void
@@ -175,10 +260,21 @@ public:
     void
     UpdateRingbufferDepthCounters();
 
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    UpdateFragmentRingOccupancyCounters(
+        _In_ NET_RING_BUFFER const &FragmentRing
+        );
+
     _IRQL_requires_max_(DISPATCH_LEVEL)
     NxRingBufferCounters
     GetRingbufferCounters() const;
 
+    // Unlike the interval counters the packet counters are never reset
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    ULONG64
+    GetNumberOfNetPacketsProduced() const { return m_rbCounters.NumberOfNetPacketsProduced; }
+
     _IRQL_requires_max_(DISPATCH_LEVEL)
     void
     ResetRingbufferCounters();
@@ -186,8 +282,14 @@ public:
 private:
     _IRQL_requires_max_(DISPATCH_LEVEL)
     UINT32
-    GetRingbufferDepth() const;
+    GetRingbufferDepth(
+        _In_ UINT32 BeginIndex
+        ) const;
 
     NET_RING_BUFFER * m_rb = nullptr;
+    UINT32 * m_nextOSIndex = nullptr;
+    bool m_isolateIndices = false;
     NxRingBufferCounters m_rbCounters;
+
+    NxRingBufferLocalIndices m_localIndices;
 };
@@ -125,6 +125,67 @@ public:
     }
 };
 
+// A run of ring buffer elements that are contiguous in memory. Consecutive
+// elements are ElementStride bytes apart, which is not necessarily sizeof(T),
+// so use Next() rather than pointer increment to walk the span.
+template<typename T>
+class NetRingBufferSpan
+{
+    UCHAR * m_first = nullptr;
+    UINT32 m_index = 0;
+    UINT32 m_count = 0;
+    UINT32 m_stride = 0;
+
+public:
+
+    NetRingBufferSpan() = default;
+
+    NetRingBufferSpan(NET_RING_BUFFER const & rb, UINT32 index, UINT32 count) :
+        m_first(const_cast<UCHAR *>(rb.Buffer) + static_cast<size_t>(index) * rb.ElementStride),
+        m_index(index),
+        m_count(count),
+        m_stride(rb.ElementStride)
+    {
+        NT_ASSERT(index + count <= rb.NumberOfElements);
+    }
+
+    T *First() const
+    {
+        return reinterpret_cast<T *>(m_first);
+    }
+
+    T *Next(T const *element) const
+    {
+        return reinterpret_cast<T *>(reinterpret_cast<UCHAR *>(const_cast<T *>(element)) + m_stride);
+    }
+
+    // Ring index of the first element, the element at position n in the span
+    // has index GetIndex() + n.
+    UINT32 GetIndex() const
+    {
+        return m_index;
+    }
+
+    UINT32 Count() const
+    {
+        return m_count;
+    }
+
+    UINT32 Stride() const
+    {
+        return m_stride;
+    }
+};
+
+// A NetRingBufferRange split into at most two contiguous spans, the second one
+// is only used when the range wraps around the end of the ring.
+template<typename T>
+struct NetRingBufferSpans
+{
+    NetRingBufferSpan<T> Span[2];
+    UINT32 Count = 0;
+};
+
 template<typename T>
 class NetRingBufferRange
 {
@@ -152,6 +213,42 @@ public:
     iterator begin() const { return iterator(m_rb, m_begin); }
     iterator end()   const { return iterator(m_rb, m_end);   }
 
+    // Returns an iterator to the n-th element of the range, n == Count()
+    // yields end().
+    iterator GetIterator(UINT32 n) const
+    {
+        NT_ASSERT(n <= Count());
+
+        return iterator(m_rb, (m_begin + n) & m_rb.ElementIndexMask);
+    }
+
+    // Splits the range into contiguous spans so that hot loops can walk the
+    // elements with pointer arithmetic instead of masking and multiplying on
+    // every step.
+    NetRingBufferSpans<T> Spans() const
+    {
+        NetRingBufferSpans<T> spans;
+
+        if (m_begin == m_end)
+            return spans;
+
+        if (m_begin < m_end)
+        {
+            spans.Span[spans.Count++] = NetRingBufferSpan<T>(m_rb, m_begin, m_end - m_begin);
+        }
+        else
+        {
+            spans.Span[spans.Count++] = NetRingBufferSpan<T>(m_rb, m_begin, m_rb.NumberOfElements - m_begin);
+
+            if (m_end > 0)
+            {
+                spans.Span[spans.Count++] = NetRingBufferSpan<T>(m_rb, 0, m_end);
+            }
+        }
+
+        return spans;
+    }
+
     UINT32 Count() const
     {
         return (m_end - m_begin) & m_rb.ElementIndexMask;
@@ -203,3 +300,5 @@ using NetRbPacketRange = NetRingBufferRange<NET_PACKET>;
 using NetRbPacketIterator = NetRingBufferIterator<NET_PACKET>;
 using NetRbFragmentIterator = NetRingBufferIterator<NET_PACKET_FRAGMENT>;
 using NetRbFragmentRange = NetRingBufferRange<NET_PACKET_FRAGMENT>;
+using NetRbPacketSpan = NetRingBufferSpan<NET_PACKET>;
+using NetRbPacketSpans = NetRingBufferSpans<NET_PACKET>;
@@ -76,6 +76,9 @@ static const NET_CLIENT_QUEUE_NOTIFY_DISPATCH QueueDispatch
 ULONG const MAX_DYNAMIC_PAGES = 16;
 ULONG const MAX_DYNAMIC_PACKET_SIZE = (MAX_DYNAMIC_PAGES - 1) * PAGE_SIZE + 1;
 
+// Number of NBLs the background population allocates between checks for cancellation
+UINT32 const RX_NBL_POPULATION_BATCH_SIZE = 64;
+
 constexpr
 USHORT
 ByteSwap(
@@ -164,16 +167,29 @@ NxRxXlat::NxRxXlat(
     m_dispatch(Dispatch),
     m_adapter(Adapter),
     m_adapterDispatch(AdapterDispatch),
+    m_nblPopulationWorkItem(this, &NxRxXlat::PopulateRemainingNbls),
     m_contextBuffer(m_ringBuffer)
 {
     m_adapterDispatch->GetProperties(m_adapter, &m_adapterProperties);
     m_nblDispatcher = static_cast<INxNblDispatcher *>(m_adapterProperties.NblDispatcher);
     ndisInitializeNblQueue(&m_discardedNbl);
 
+    // nothing to wait for until background population is queued
+    m_nblPopulationComplete.Set();
+
     m_shouldReportCounters = m_dispatch->NetClientQueryDriverConfigurationBoolean(RX_REPORT_PERF_COUNTERS);
     m_counterReportInterval = m_dispatch->NetClientQueryDriverConfigurationUlong(RX_PERF_COUNTERS_ITERATION_INTERVAL);
     m_shouldUpdateEcCounters = m_dispatch->NetClientQueryDriverConfigurationBoolean(EC_UPDATE_PERF_COUNTERS);
 
+    m_busyPoll.Initialize(
+        m_dispatch->NetClientQueryDriverConfigurationUlong(EC_BUSY_POLL_BUDGET_US),
+        m_dispatch->NetClientQueryDriverConfigurationUlong(EC_BUSY_POLL_BUDGET_ITERATIONS),
+        m_dispatch->NetClientQueryDriverConfigurationUlong(EC_BUSY_POLL_PACKET_RATE_THRESHOLD));
+
+    m_moderation.Initialize(
+        m_dispatch->NetClientQueryDriverConfigurationUlong(EC_NOTIFICATION_LATENCY_BUDGET_US),
+        m_executionContext);
+
     if (m_shouldReportCounters)
     {
 #ifdef _KERNEL_MODE
@@ -238,7 +254,12 @@ NxRxXlat::GetNotificationsToArm()
     {
         notifications.Flags.ShouldArmNblReturned = true;
 
-        notifications.Flags.ShouldArmRxIndication = m_outstandingPackets != 0;
+        // When moderation expects more packets within the latency budget, pick
+        // them up in one batch from the coalescing timer instead of having the
+        // adapter notify the first one
+        auto const coalesce = m_moderation.ShouldCoalesce() && !m_executionContext.IsStopping();
+        notifications.Flags.ShouldArmRxIndication = m_outstandingPackets != 0 && !coalesce;
+        notifications.Flags.ShouldArmCoalescingTimer = m_outstandingPackets != 0 && coalesce;
     }
 
     return notifications;
@@ -259,6 +280,11 @@ NxRxXlat::ArmNotifications(
     {
         ArmAdapterRxNotification();
     }
+
+    if (notifications.Flags.ShouldArmCoalescingTimer)
+    {
+        m_moderation.ArmCoalescingTimer();
+    }
 }
 
 void
@@ -323,22 +349,39 @@ NxRxXlat::EcPrepareBuffersForNetAdapter()
 {
     m_returnedPackets = 0;
 
-    while (auto pCurrentPacket = m_ringBuffer.GetNextPacketToGiveToNic())
-    {
-        NT_ASSERT(pCurrentPacket->FragmentCount == 0);
+    auto const available = m_ringBuffer.AvailablePackets();
+    auto const spans = available.Spans();
+    UINT32 packetsGiven = 0;
+    bool outOfBuffers = false;
 
-        auto & packetContext = m_contextBuffer.GetPacketContext<PacketContext>(*pCurrentPacket);
-        NT_ASSERT(packetContext.NetBufferList == nullptr);
+    for (UINT32 s = 0; s < spans.Count && !outOfBuffers; s++)
+    {
+        auto const &span = spans.Span[s];
+        auto pCurrentPacket = span.First();
 
-        if (!NT_SUCCESS(AttachEmptyDataBufferToNetPacket(pCurrentPacket,
-                                                         &packetContext.NetBufferList)))
+        for (UINT32 i = 0; i < span.Count(); i++, pCurrentPacket = span.Next(pCurrentPacket))
         {
-            break;
-        }
+            NT_ASSERT(pCurrentPacket->FragmentCount == 0);
 
-        --m_outstandingPackets;
+            auto & packetContext = m_contextBuffer.GetPacketContext<PacketContext>(span.GetIndex() + i);
+            NT_ASSERT(packetContext.NetBufferList == nullptr);
+
+            if (!NT_SUCCESS(AttachEmptyDataBufferToNetPacket(pCurrentPacket,
+                                                             &packetContext.NetBufferList)))
+            {
+                outOfBuffers = true;
+                break;
+            }
 
-        m_ringBuffer.GiveNextPacketToNic();
+            --m_outstandingPackets;
+            ++packetsGiven;
+        }
+    }
+
+    // Publish EndIndex once for the whole batch
+    if (packetsGiven > 0)
+    {
+        m_ringBuffer.AdvanceEnd(available.GetIterator(packetsGiven));
     }
 }
 
@@ -349,9 +392,7 @@ NxRxXlat::EcUpdateAffinity()
     {
         while (InterlockedExchange(&m_groupAffinityChanged, 0))
         {
-#ifdef _KERNEL_MODE
-            KeSetSystemGroupAffinityThread(&m_groupAffinity, NULL);
-#endif
+            m_executionContext.SetGroupAffinity(m_groupAffinity);
         }
     }
 }
@@ -359,7 +400,17 @@ NxRxXlat::EcUpdateAffinity()
 void
 NxRxXlat::EcYieldToNetAdapter()
 {
+    if (m_latencyTracker)
+    {
+        m_latencyTracker->StampPosted();
+    }
+
     m_queueDispatch->Advance(m_queue);
+
+    if (m_latencyTracker)
+    {
+        m_latencyTracker->StampReturned();
+    }
 }
 
 static size_t g_NetBufferOffset = sizeof(NET_BUFFER_LIST);
@@ -404,53 +455,59 @@ NxRxXlat::EcIndicateNblsToNdis()
 {
     NxNblSequence nblsToIndicate;
 
-    auto pRing = m_ringBuffer.Get();
-    auto packetIndex = m_ringBuffer.GetNextOSIndex();
-    auto isLastPacket = packetIndex == pRing->BeginIndex;
+    auto const pRing = m_ringBuffer.Get();
+    auto const returned = m_ringBuffer.ReturnedPackets();
+    auto const spans = returned.Spans();
+    auto remaining = returned.Count();
 
-    while (true)
+    for (UINT32 s = 0; s < spans.Count; s++)
     {
-        if (isLastPacket)
+        auto const &span = spans.Span[s];
+        auto completed = span.First();
+
+        for (UINT32 i = 0; i < span.Count(); i++, completed = span.Next(completed), remaining--)
         {
-            m_ringBuffer.GetNextOSIndex() = packetIndex;
-            break;
-        }
+            auto const packetIndex = span.GetIndex() + i;
 
-        auto nextPacketIndex = NetRingBufferIncrementIndex(pRing, packetIndex);
-        isLastPacket = (nextPacketIndex == pRing->BeginIndex);
+            if (remaining > 1)
+            {
+                auto const nextPacketIndex = (packetIndex + 1) & pRing->ElementIndexMask;
+                PrefetchNblForReceiveIndication(m_contextBuffer.GetPacketContext<PacketContext>(nextPacketIndex).NetBufferList);
+            }
 
-        if (!isLastPacket)
-            PrefetchNblForReceiveIndication(m_contextBuffer.GetPacketContext<PacketContext>(nextPacketIndex).NetBufferList);
+            bool shouldIndicate = false;
+            PNET_BUFFER_LIST nbl = nullptr;
 
-        auto completed = NetRingBufferGetPacketAtIndex(pRing, packetIndex);
+            if (!completed->IgnoreThisPacket)
+            {
+                auto & packetContext = m_contextBuffer.GetPacketContext<PacketContext>(packetIndex);
 
-        bool shouldIndicate = false;
-        PNET_BUFFER_LIST nbl = nullptr;
+                nbl = packetContext.NetBufferList;
+                packetContext.NetBufferList = nullptr;
 
-        if (!completed->IgnoreThisPacket)
-        {
-            auto & packetContext = m_contextBuffer.GetPacketContext<PacketContext>(*completed);
-
-            nbl = packetContext.NetBufferList;
-            packetContext.NetBufferList = nullptr;
+                shouldIndicate = TransferDataBufferFromNetPacketToNbl(completed, nbl);
+            }
 
-            shouldIndicate = TransferDataBufferFromNetPacketToNbl(completed, nbl);
-        }
+            if (shouldIndicate)
+            {
+                nblsToIndicate.AddNbl(nbl);
+            }
+            else if (nbl)
+            {
+                ndisAppendNblChainToNblQueueFast(&m_discardedNbl, nbl, nbl);
+            }
 
-        if (shouldIndicate)
-        {
-            nblsToIndicate.AddNbl(nbl);
-        }
-        else if (nbl)
-        {
-            ndisAppendNblChainToNblQueueFast(&m_discardedNbl, nbl, nbl);
+            ReinitializePacket(completed);
         }
+    }
 
-        ReinitializePacket(completed);
-
-        packetIndex = nextPacketIndex;
+    if (m_latencyTracker)
+    {
+        m_latencyTracker->StampCompleted(returned);
     }
 
+    m_ringBuffer.AdvanceNext(returned.end());
+
     m_postedPackets = nblsToIndicate.GetCount();
 
     if (!nblsToIndicate)
@@ -480,6 +537,30 @@ NxRxXlat::EcIndicateNblsToNdis()
 void
 NxRxXlat::WaitForWork()
 {
+    if (EcPrepareToHalt())
+    {
+        m_executionContext.WaitForWork();
+        EcResumeFromHalt();
+    }
+}
+
+bool
+NxRxXlat::EcPrepareToHalt()
+{
+    // Within the busy-poll budget keep iterating, which advances the NIC
+    // and polls the NBL queue, rather than arming notifications and parking
+    if (m_busyPoll.ShouldPoll(m_postedPackets + m_returnedPackets) && !m_executionContext.IsStopping())
+    {
+        return false;
+    }
+
+    // Likewise while moderation expects a batch within the latency budget
+    if (m_moderation.ShouldPoll(m_ringBuffer.GetNumberOfNetPacketsProduced(), m_postedPackets + m_returnedPackets) &&
+        !m_executionContext.IsStopping())
+    {
+        return false;
+    }
+
     auto notificationsToArm = GetNotificationsToArm();
 
     // In order to handle race conditions, the notifications that should
@@ -488,15 +569,21 @@ NxRxXlat::WaitForWork()
     // and loop again.
     if (notificationsToArm.Value != 0 && notificationsToArm.Value == m_lastArmedNotifications.Value)
     {
-        m_executionContext.WaitForWork();
-
-        // after halting, don't arm any notifications
-        notificationsToArm.Value = 0;
+        return true;
     }
 
     ArmNotifications(notificationsToArm);
 
     m_lastArmedNotifications = notificationsToArm;
+
+    return false;
+}
+
+void
+NxRxXlat::EcResumeFromHalt()
+{
+    // after halting, don't arm any notifications
+    m_lastArmedNotifications.Value = 0;
 }
 
 static EC_START_ROUTINE NetAdapterReceiveThread;
@@ -512,7 +599,7 @@ NetAdapterReceiveThread(
 }
 
 void
-NxRxXlat::SetupRxThreadProperties()
+NxRxXlat::SetupThreadProperties()
 {
 #if _KERNEL_MODE
     // setup thread prioirty;
@@ -545,73 +632,122 @@ NxRxXlat::SetupRxThreadProperties()
 void
 NxRxXlat::ReceiveThread()
 {
-    SetupRxThreadProperties();
+    SetupThreadProperties();
 
     while (! m_executionContext.IsTerminated())
     {
-        m_queueDispatch->Start(m_queue);
+        EcStart();
 
-        auto cancelIssued = false;
-
-        while (true)
+        do
         {
-            EcReturnBuffers();
+            EcRunIteration();
+            WaitForWork();
 
-            // provide buffers to NetAdapter only if running
-            if (! m_executionContext.IsStopping())
-            {
-                EcPrepareBuffersForNetAdapter();
-            }
+        } while (! EcWindDown());
+    }
+}
 
-            EcUpdateAffinity();
-            EcYieldToNetAdapter();
+void
+NxRxXlat::EcStart()
+{
+    m_queueDispatch->Start(m_queue);
+    m_ringBuffer.ResetLocalIndices();
 
-            // update ringbuffer counters;
-            m_ringBuffer.UpdateRingbufferDepthCounters();
+    if (m_latencyTracker)
+    {
+        m_latencyTracker->Reset();
+    }
 
-            EcIndicateNblsToNdis();
+    m_cancelIssued = false;
+}
 
-            if (m_shouldUpdateEcCounters)
-            {
-                // end of iteration, update execution context counters;
-                m_executionContext.UpdateCounters(
-                    m_postedPackets == 0 && m_returnedPackets == 0);
-            }
+void
+NxRxXlat::EcRunIteration()
+{
+    auto const pRing = m_ringBuffer.Get();
 
-            WaitForWork();
+    m_stageCounters.StartStage();
+    EcReturnBuffers();
+    m_stageCounters.EndStage(NxRxStage::ReturnBuffers, m_returnedPackets);
 
-            // This represents the wind down of Rx
-            if (m_executionContext.IsStopping())
-            {
-                if (!cancelIssued)
-                {
-                    // Indicate cancellation to the adapter
-                    // and drop all outstanding NBLs.
-                    //
-                    // One NBL may remain that has been partially programmed into the NIC.
-                    // So that NBL is kept around until the end.
+    // provide buffers to NetAdapter only if running
+    if (! m_executionContext.IsStopping())
+    {
+        auto const endIndex = pRing->EndIndex;
 
-                    m_queueDispatch->Cancel(m_queue);
+        m_stageCounters.StartStage();
+        EcPrepareBuffersForNetAdapter();
+        m_stageCounters.EndStage(NxRxStage::PrepareBuffers,
+            NetRingBufferGetNumberOfElementsInRange(pRing, endIndex, pRing->EndIndex));
+    }
 
-                    cancelIssued = true;
-                }
+    EcUpdateAffinity();
 
-                // The termination condition is that all packets have been returned from the NIC.
-                if (! m_ringBuffer.AnyNicPackets())
-                {
-                    EcRecoverBuffers();
-                    m_queueDispatch->Stop(m_queue);
-                    m_executionContext.SignalStopped();
-                    break;
-                }
-            }
-        }
+    auto const beginIndex = pRing->BeginIndex;
+
+    m_stageCounters.StartStage();
+    EcYieldToNetAdapter();
+    m_stageCounters.EndStage(NxRxStage::YieldToNetAdapter,
+        NetRingBufferGetNumberOfElementsInRange(pRing, beginIndex, pRing->BeginIndex));
+
+    // update ringbuffer counters;
+    m_ringBuffer.UpdateRingbufferDepthCounters();
+    m_ringBuffer.UpdateFragmentRingOccupancyCounters(
+        *NET_DATAPATH_DESCRIPTOR_GET_FRAGMENT_RING_BUFFER(m_descriptor));
+
+    auto const nextIndex = m_ringBuffer.GetNextOSIndex();
+
+    m_stageCounters.StartStage();
+    EcIndicateNblsToNdis();
+    m_stageCounters.EndStage(NxRxStage::IndicateNbls,
+        NetRingBufferGetNumberOfElementsInRange(pRing, nextIndex, m_ringBuffer.GetNextOSIndex()));
+
+    if (m_shouldUpdateEcCounters)
+    {
+        // end of iteration, update execution context counters;
+        m_executionContext.UpdateCounters(
+            m_postedPackets == 0 && m_returnedPackets == 0);
+    }
+}
+
+bool
+NxRxXlat::EcWindDown()
+{
+    // This represents the wind down of Rx
+    if (! m_executionContext.IsStopping())
+    {
+        return false;
+    }
+
+    if (!m_cancelIssued)
+    {
+        // Indicate cancellation to the adapter
+        // and drop all outstanding NBLs.
+        //
+        // One NBL may remain that has been partially programmed into the NIC.
+        // So that NBL is kept around until the end.
+
+        m_queueDispatch->Cancel(m_queue);
+
+        m_cancelIssued = true;
     }
+
+    // The termination condition is that all packets have been returned from the NIC.
+    if (m_ringBuffer.AnyNicPackets())
+    {
+        return false;
+    }
+
+    EcRecoverBuffers();
+    m_queueDispatch->Stop(m_queue);
+    m_executionContext.SignalStopped();
+
+    return true;
 }
 
 NTSTATUS
 NxRxXlat::Initialize(
-    void
+    _In_opt_ INxQueueScheduler * QueueScheduler
     )
 {
     CX_RETURN_IF_NOT_NT_SUCCESS_MSG(CreateVariousPools(),
@@ -655,18 +791,53 @@ NxRxXlat::Initialize(
     m_descriptor = m_queueDispatch->GetNetDatapathDescriptor(m_queue);
 
     CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
-        m_ringBuffer.Initialize(NET_DATAPATH_DESCRIPTOR_GET_PACKET_RING_BUFFER(m_descriptor)),
+        m_ringBuffer.Initialize(
+            NET_DATAPATH_DESCRIPTOR_GET_PACKET_RING_BUFFER(m_descriptor),
+            m_dispatch->NetClientQueryDriverConfigurationBoolean(RING_BUFFER_ISOLATED_INDICES)),
         "Failed to initialize packet ring buffer.");
 
     CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
         m_contextBuffer.Initialize(sizeof(PacketContext)),
         "Failed to initialize private context.");
 
-    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
-        m_executionContext.Initialize(this, NetAdapterReceiveThread),
-        "Failed to start Rx execution context. NxRxXlat=%p", this);
+    auto const latencySamplingInterval =
+        m_dispatch->NetClientQueryDriverConfigurationUlong(PACKET_LATENCY_SAMPLING_INTERVAL);
 
-    m_executionContext.SetDebugNameHint(L"Receive", GetQueueId(), m_adapterProperties.NetLuid);
+    if (latencySamplingInterval != 0)
+    {
+        m_latencyTracker = wil::make_unique_nothrow<NxLatencyTracker>(m_ringBuffer, latencySamplingInterval);
+
+        if (!m_latencyTracker)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(m_latencyTracker->Initialize());
+    }
+
+    if (QueueScheduler)
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            QueueScheduler->AddQueue(*this, m_executionContext),
+            "Failed to add Rx queue to queue scheduler. NxRxXlat=%p", this);
+    }
+    else
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            m_executionContext.Initialize(this, NetAdapterReceiveThread),
+            "Failed to start Rx execution context. NxRxXlat=%p", this);
+
+        m_executionContext.SetDebugNameHint(L"Receive", GetQueueId(), m_adapterProperties.NetLuid);
+    }
+
+    // CreateVariousPools only populated enough NBLs to fill the packet ring,
+    // the rest are allocated in the background so that bring up is not
+    // blocked on allocating the whole pool
+    if (static_cast<UINT32>(m_numNblsPopulated) < m_rxNumNbls)
+    {
+        m_nblPopulationComplete.Clear();
+        m_nblPopulationWorkItem.Queue();
+    }
 
     return STATUS_SUCCESS;
 }
@@ -741,7 +912,9 @@ NxRxXlat::CreateVariousPools()
     poolParameters.ContextSize = 0;
     poolParameters.DataSize = 0;
 
-    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !m_NblLookupTable.reserve(m_rxNumNbls));
+    // the lookup table is sized up front so that the background population
+    // never reallocates it while the EC thread is drawing NBLs from it
+    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !m_NblLookupTable.resize(m_rxNumNbls));
 
     m_netBufferListPool.reset(NdisAllocateNetBufferListPool(m_adapterProperties.NdisAdapterHandle,
                                                             &poolParameters));
@@ -757,7 +930,12 @@ NxRxXlat::CreateVariousPools()
 
     if (m_rxBufferAllocationMode != NET_CLIENT_MEMORY_MANAGEMENT_MODE_DRIVER)
     {
-        // create buffer pool if the driver wants the OS to allocate Rx buffer
+        // create buffer pool if the driver wants the OS to allocate Rx buffer.
+        // Coloring staggers the headers across cache sets at the cost of up
+        // to a coloring stride per buffer, so it is left to the configuration
+        auto const cacheColoring =
+            m_dispatch->NetClientQueryDriverConfigurationBoolean(RX_BUFFER_CACHE_COLORING);
+
         NET_CLIENT_BUFFER_POOL_CONFIG bufferPoolConfig = {
             &datapathCapabilities.RxMemoryConstraints,
             m_rxNumDataBuffers,
@@ -765,7 +943,8 @@ NxRxXlat::CreateVariousPools()
             m_backfillSize,
             0,
             MM_ANY_NODE_OK,                      //default numa node
-            NET_CLIENT_BUFFER_POOL_FLAGS_NONE   //non-serialized version
+            (cacheColoring ? NET_CLIENT_BUFFER_POOL_FLAGS_CACHE_COLORING : NET_CLIENT_BUFFER_POOL_FLAGS_NONE) | //non-serialized
+                (m_shouldReportCounters ? NET_CLIENT_BUFFER_POOL_FLAGS_TRACK_HOLD_TIME : NET_CLIENT_BUFFER_POOL_FLAGS_NONE)
         };
 
         CX_RETURN_IF_NOT_NT_SUCCESS(
@@ -774,56 +953,124 @@ NxRxXlat::CreateVariousPools()
                                                   &m_bufferPoolDispatch));
     }
 
-    for (size_t i = 0; i < m_rxNumNbls; i++)
+    // populate only the working set needed to fill the packet ring, the
+    // remaining NBLs are populated by PopulateRemainingNbls after the queue
+    // has been created
+    CX_RETURN_IF_NOT_NT_SUCCESS(PopulateNbls(min(m_rxNumNbls, m_rxNumPackets)));
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NxRxXlat::AllocateNbl(
+    _In_ size_t Index
+    )
+{
+    PNET_BUFFER_LIST nbl =
+        NdisAllocateNetBufferAndNetBufferList(m_netBufferListPool.get(),
+                                              0,
+                                              0,
+                                              nullptr,
+                                              0,
+                                              0);
+
+    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !nbl);
+
+    PNET_BUFFER nb = NET_BUFFER_LIST_FIRST_NB(nbl);
+    size_t mdlSize = ALIGN_UP(MmSizeOfMdl(DUMMY_VA, m_rxDataBufferSize), PVOID);
+    PMDL mdl = reinterpret_cast<PMDL>(((size_t) m_MdlPool.get()) + Index * mdlSize);
+    NET_BUFFER_FIRST_MDL(nb) = NET_BUFFER_CURRENT_MDL(nb) = mdl;
+
+    auto internalAllocationOffset = (UCHAR*)nb - (UCHAR*)nbl;
+    if (internalAllocationOffset < 4 * sizeof(NET_BUFFER_LIST))
+        g_NetBufferOffset = internalAllocationOffset;
+
+    if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH)
     {
-        PNET_BUFFER_LIST nbl =
-            NdisAllocateNetBufferAndNetBufferList(m_netBufferListPool.get(),
-                                                  0,
-                                                  0,
-                                                  nullptr,
-                                                  0,
-                                                  0);
+        //
+        // pre-built MDL if the driver wants the OS to automatic attach the Rx buffer
+        // to the NET_PACKETs
+        //
 
-        CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !nbl);
 
-        PNET_BUFFER nb = NET_BUFFER_LIST_FIRST_NB(nbl);
-        PMDL mdl = reinterpret_cast<PMDL>(((size_t) m_MdlPool.get()) + i * mdlSize);
-        NET_BUFFER_FIRST_MDL(nb) = NET_BUFFER_CURRENT_MDL(nb) = mdl;
 
-        auto internalAllocationOffset = (UCHAR*)nb - (UCHAR*)nbl;
-        if (internalAllocationOffset < 4 * sizeof(NET_BUFFER_LIST))
-            g_NetBufferOffset = internalAllocationOffset;
 
-        if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH)
+
+
+        NET_PACKET_FRAGMENT data;
+
+        if (1 != m_bufferPoolDispatch->NetClientAllocateBuffers(m_bufferPool, &data, 1))
         {
-            //
-            // pre-built MDL if the driver wants the OS to automatic attach the Rx buffer
-            // to the NET_PACKETs
-            //
+            NdisFreeNetBufferList(nbl);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        GetRxContextFromNb(nb)->DmaLogicalAddress = data.Mapping.DmaLogicalAddress.QuadPart;
+
+        MmInitializeMdl(mdl, data.VirtualAddress, data.Capacity);
+        MmBuildMdlForNonPagedPool(mdl);
+    }
 
+    m_NblLookupTable[Index] = nbl;
 
+    return STATUS_SUCCESS;
+}
 
+NTSTATUS
+NxRxXlat::PopulateNbls(
+    _In_ UINT32 Count
+    )
+{
+    //
+    // Only this routine appends NBLs to the lookup table. Slots at or above
+    // m_numNblsPopulated are never touched by the EC thread, so they can be
+    // filled in while the queue is running and then published by advancing
+    // m_numNblsPopulated.
+    //
+    // In OS_ALLOCATE_AND_ATTACH mode the EC thread never allocates from or
+    // frees to the buffer pool, so allocating data buffers here does not
+    // race with the datapath.
+    //
+    UINT32 populated = static_cast<UINT32>(m_numNblsPopulated);
 
+    while (populated < Count)
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS(AllocateNbl(populated));
 
+        populated++;
+        (void)InterlockedExchange(&m_numNblsPopulated, static_cast<LONG>(populated));
+    }
 
-            NET_PACKET_FRAGMENT data;
+    return STATUS_SUCCESS;
+}
 
-            CX_RETURN_NTSTATUS_IF(
-                STATUS_INSUFFICIENT_RESOURCES,
-                1 != m_bufferPoolDispatch->NetClientAllocateBuffers(m_bufferPool,
-                                                                    &data,
-                                                                    1));
+void
+NxRxXlat::PopulateRemainingNbls(
+    void
+    )
+{
+    // Populate in batches so that a queue being destroyed does not wait for
+    // the whole pool. If an allocation fails the queue keeps running with
+    // the NBLs populated so far.
+    while (!m_nblPopulationCancelled)
+    {
+        auto const populated = static_cast<UINT32>(m_numNblsPopulated);
 
-            GetRxContextFromNb(nb)->DmaLogicalAddress = data.Mapping.DmaLogicalAddress.QuadPart;
+        if (populated >= m_rxNumNbls)
+        {
+            break;
+        }
 
-            MmInitializeMdl(mdl, data.VirtualAddress, data.Capacity);
-            MmBuildMdlForNonPagedPool(mdl);
+        if (!NT_SUCCESS(PopulateNbls(min(populated + RX_NBL_POPULATION_BATCH_SIZE, m_rxNumNbls))))
+        {
+            break;
         }
 
-        m_NblLookupTable.append(nbl);
+        // the EC thread might be waiting for NBLs to become available
+        m_executionContext.SignalWork();
     }
 
-    return STATUS_SUCCESS;
+    m_nblPopulationComplete.Set();
 }
 
 void
@@ -909,10 +1156,17 @@ NxRxXlat::~NxRxXlat()
     }
 #endif
 
+    m_moderation.CancelCoalescingTimer();
+
+    // The background population signals the EC, it must be done before the
+    // EC is terminated and the pools are torn down
+    (void)InterlockedExchange(&m_nblPopulationCancelled, TRUE);
+    m_nblPopulationComplete.Wait();
+
     // stop the EC and wait for wind down.
     m_executionContext.Terminate();
 
-    for (size_t i = 0; i < m_NblLookupTable.count(); i++)
+    for (size_t i = 0; i < static_cast<UINT32>(m_numNblsPopulated); i++)
     {
         PNET_BUFFER_LIST nbl = m_NblLookupTable[i];
 
@@ -961,8 +1215,11 @@ NxRxXlat::AttachEmptyDataBufferToNetPacket(
     _Inout_ PNET_PACKET Packet,
     _Out_ PNET_BUFFER_LIST* Nbl)
 {
-    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
-                          m_NumOfNblsInUse == m_rxNumDataBuffers);
+    if (m_NumOfNblsInUse == static_cast<UINT32>(ReadAcquire(&m_numNblsPopulated)))
+    {
+        m_nblAllocationFailures++;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
     if (Packet->FragmentCount == 0)
     {
@@ -1282,7 +1539,14 @@ NxRxXlat::FreeReceivedDataBuffer(PNET_BUFFER_LIST nbl)
 PNET_BUFFER_LIST
 NxRxXlat::DrawNblFromPool()
 {
-    return m_NblLookupTable[m_NumOfNblsInUse++];
+    auto nbl = m_NblLookupTable[m_NumOfNblsInUse++];
+
+    if (m_NumOfNblsInUse > m_nblsInUseHighWatermark)
+    {
+        m_nblsInUseHighWatermark = m_NumOfNblsInUse;
+    }
+
+    return nbl;
 }
 
 void
@@ -1332,6 +1596,41 @@ NxRxXlat::ReportCounters()
     ULONG64 usefulIterationCount =
         localECCounters.IterationCount - localECCounters.BusyWaitIterationCount;
 
+    auto const busyPollCounters = m_busyPoll.GetCounters();
+    m_busyPoll.ResetCounters();
+
+    auto const moderationCounters = m_moderation.GetCounters();
+    m_moderation.ResetCounters();
+
+    UINT32 osOwnedPacketsPercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+    UINT32 nicOwnedPacketsPercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+    UINT32 returnedPacketsPercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+    UINT32 osOwnedFragmentsPercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+    UINT32 nicOwnedFragmentsPercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+
+    auto const &occupancy = localRBCounters.Occupancy;
+    occupancy.OsOwnedPackets.GetReportedPercentiles(osOwnedPacketsPercentiles);
+    occupancy.NicOwnedPackets.GetReportedPercentiles(nicOwnedPacketsPercentiles);
+    occupancy.ReturnedPackets.GetReportedPercentiles(returnedPacketsPercentiles);
+    occupancy.OsOwnedFragments.GetReportedPercentiles(osOwnedFragmentsPercentiles);
+    occupancy.NicOwnedFragments.GetReportedPercentiles(nicOwnedFragmentsPercentiles);
+
+    NET_CLIENT_BUFFER_POOL_COUNTERS bufferPoolCounters = {};
+    if (m_bufferPool)
+    {
+        m_bufferPoolDispatch->NetClientGetBufferPoolCounters(m_bufferPool, &bufferPoolCounters);
+        m_bufferPoolDispatch->NetClientResetBufferPoolCounters(m_bufferPool);
+    }
+
+    // Like the pool counters, NBL pressure is reported per interval
+    auto const nblsInUseHighWatermark = m_nblsInUseHighWatermark;
+    auto const nblAllocationFailures = m_nblAllocationFailures;
+    m_nblsInUseHighWatermark = m_NumOfNblsInUse;
+    m_nblAllocationFailures = 0;
+
+    ULONG64 bufferAverageHoldTime = bufferPoolCounters.NumberOfFrees == 0 ? 0 :
+        bufferPoolCounters.CumulativeHoldTime / bufferPoolCounters.NumberOfFrees;
+
     TraceLoggingWrite(
         g_hNetAdapterCxXlatProvider,
         "RxTranslationCounterUpdates",
@@ -1343,6 +1642,26 @@ NxRxXlat::ReportCounters()
         TraceLoggingUInt64(localRBCounters.RingbufferEmptyCount, "numberOfRingbufferEmptySamples"),
         TraceLoggingUInt64(localRBCounters.RingbufferFullyOccupiedCount, "numberOfRingbufferFullSamples"),
         TraceLoggingUInt64(localRBCounters.RingbufferPartiallyOccupiedCount, "numberOfRingbufferPartiallyUsedSamples"),
+        TraceLoggingUInt64Array(occupancy.OsOwnedPackets.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "osOwnedPacketsLog2Histogram"),
+        TraceLoggingUInt32(occupancy.OsOwnedPackets.NumberOfSamples == 0 ? 0 : occupancy.OsOwnedPackets.Minimum, "osOwnedPacketsMinimum"),
+        TraceLoggingUInt32(occupancy.OsOwnedPackets.Maximum, "osOwnedPacketsMaximum"),
+        TraceLoggingUInt32Array(osOwnedPacketsPercentiles, NX_RING_OCCUPANCY_PERCENTILES, "osOwnedPacketsP50P90P99"),
+        TraceLoggingUInt64Array(occupancy.NicOwnedPackets.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "nicOwnedPacketsLog2Histogram"),
+        TraceLoggingUInt32(occupancy.NicOwnedPackets.NumberOfSamples == 0 ? 0 : occupancy.NicOwnedPackets.Minimum, "nicOwnedPacketsMinimum"),
+        TraceLoggingUInt32(occupancy.NicOwnedPackets.Maximum, "nicOwnedPacketsMaximum"),
+        TraceLoggingUInt32Array(nicOwnedPacketsPercentiles, NX_RING_OCCUPANCY_PERCENTILES, "nicOwnedPacketsP50P90P99"),
+        TraceLoggingUInt64Array(occupancy.ReturnedPackets.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "returnedPacketsLog2Histogram"),
+        TraceLoggingUInt32(occupancy.ReturnedPackets.NumberOfSamples == 0 ? 0 : occupancy.ReturnedPackets.Minimum, "returnedPacketsMinimum"),
+        TraceLoggingUInt32(occupancy.ReturnedPackets.Maximum, "returnedPacketsMaximum"),
+        TraceLoggingUInt32Array(returnedPacketsPercentiles, NX_RING_OCCUPANCY_PERCENTILES, "returnedPacketsP50P90P99"),
+        TraceLoggingUInt64Array(occupancy.OsOwnedFragments.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "osOwnedFragmentsLog2Histogram"),
+        TraceLoggingUInt32(occupancy.OsOwnedFragments.NumberOfSamples == 0 ? 0 : occupancy.OsOwnedFragments.Minimum, "osOwnedFragmentsMinimum"),
+        TraceLoggingUInt32(occupancy.OsOwnedFragments.Maximum, "osOwnedFragmentsMaximum"),
+        TraceLoggingUInt32Array(osOwnedFragmentsPercentiles, NX_RING_OCCUPANCY_PERCENTILES, "osOwnedFragmentsP50P90P99"),
+        TraceLoggingUInt64Array(occupancy.NicOwnedFragments.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "nicOwnedFragmentsLog2Histogram"),
+        TraceLoggingUInt32(occupancy.NicOwnedFragments.NumberOfSamples == 0 ? 0 : occupancy.NicOwnedFragments.Minimum, "nicOwnedFragmentsMinimum"),
+        TraceLoggingUInt32(occupancy.NicOwnedFragments.Maximum, "nicOwnedFragmentsMaximum"),
+        TraceLoggingUInt32Array(nicOwnedFragmentsPercentiles, NX_RING_OCCUPANCY_PERCENTILES, "nicOwnedFragmentsP50P90P99"),
         TraceLoggingUInt64(localRBCounters.NumberOfNetPacketsProduced, "totalNumberOfNetpacketsProducedForReceive"),
         TraceLoggingUInt64(localRBCounters.NumberOfNetPacketsConsumed, "totalNumberOfNetpacketsCompletedReceiving"),
         TraceLoggingUInt64(localECCounters.IterationCount, "ecUpdateIterationCount"),
@@ -1351,7 +1670,85 @@ NxRxXlat::ReportCounters()
         TraceLoggingUInt64(localECCounters.TotalCpuCycleTime, "totalNumberOfCpuCyclesRecord"),
         TraceLoggingUInt64(localECCounters.BusyWaitCycles, "numberOfCpuCyclesPolledWithNoPackets"),
         TraceLoggingUInt64(localECCounters.ProcessingCycles, "numberOfCpuCyclesSpentProcessingPackets"),
-        TraceLoggingUInt64(localECCounters.IdleCycles, "numberOfCpuCyclesSleeping")
+        TraceLoggingUInt64(localECCounters.IdleCycles, "numberOfCpuCyclesSleeping"),
+        TraceLoggingUInt64(busyPollCounters.Polls, "busyPollIterations"),
+        TraceLoggingUInt64(busyPollCounters.PollsWithWork, "busyPollRunsThatFoundWork"),
+        TraceLoggingUInt64(busyPollCounters.BudgetExhausted, "busyPollRunsThatExhaustedBudget"),
+        TraceLoggingUInt64(busyPollCounters.SuppressedByPacketRate, "busyPollIdleIterationsBelowPacketRate"),
+        TraceLoggingUInt64(m_busyPoll.GetPacketRate(), "busyPollPacketRate"),
+        TraceLoggingUInt32(static_cast<UINT32>(m_moderation.GetMode()), "notificationMode"),
+        TraceLoggingUInt64(m_moderation.GetPacketRate(), "notificationModerationPacketRate"),
+        TraceLoggingUInt64(moderationCounters.ModeChanges, "notificationModeChanges"),
+        TraceLoggingUInt64(moderationCounters.PollIterations, "notificationModerationPollIterations"),
+        TraceLoggingUInt64(moderationCounters.PollRunsExpired, "notificationModerationPollRunsExpired"),
+        TraceLoggingUInt64(moderationCounters.CoalescingTimerArms, "notificationModerationCoalescingTimerArms"),
+        TraceLoggingUInt64(static_cast<UINT32>(m_numNblsPopulated), "nblPoolSize"),
+        TraceLoggingUInt64(m_NumOfNblsInUse, "nblsInUse"),
+        TraceLoggingUInt64(nblsInUseHighWatermark, "nblsInUseHighWatermark"),
+        TraceLoggingUInt64(nblAllocationFailures, "nblAllocationFailures"),
+        TraceLoggingUInt64(bufferPoolCounters.PoolSize, "rxBufferPoolSize"),
+        TraceLoggingUInt64(bufferPoolCounters.BuffersInUse, "rxBuffersInUse"),
+        TraceLoggingUInt64(bufferPoolCounters.BuffersInUseHighWatermark, "rxBuffersInUseHighWatermark"),
+        TraceLoggingUInt64(bufferPoolCounters.AllocationFailures, "rxBufferAllocationFailures"),
+        TraceLoggingUInt64Array(bufferPoolCounters.AllocationBatchSizeHistogram, NET_CLIENT_BUFFER_POOL_BATCH_SIZE_BUCKETS, "rxBufferAllocationBatchSizeLog2Histogram"),
+        TraceLoggingUInt64(bufferAverageHoldTime, "rxBufferAverageHoldTimeInCycles"),
+        TraceLoggingUInt64(bufferPoolCounters.NumberOfChunks, "rxBufferPoolNumberOfChunks"),
+        TraceLoggingUInt64(bufferPoolCounters.MinimumChunkOccupancy, "rxBufferPoolMinimumChunkOccupancy"),
+        TraceLoggingUInt64(bufferPoolCounters.MaximumChunkOccupancy, "rxBufferPoolMaximumChunkOccupancy")
     );
+
+    if (m_latencyTracker)
+    {
+        auto const & postToReturn = m_latencyTracker->GetHistogram(NxLatencyInterval::PostToReturn);
+        ULONG64 postToReturnPercentiles[NX_LATENCY_PERCENTILES];
+        postToReturn.GetReportedPercentiles(postToReturnPercentiles);
+        auto const & returnToIndication = m_latencyTracker->GetHistogram(NxLatencyInterval::ReturnToCompletion);
+        ULONG64 returnToIndicationPercentiles[NX_LATENCY_PERCENTILES];
+        returnToIndication.GetReportedPercentiles(returnToIndicationPercentiles);
+
+        TraceLoggingWrite(
+            g_hNetAdapterCxXlatProvider,
+            "RxLatencyCounterUpdates",
+            TraceLoggingDescription("RX sampled packet latency event"),
+            TraceLoggingUInt32(m_executionContext.GetExecutionContextIdentifier(), "threadID"),
+            TraceLoggingUInt64(postToReturn.NumberOfSamples, "postToReturnSamples"),
+            TraceLoggingUInt64(postToReturn.Maximum, "postToReturnMaximumNs"),
+            TraceLoggingUInt64Array(postToReturnPercentiles, NX_LATENCY_PERCENTILES, "postToReturnP50P90P99P999Ns"),
+            TraceLoggingUInt64Array(postToReturn.Buckets, NX_LATENCY_HISTOGRAM_BUCKETS, "postToReturnHistogram"),
+            TraceLoggingUInt64(returnToIndication.NumberOfSamples, "returnToIndicationSamples"),
+            TraceLoggingUInt64(returnToIndication.Maximum, "returnToIndicationMaximumNs"),
+            TraceLoggingUInt64Array(returnToIndicationPercentiles, NX_LATENCY_PERCENTILES, "returnToIndicationP50P90P99P999Ns"),
+            TraceLoggingUInt64Array(returnToIndication.Buckets, NX_LATENCY_HISTOGRAM_BUCKETS, "returnToIndicationHistogram")
+        );
+
+        m_latencyTracker->ResetHistograms();
+    }
+
+#if XLAT_STAGE_CYCLE_COUNTERS
+    auto const returnBuffers = m_stageCounters.GetCounters(NxRxStage::ReturnBuffers);
+    auto const prepareBuffers = m_stageCounters.GetCounters(NxRxStage::PrepareBuffers);
+    auto const yieldToNetAdapter = m_stageCounters.GetCounters(NxRxStage::YieldToNetAdapter);
+    auto const indicateNbls = m_stageCounters.GetCounters(NxRxStage::IndicateNbls);
+    m_stageCounters.ResetCounters();
+
+    TraceLoggingWrite(
+        g_hNetAdapterCxXlatProvider,
+        "RxStageCycleCounterUpdates",
+        TraceLoggingDescription("RX per-stage cycle counter event"),
+        TraceLoggingUInt32(m_executionContext.GetExecutionContextIdentifier(), "threadID"),
+        TraceLoggingUInt64(returnBuffers.Cycles, "returnBuffersCycles"),
+        TraceLoggingUInt64(returnBuffers.Packets, "returnBuffersPackets"),
+        TraceLoggingUInt64(returnBuffers.GetCyclesPerPacket(), "returnBuffersCyclesPerPacket"),
+        TraceLoggingUInt64(prepareBuffers.Cycles, "prepareBuffersCycles"),
+        TraceLoggingUInt64(prepareBuffers.Packets, "prepareBuffersPackets"),
+        TraceLoggingUInt64(prepareBuffers.GetCyclesPerPacket(), "prepareBuffersCyclesPerPacket"),
+        TraceLoggingUInt64(yieldToNetAdapter.Cycles, "yieldToNetAdapterCycles"),
+        TraceLoggingUInt64(yieldToNetAdapter.Packets, "yieldToNetAdapterPackets"),
+        TraceLoggingUInt64(yieldToNetAdapter.GetCyclesPerPacket(), "yieldToNetAdapterCyclesPerPacket"),
+        TraceLoggingUInt64(indicateNbls.Cycles, "indicateNblsCycles"),
+        TraceLoggingUInt64(indicateNbls.Packets, "indicateNblsPackets"),
+        TraceLoggingUInt64(indicateNbls.GetCyclesPerPacket(), "indicateNblsCyclesPerPacket")
+    );
+#endif
 }
 
@@ -12,13 +12,19 @@ Abstract:
 #pragma once
 
 #include <NetClientAdapter.h>
+#include <KWorkItem.h>
+#include <KWaitEvent.h>
 
-#include "NxExecutionContext.hpp"
+#include "NxQueueScheduler.hpp"
 #include "NxSignal.hpp"
 #include "NxRingBuffer.hpp"
 #include "NxContextBuffer.hpp"
 #include "NxNbl.hpp"
 #include "NxNblQueue.hpp"
+#include "NxStageCounters.hpp"
+#include "NxBusyPoll.hpp"
+#include "NxNotificationModeration.hpp"
+#include "NxLatencyTracker.hpp"
 
 class NxNblRx :
     public INxNblRx,
@@ -35,7 +41,17 @@ class NxNblRx :
     );
 };
 
+enum class NxRxStage
+{
+    ReturnBuffers,
+    PrepareBuffers,
+    YieldToNetAdapter,
+    IndicateNbls,
+    Count
+};
+
 class NxRxXlat :
+    public INxExecutionContextQueue,
     public NxNonpagedAllocation<'lXRN'>
 {
 public:
@@ -62,7 +78,7 @@ public:
     _IRQL_requires_(PASSIVE_LEVEL)
     NTSTATUS
     Initialize(
-        void
+        _In_opt_ INxQueueScheduler * QueueScheduler
         );
 
     _IRQL_requires_(PASSIVE_LEVEL)
@@ -121,6 +137,46 @@ public:
         void
         );
 
+    //
+    // INxExecutionContextQueue
+    //
+
+    virtual
+    void
+    SetupThreadProperties(
+        void
+        );
+
+    virtual
+    void
+    EcStart(
+        void
+        );
+
+    virtual
+    void
+    EcRunIteration(
+        void
+        );
+
+    virtual
+    bool
+    EcPrepareToHalt(
+        void
+        );
+
+    virtual
+    void
+    EcResumeFromHalt(
+        void
+        );
+
+    virtual
+    bool
+    EcWindDown(
+        void
+        );
+
 private:
 
     size_t m_queueId = ~0U;
@@ -155,7 +211,8 @@ private:
             {
                 bool ShouldArmRxIndication : 1;
                 bool ShouldArmNblReturned : 1;
-                UINT8 Reserved : 6;
+                bool ShouldArmCoalescingTimer : 1;
+                UINT8 Reserved : 5;
             } Flags;
 
             UINT8 Value = 0;
@@ -179,6 +236,16 @@ private:
     Rtl::KArray<PNET_BUFFER_LIST, NonPagedPoolNx> m_NblLookupTable;
     KPoolPtrNP<MDL> m_MdlPool;
 
+    // number of entries in m_NblLookupTable that have been allocated, grows
+    // from the initial working set to m_rxNumNbls as the background
+    // population runs
+    volatile LONG m_numNblsPopulated = 0;
+    size_t m_nblsInUseHighWatermark = 0;
+    ULONG64 m_nblAllocationFailures = 0;
+    KWorkItem<NxRxXlat> m_nblPopulationWorkItem;
+    KWaitEvent m_nblPopulationComplete;
+    volatile LONG m_nblPopulationCancelled = FALSE;
+
     NET_CLIENT_MEMORY_MANAGEMENT_MODE m_rxBufferAllocationMode = NET_CLIENT_MEMORY_MANAGEMENT_MODE_DRIVER;
     size_t m_rxDataBufferSize = 0;
     UINT32 m_rxNumDataBuffers = 0;
@@ -198,11 +265,19 @@ private:
     NxRingBuffer m_ringBuffer;
     NxContextBuffer m_contextBuffer;
 
+    // only allocated when packet latency sampling is enabled
+    wistd::unique_ptr<NxLatencyTracker> m_latencyTracker;
+
     // changes as translation routine runs
     ULONG m_outstandingPackets = 0;
     ULONG m_postedPackets = 0;
     ULONG m_returnedPackets = 0;
 
+    // Set once the adapter queue has been cancelled during wind down
+    bool m_cancelIssued = false;
+
+    NxStageCycleCounters<NxRxStage, static_cast<size_t>(NxRxStage::Count)> m_stageCounters;
+
 #ifdef _KERNEL_MODE
     KTIMER m_CounterReportTimer;
     KDPC m_CounterReportDpc;
@@ -288,6 +363,22 @@ private:
     NTSTATUS
     CreateVariousPools();
 
+    NTSTATUS
+    AllocateNbl(
+        _In_ size_t Index
+        );
+
+    NTSTATUS
+    PopulateNbls(
+        _In_ UINT32 Count
+        );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    PopulateRemainingNbls(
+        void
+        );
+
     NTSTATUS
     PreparePacketExtensions(
         _Inout_ Rtl::KArray<NET_CLIENT_PACKET_EXTENSION>& addedPacketExtensions
@@ -302,13 +393,13 @@ private:
     bool
     IsPacketChecksumEnabled() const;
 
-    void
-    SetupRxThreadProperties();
-
     bool m_shouldReportCounters = false;
     ULONG m_counterReportInterval = 0;
     bool m_shouldUpdateEcCounters = false;
 
+    NxBusyPoll m_busyPoll;
+    NxNotificationModeration m_moderation;
+
 #ifdef  _KERNEL_MODE
     static
     KDEFERRED_ROUTINE CounterReportDpcRoutine;
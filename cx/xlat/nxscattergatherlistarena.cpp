@@ -0,0 +1,192 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Slab arena for the buffers HAL builds scatter/gather lists in.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxScatterGatherListArena.tmh"
+
+#include "NxScatterGatherListArena.hpp"
+
+#define NX_SGL_ARENA_POOL_TAG 'aSxN'
+
+// The slab header is padded so that blocks keep the pool alignment
+#define NX_SGL_ARENA_SLAB_HEADER_SIZE ALIGN_UP_BY(sizeof(Slab), MEMORY_ALLOCATION_ALIGNMENT)
+
+NxScatterGatherListArena::~NxScatterGatherListArena(
+    void
+    )
+{
+    FreeSlabs(m_small);
+    FreeSlabs(m_large);
+}
+
+_Use_decl_annotations_
+void
+NxScatterGatherListArena::Initialize(
+    ULONG SmallBlockSize,
+    ULONG LargeBlockSize,
+    ULONG MaximumBlocks
+    )
+{
+    // Blocks hold a free list link while not in use, and the SGL HAL
+    // builds in them needs pointer alignment
+    m_small.BlockSize = ALIGN_UP_BY(max(SmallBlockSize, static_cast<ULONG>(sizeof(FreeBlock))), MEMORY_ALLOCATION_ALIGNMENT);
+
+    if (LargeBlockSize > SmallBlockSize)
+    {
+        m_large.BlockSize = ALIGN_UP_BY(LargeBlockSize, MEMORY_ALLOCATION_ALIGNMENT);
+    }
+
+    auto const numberOfSlabs = (MaximumBlocks + NX_SGL_ARENA_BLOCKS_PER_SLAB - 1) / NX_SGL_ARENA_BLOCKS_PER_SLAB;
+
+    m_maximumBytes =
+        static_cast<size_t>(numberOfSlabs) * NX_SGL_ARENA_SLAB_HEADER_SIZE +
+        static_cast<size_t>(MaximumBlocks) * m_small.BlockSize;
+}
+
+_Use_decl_annotations_
+bool
+NxScatterGatherListArena::Grow(
+    SizeClass & Class
+    )
+{
+    size_t const headerSize = NX_SGL_ARENA_SLAB_HEADER_SIZE;
+    size_t const remainingBytes = m_maximumBytes - m_counters.AllocatedBytes;
+
+    if (remainingBytes < headerSize + Class.BlockSize)
+    {
+        return false;
+    }
+
+    auto const numberOfBlocks = static_cast<ULONG>(
+        min(size_t{ NX_SGL_ARENA_BLOCKS_PER_SLAB }, (remainingBytes - headerSize) / Class.BlockSize));
+
+    size_t const slabSize = headerSize + static_cast<size_t>(numberOfBlocks) * Class.BlockSize;
+
+    auto slab = static_cast<Slab *>(ExAllocatePoolWithTag(NonPagedPoolNx, slabSize, NX_SGL_ARENA_POOL_TAG));
+
+    if (slab == nullptr)
+    {
+        return false;
+    }
+
+    slab->Next = Class.Slabs;
+    Class.Slabs = slab;
+
+    auto blocks = reinterpret_cast<UCHAR *>(slab) + headerSize;
+
+    for (ULONG i = 0; i < numberOfBlocks; i++)
+    {
+        auto block = reinterpret_cast<FreeBlock *>(blocks + static_cast<size_t>(i) * Class.BlockSize);
+
+        block->Next = Class.FreeBlocks;
+        Class.FreeBlocks = block;
+    }
+
+    Class.NumberOfBlocks += numberOfBlocks;
+    m_counters.AllocatedBytes += slabSize;
+
+    return true;
+}
+
+_Use_decl_annotations_
+void
+NxScatterGatherListArena::FreeSlabs(
+    SizeClass & Class
+    )
+{
+    NT_ASSERT(Class.BlocksInUse == 0);
+
+    while (Class.Slabs != nullptr)
+    {
+        auto slab = Class.Slabs;
+        Class.Slabs = slab->Next;
+
+        ExFreePoolWithTag(slab, NX_SGL_ARENA_POOL_TAG);
+    }
+
+    Class.FreeBlocks = nullptr;
+    Class.NumberOfBlocks = 0;
+}
+
+_Use_decl_annotations_
+void *
+NxScatterGatherListArena::Allocate(
+    bool Large,
+    ULONG & BlockSize
+    )
+{
+    auto * sizeClass = Large && HasLargeBlocks() ? &m_large : &m_small;
+
+    BlockSize = 0;
+
+    if (sizeClass->FreeBlocks == nullptr && !Grow(*sizeClass))
+    {
+        // The budget might have gone to large blocks
+        if (sizeClass != &m_small || m_large.FreeBlocks == nullptr)
+        {
+            return nullptr;
+        }
+
+        sizeClass = &m_large;
+    }
+
+    auto block = sizeClass->FreeBlocks;
+    sizeClass->FreeBlocks = block->Next;
+    sizeClass->BlocksInUse++;
+
+    if (sizeClass == &m_large)
+    {
+        m_counters.LargeBlockAllocations++;
+    }
+
+    BlockSize = sizeClass->BlockSize;
+
+    return block;
+}
+
+_Use_decl_annotations_
+void
+NxScatterGatherListArena::Free(
+    void * Block,
+    ULONG BlockSize
+    )
+{
+    auto & sizeClass = BlockSize == m_small.BlockSize ? m_small : m_large;
+
+    NT_ASSERT(BlockSize == sizeClass.BlockSize);
+    NT_ASSERT(sizeClass.BlocksInUse > 0);
+
+    auto block = static_cast<FreeBlock *>(Block);
+    block->Next = sizeClass.FreeBlocks;
+    sizeClass.FreeBlocks = block;
+    sizeClass.BlocksInUse--;
+}
+
+bool
+NxScatterGatherListArena::HasLargeBlocks(
+    void
+    ) const
+{
+    return m_large.BlockSize != 0;
+}
+
+NxScatterGatherListArenaCounters
+NxScatterGatherListArena::GetCounters(
+    void
+    ) const
+{
+    auto counters = m_counters;
+
+    counters.SmallBlocksInUse = m_small.BlocksInUse;
+    counters.LargeBlocksInUse = m_large.BlocksInUse;
+
+    return counters;
+}
@@ -0,0 +1,117 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Slab arena for the buffers HAL builds scatter/gather lists in.
+
+    Rather than preallocating an MTU sized scatter/gather list for every
+    packet of the ring, a buffer is taken from the arena when a packet is
+    mapped and returned once the packet completes, so memory follows the
+    number of DMA mapped packets in flight instead of the ring size.
+
+    Blocks come in two sizes. Small blocks fit the list of an MTU sized
+    packet, large blocks the list of the largest packet the NIC accepts.
+    Blocks are carved out of slabs allocated as the arena runs out of
+    them, slabs are kept until the arena is destroyed. Both sizes share
+    one budget, the arena never takes more memory than a small block for
+    every packet of the ring would.
+
+    The arena is not synchronized, it is only used from the queue's
+    execution context.
+
+--*/
+
+#pragma once
+
+// Number of blocks carved out of each slab
+#define NX_SGL_ARENA_BLOCKS_PER_SLAB 32
+
+struct NxScatterGatherListArenaCounters
+{
+    size_t AllocatedBytes = 0; // slabs, in bytes
+    ULONG SmallBlocksInUse = 0;
+    ULONG LargeBlocksInUse = 0;
+    ULONG64 LargeBlockAllocations = 0;
+};
+
+class NxScatterGatherListArena : public NxNonpagedAllocation<'aSxN'>
+{
+public:
+
+    ~NxScatterGatherListArena(
+        void
+        );
+
+    // A large block size no bigger than the small one disables large blocks.
+    // Slabs are allocated up to the memory MaximumBlocks small blocks take.
+    void
+    Initialize(
+        _In_ ULONG SmallBlockSize,
+        _In_ ULONG LargeBlockSize,
+        _In_ ULONG MaximumBlocks
+        );
+
+    // Returns nullptr if there is no block left and no budget or memory for
+    // a new slab. A small block request can be served with a large block.
+    void *
+    Allocate(
+        _In_ bool Large,
+        _Out_ ULONG & BlockSize
+        );
+
+    void
+    Free(
+        _In_ void * Block,
+        _In_ ULONG BlockSize
+        );
+
+    bool
+    HasLargeBlocks(
+        void
+        ) const;
+
+    NxScatterGatherListArenaCounters
+    GetCounters(
+        void
+        ) const;
+
+private:
+
+    struct Slab
+    {
+        Slab * Next;
+    };
+
+    struct FreeBlock
+    {
+        FreeBlock * Next;
+    };
+
+    struct SizeClass
+    {
+        ULONG BlockSize = 0;
+        ULONG NumberOfBlocks = 0;
+        ULONG BlocksInUse = 0;
+        FreeBlock * FreeBlocks = nullptr;
+        Slab * Slabs = nullptr;
+    };
+
+    bool
+    Grow(
+        _Inout_ SizeClass & Class
+        );
+
+    void
+    FreeSlabs(
+        _Inout_ SizeClass & Class
+        );
+
+    SizeClass m_small;
+    SizeClass m_large;
+
+    size_t m_maximumBytes = 0;
+
+    NxScatterGatherListArenaCounters m_counters;
+};
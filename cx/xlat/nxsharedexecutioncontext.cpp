@@ -0,0 +1,188 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Implements an Execution Context (EC) that services several translator
+    queues from a single thread.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxSharedExecutionContext.tmh"
+#include "NxSharedExecutionContext.hpp"
+
+static EC_START_ROUTINE NetAdapterSharedThread;
+
+static
+EC_RETURN
+NetAdapterSharedThread(
+    PVOID StartContext
+    )
+{
+    reinterpret_cast<NxSharedExecutionContext*>(StartContext)->ExecutionContextThread();
+    return EC_RETURN();
+}
+
+NxSharedExecutionContext::~NxSharedExecutionContext()
+{
+    Release();
+
+    // Waits until the EC completely exits
+    m_executionContext.Terminate();
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxSharedExecutionContext::AddQueue(
+    INxExecutionContextQueue & Queue,
+    NxExecutionContext & QueueContext
+    )
+{
+    NT_ASSERT(! m_started);
+
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_queues.append({ &Queue, &QueueContext, false }));
+
+    QueueContext.InitializeShared(*this);
+
+    return STATUS_SUCCESS;
+}
+
+void
+NxSharedExecutionContext::SignalWork()
+{
+    m_executionContext.SignalWork();
+}
+
+_Use_decl_annotations_
+void
+NxSharedExecutionContext::SetGroupAffinity(
+    GROUP_AFFINITY const & GroupAffinity
+    )
+{
+    // Only called from the shared thread
+    m_executionContext.SetGroupAffinity(GroupAffinity);
+}
+
+ULONG
+NxSharedExecutionContext::GetExecutionContextIdentifier() const
+{
+    return m_executionContext.GetExecutionContextIdentifier();
+}
+
+void
+NxSharedExecutionContext::Release()
+{
+    // Once stopped the shared thread no longer looks at the hosted queues,
+    // so they can go away. This is done by the first queue released.
+    if (m_started)
+    {
+        m_executionContext.Cancel();
+        m_executionContext.Stop();
+
+        m_started = false;
+    }
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxSharedExecutionContext::Initialize(
+    NET_LUID NetworkInterface
+    )
+{
+    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+        m_executionContext.Initialize(this, NetAdapterSharedThread),
+        "Failed to start shared execution context. NxSharedExecutionContext=%p", this);
+
+    m_executionContext.SetDebugNameHint(L"Shared", 0, NetworkInterface);
+
+    // The shared EC itself runs until it is destroyed, the hosted queues
+    // are started and stopped through their own ECs
+    m_executionContext.Start();
+    m_started = true;
+
+    return STATUS_SUCCESS;
+}
+
+void
+NxSharedExecutionContext::ExecutionContextThread()
+{
+    for (auto & hosted : m_queues)
+    {
+        hosted.Queue->SetupThreadProperties();
+    }
+
+    while (! m_executionContext.IsTerminated())
+    {
+        while (true)
+        {
+            size_t runningQueues = 0;
+
+            for (auto & hosted : m_queues)
+            {
+                if (! hosted.Running && hosted.Context->IsRunning())
+                {
+                    hosted.Queue->EcStart();
+                    hosted.Running = true;
+                }
+
+                runningQueues += hosted.Running;
+            }
+
+            // Queues only stop after having been cancelled, so once the shared
+            // EC is stopping and no queue is left running it is safe to exit
+            if (runningQueues == 0 && m_executionContext.IsStopping())
+            {
+                m_executionContext.SignalStopped();
+                break;
+            }
+
+            // Round-robin one iteration over every running queue
+            for (auto & hosted : m_queues)
+            {
+                if (hosted.Running)
+                {
+                    hosted.Queue->EcRunIteration();
+                }
+            }
+
+            // Halting is only safe once every queue can halt. Queues that can't
+            // (re)arm their notifications, queues that can keep the ones armed
+            // on the previous iteration. Any of them firing wakes this EC.
+            auto canHalt = true;
+
+            for (auto & hosted : m_queues)
+            {
+                if (hosted.Running)
+                {
+                    canHalt = hosted.Queue->EcPrepareToHalt() && canHalt;
+                }
+            }
+
+            if (canHalt)
+            {
+                m_executionContext.WaitForWork();
+
+                for (auto & hosted : m_queues)
+                {
+                    if (hosted.Running)
+                    {
+                        hosted.Queue->EcResumeFromHalt();
+                    }
+                }
+            }
+
+            for (auto & hosted : m_queues)
+            {
+                if (hosted.Running && hosted.Queue->EcWindDown())
+                {
+                    hosted.Running = false;
+                }
+            }
+        }
+    }
+}
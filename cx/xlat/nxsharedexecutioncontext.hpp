@@ -0,0 +1,107 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Defines an Execution Context (EC) that services several translator
+    queues from a single thread.
+
+    Each queue keeps its own NxExecutionContext state machine, so queues
+    are still started, cancelled and stopped independently, but instead of
+    owning a thread the queue's EC is hosted by the shared EC. The shared
+    thread runs one iteration of every running queue in turn and only
+    halts once all of them are ready to halt, so that a notification from
+    any of the queues wakes the whole group.
+
+--*/
+
+#pragma once
+
+#include <KArray.h>
+
+#include "NxQueueScheduler.hpp"
+
+class NxSharedExecutionContext :
+    public INxQueueScheduler,
+    public INxExecutionContextHost,
+    public NxNonpagedAllocation<'cEsN'>
+{
+public:
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    ~NxSharedExecutionContext(
+        void
+        );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    Initialize(
+        _In_ NET_LUID NetworkInterface
+        );
+
+    void
+    ExecutionContextThread(
+        void
+        );
+
+    //
+    // INxQueueScheduler
+    //
+
+    /// Must be called before Initialize. The thread properties of the
+    /// queues are applied in the order they were added, so the last queue
+    /// added has the final say.
+    _IRQL_requires_(PASSIVE_LEVEL)
+    virtual
+    NTSTATUS
+    AddQueue(
+        _In_ INxExecutionContextQueue & Queue,
+        _Inout_ NxExecutionContext & QueueContext
+        );
+
+    //
+    // INxExecutionContextHost
+    //
+
+    virtual
+    void
+    SignalWork(
+        void
+        );
+
+    virtual
+    void
+    SetGroupAffinity(
+        _In_ GROUP_AFFINITY const & GroupAffinity
+        );
+
+    virtual
+    ULONG
+    GetExecutionContextIdentifier(
+        void
+        ) const;
+
+    /// Stops the shared thread, all hosted queues must have been stopped
+    _IRQL_requires_(PASSIVE_LEVEL)
+    virtual
+    void
+    Release(
+        void
+        );
+
+private:
+
+    struct HostedQueue
+    {
+        INxExecutionContextQueue * Queue;
+        NxExecutionContext * Context;
+        bool Running;
+    };
+
+    Rtl::KArray<HostedQueue, NonPagedPoolNx> m_queues;
+
+    NxExecutionContext m_executionContext;
+
+    bool m_started = false;
+};
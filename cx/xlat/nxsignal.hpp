@@ -4,13 +4,15 @@
 
 Abstract:
 
-    The NxRingBuffer wraps a NET_RING_BUFFER, providing simple accessor methods
-    for inserting and removing items into the ring buffer.
+    Lightweight signals used between the translator's execution contexts
+    and the threads that hand them work.
 
 --*/
 
 #pragma once
 
+#include <KWaitEvent.h>
+
 class NxInterlockedFlag
 {
     _Interlocked_ volatile LONG m_flag = false;
@@ -23,3 +25,58 @@ public:
     _IRQL_requires_max_(DISPATCH_LEVEL)
     bool TestAndClear() { return !!InterlockedExchange(&m_flag, false); }
 };
+
+// Wakes up a single consumer thread. Producers ring the doorbell after
+// publishing work. The consumer moves the state word to Sleeping right
+// before it blocks, and only a ring that finds it there sets the event.
+// While the consumer runs, ringing costs a read of the state word, or at
+// most one interlocked exchange until the consumer next goes to sleep.
+class NxDoorbell
+{
+    enum State : LONG
+    {
+        Running,
+        Sleeping,
+        Rung,
+    };
+
+    _Interlocked_ volatile LONG m_state = State::Running;
+
+    KAutoEvent m_wake;
+
+public:
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void Ring()
+    {
+        // Orders the producer's work before the read of the state word,
+        // otherwise a stale Rung could hide a consumer going to sleep
+        MemoryBarrier();
+
+        // Already rung since the consumer last woke up, it is bound to look
+        // for work again
+        if (ReadNoFence(&m_state) == State::Rung)
+        {
+            return;
+        }
+
+        if (InterlockedExchange(&m_state, State::Rung) == State::Sleeping)
+        {
+            m_wake.Set();
+        }
+    }
+
+    // Called only by the consumer. Blocks until the doorbell is rung, or
+    // returns right away if it was rung since the last Wait returned.
+    void Wait()
+    {
+        // Double check before blocking: this fails if a producer rang after
+        // the consumer last looked for work
+        if (InterlockedCompareExchange(&m_state, State::Sleeping, State::Running) == State::Running)
+        {
+            m_wake.Wait();
+        }
+
+        InterlockedExchange(&m_state, State::Running);
+    }
+};
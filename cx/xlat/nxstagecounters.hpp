@@ -0,0 +1,88 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Optional per-stage cycle and packet accounting for the translator EC
+    loops. Each stage is bracketed with StartStage/EndStage, which read the
+    time stamp counter and charge the elapsed cycles and the number of
+    packets the stage moved to that stage.
+
+    The counters are compiled in only when XLAT_STAGE_CYCLE_COUNTERS is
+    defined to a non-zero value. When it is zero or undefined every method
+    below is an empty inline function.
+
+--*/
+
+#pragma once
+
+#ifndef XLAT_STAGE_CYCLE_COUNTERS
+#define XLAT_STAGE_CYCLE_COUNTERS 0
+#endif
+
+struct NxStageCounters
+{
+    ULONG64 Cycles = 0;
+    ULONG64 Packets = 0;
+
+    ULONG64
+    GetCyclesPerPacket() const
+    {
+        return Packets == 0 ? 0 : Cycles / Packets;
+    }
+};
+
+template <typename TStage, size_t NumberOfStages>
+class NxStageCycleCounters
+{
+public:
+
+    void
+    StartStage()
+    {
+#if XLAT_STAGE_CYCLE_COUNTERS
+        m_stageStart = ReadTimeStampCounter();
+#endif
+    }
+
+    void
+    EndStage(
+        _In_ TStage Stage,
+        _In_ ULONG64 Packets
+        )
+    {
+#if XLAT_STAGE_CYCLE_COUNTERS
+        auto & counters = m_counters[static_cast<size_t>(Stage)];
+
+        counters.Cycles += ReadTimeStampCounter() - m_stageStart;
+        counters.Packets += Packets;
+#else
+        UNREFERENCED_PARAMETER((Stage, Packets));
+#endif
+    }
+
+#if XLAT_STAGE_CYCLE_COUNTERS
+    NxStageCounters
+    GetCounters(
+        _In_ TStage Stage
+        ) const
+    {
+        return m_counters[static_cast<size_t>(Stage)];
+    }
+
+    void
+    ResetCounters()
+    {
+        for (auto & counters : m_counters)
+        {
+            counters = {};
+        }
+    }
+
+private:
+
+    ULONG64 m_stageStart = 0;
+    NxStageCounters m_counters[NumberOfStages];
+#endif
+};
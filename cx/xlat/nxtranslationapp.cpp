@@ -20,6 +20,9 @@ Abstract:
 #include "NxTranslationApp.hpp"
 #include "NxPerfTuner.hpp"
 
+#include <KWorkItem.h>
+#include <KWaitEvent.h>
+
 TRACELOGGING_DEFINE_PROVIDER(
     g_hNetAdapterCxXlatProvider,
     "Microsoft.Windows.Ndis.NetAdapterCx.Translator",
@@ -149,6 +152,72 @@ static const NET_CLIENT_CONTROL_DISPATCH ControlDispatch =
     &NetClientAdapterOffloadInitialize
 };
 
+//
+// Runs NxRxXlat::Initialize on a system worker thread so that the queues
+// of a multi-queue adapter are brought up in parallel instead of one
+// after the other.
+//
+class NxRxQueueInitializer :
+    public NxNonpagedAllocation<'iXRN'>
+{
+public:
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NxRxQueueInitializer(
+        _In_ NxRxXlat & Queue,
+        _In_opt_ INxQueueScheduler * QueueScheduler,
+        _Inout_ volatile LONG & Outstanding,
+        _In_ KWaitEvent & AllDone
+        ) noexcept :
+        m_queue(Queue),
+        m_queueScheduler(QueueScheduler),
+        m_outstanding(Outstanding),
+        m_allDone(AllDone),
+        m_workItem(this, &NxRxQueueInitializer::Initialize)
+    {
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    Queue(
+        void
+        )
+    {
+        m_workItem.Queue();
+    }
+
+    NTSTATUS
+    GetStatus(
+        void
+        ) const
+    {
+        return m_status;
+    }
+
+private:
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    Initialize(
+        void
+        )
+    {
+        m_status = m_queue.Initialize(m_queueScheduler);
+
+        if (InterlockedDecrement(&m_outstanding) == 0)
+        {
+            m_allDone.Set();
+        }
+    }
+
+    NxRxXlat & m_queue;
+    INxQueueScheduler * m_queueScheduler;
+    volatile LONG & m_outstanding;
+    KWaitEvent & m_allDone;
+    KWorkItem<NxRxQueueInitializer> m_workItem;
+    NTSTATUS m_status = STATUS_UNSUCCESSFUL;
+};
+
 _Use_decl_annotations_
 NxTranslationAppFactory::~NxTranslationAppFactory(
     void
@@ -328,6 +397,39 @@ NxTranslationApp::ReceiveScalingSetIndirectionEntries(
     return m_receiveScaling->SetIndirectionEntries(Request);
 }
 
+_Use_decl_annotations_
+PAGEDX
+NTSTATUS
+NxTranslationApp::CreateDatapathScheduler(
+    void
+    )
+{
+    auto const numberOfWorkers =
+        m_dispatch->NetClientQueryDriverConfigurationUlong(DATAPATH_SCHEDULER_WORKERS);
+
+    // A thread per queue unless the scheduler is enabled
+    if (numberOfWorkers == 0)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    auto datapathScheduler = wil::make_unique_nothrow<NxDatapathScheduler>();
+
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! datapathScheduler);
+
+    CX_RETURN_IF_NOT_NT_SUCCESS(
+        datapathScheduler->Initialize(
+            numberOfWorkers,
+            m_dispatch->NetClientQueryDriverConfigurationUlong(RX_THREAD_PRIORITY),
+            GetProperties().NetLuid));
+
+    m_datapathScheduler = wistd::move(datapathScheduler);
+
+    return STATUS_SUCCESS;
+}
+
 _Use_decl_annotations_
 PAGEDX
 NTSTATUS
@@ -335,6 +437,24 @@ NxTranslationApp::CreateDefaultQueues(
     void
     )
 {
+    // When enabled, the default Tx and Rx queues are serviced by a single
+    // EC thread instead of one thread each. The datapath scheduler, which
+    // runs every queue, takes precedence.
+    wistd::unique_ptr<NxSharedExecutionContext> sharedExecutionContext;
+    INxQueueScheduler * queueScheduler = m_datapathScheduler.get();
+
+    if (! queueScheduler &&
+        m_dispatch->NetClientQueryDriverConfigurationBoolean(EC_SHARE_DEFAULT_QUEUES))
+    {
+        sharedExecutionContext = wil::make_unique_nothrow<NxSharedExecutionContext>();
+
+        CX_RETURN_NTSTATUS_IF(
+            STATUS_INSUFFICIENT_RESOURCES,
+            ! sharedExecutionContext);
+
+        queueScheduler = sharedExecutionContext.get();
+    }
+
     auto txQueue = wil::make_unique_nothrow<NxTxXlat>(
         0,
         m_dispatch,
@@ -346,7 +466,7 @@ NxTranslationApp::CreateDefaultQueues(
         ! txQueue);
 
     CX_RETURN_IF_NOT_NT_SUCCESS(
-        txQueue->Initialize());
+        txQueue->Initialize(queueScheduler));
 
     auto rxQueue = wil::make_unique_nothrow<NxRxXlat>(
         0,
@@ -367,10 +487,17 @@ NxTranslationApp::CreateDefaultQueues(
         ! m_rxQueues.resize(1));
 
     CX_RETURN_IF_NOT_NT_SUCCESS(
-        rxQueue->Initialize());
+        rxQueue->Initialize(queueScheduler));
+
+    if (sharedExecutionContext)
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS(
+            sharedExecutionContext->Initialize(GetProperties().NetLuid));
+    }
 
     m_txQueue = wistd::move(txQueue);
     m_rxQueues[0] = wistd::move(rxQueue);
+    m_sharedExecutionContext = wistd::move(sharedExecutionContext);
 
     return STATUS_SUCCESS;
 }
@@ -422,10 +549,21 @@ NxTranslationApp::CreateReceiveScalingQueues(
         return STATUS_SUCCESS;
     }
 
+    auto const numberOfNewQueues = receiveScaling->GetNumberOfQueues() - m_rxQueues.count();
+
     Rtl::KArray<wistd::unique_ptr<NxRxXlat>> queues;
     CX_RETURN_NTSTATUS_IF(
         STATUS_INSUFFICIENT_RESOURCES,
-        ! queues.resize(receiveScaling->GetNumberOfQueues() - m_rxQueues.count()));
+        ! queues.resize(numberOfNewQueues));
+
+    Rtl::KArray<wistd::unique_ptr<NxRxQueueInitializer>> initializers;
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! initializers.resize(numberOfNewQueues));
+
+    // one extra reference is held until every initializer has been queued
+    volatile LONG outstanding = 1;
+    KWaitEvent allDone;
 
     for (auto i = m_rxQueues.count(); i < receiveScaling->GetNumberOfQueues(); i++)
     {
@@ -435,14 +573,36 @@ NxTranslationApp::CreateReceiveScalingQueues(
             m_adapter,
             m_adapterDispatch);
 
+        auto initializer = rxQueue
+            ? wil::make_unique_nothrow<NxRxQueueInitializer>(*rxQueue, m_datapathScheduler.get(), outstanding, allDone)
+            : nullptr;
+
+        if (! initializer)
+        {
+            // queues already handed to a worker must finish before they are destroyed
+            break;
+        }
+
+        InterlockedIncrement(&outstanding);
+        initializer->Queue();
+
+        queues[i - m_rxQueues.count()] = wistd::move(rxQueue);
+        initializers[i - m_rxQueues.count()] = wistd::move(initializer);
+    }
+
+    if (InterlockedDecrement(&outstanding) != 0)
+    {
+        allDone.Wait();
+    }
+
+    for (auto & initializer : initializers)
+    {
         CX_RETURN_NTSTATUS_IF(
             STATUS_INSUFFICIENT_RESOURCES,
-            ! rxQueue);
+            ! initializer);
 
         CX_RETURN_IF_NOT_NT_SUCCESS(
-            rxQueue->Initialize());
-
-        queues[i - m_rxQueues.count()] = wistd::move(rxQueue);
+            initializer->GetStatus());
     }
 
     CX_RETURN_NTSTATUS_IF(
@@ -539,6 +699,9 @@ NxTranslationApp::CreateDatapath(
     void
     )
 {
+    CX_RETURN_IF_NOT_NT_SUCCESS(
+        CreateDatapathScheduler());
+
     CX_RETURN_IF_NOT_NT_SUCCESS(
         CreateDefaultQueues());
 
@@ -560,6 +723,11 @@ NxTranslationApp::DestroyDatapath(
 
     m_txQueue.reset();
     m_rxQueues.clear();
+
+    // Destroying a hosted queue releases its host, so the queue schedulers
+    // go away last
+    m_sharedExecutionContext.reset();
+    m_datapathScheduler.reset();
 }
 
 _Use_decl_annotations_
@@ -14,6 +14,8 @@ Abstract:
 #include "NxApp.hpp"
 #include "NxTxXlat.hpp"
 #include "NxRxXlat.hpp"
+#include "NxSharedExecutionContext.hpp"
+#include "NxDatapathScheduler.hpp"
 #include "NxReceiveScaling.hpp"
 #include "NxOffload.hpp"
 
@@ -116,6 +118,13 @@ public:
 
 private:
 
+    _IRQL_requires_(PASSIVE_LEVEL)
+    PAGEDX
+    NTSTATUS
+    CreateDatapathScheduler(
+        void
+        );
+
     _IRQL_requires_(PASSIVE_LEVEL)
     PAGEDX
     NTSTATUS
@@ -144,6 +153,17 @@ private:
         void
         );
 
+    // the queue schedulers are declared before the queues they host
+    // so that they are destroyed last
+
+    // runs every queue when the datapath scheduler is enabled
+    wistd::unique_ptr<NxDatapathScheduler>
+        m_datapathScheduler;
+
+    // hosts the default queues when they share an EC
+    wistd::unique_ptr<NxSharedExecutionContext>
+        m_sharedExecutionContext;
+
     wistd::unique_ptr<NxTxXlat>
         m_txQueue;
 
@@ -55,6 +55,37 @@ NxTxXlat::NxTxXlat(
     m_counterReportInterval = m_dispatch->NetClientQueryDriverConfigurationUlong(TX_PERF_COUNTERS_ITERATION_INTERVAL);
     m_shouldUpdateEcCounters = m_dispatch->NetClientQueryDriverConfigurationBoolean(EC_UPDATE_PERF_COUNTERS);
 
+    m_busyPoll.Initialize(
+        m_dispatch->NetClientQueryDriverConfigurationUlong(EC_BUSY_POLL_BUDGET_US),
+        m_dispatch->NetClientQueryDriverConfigurationUlong(EC_BUSY_POLL_BUDGET_ITERATIONS),
+        m_dispatch->NetClientQueryDriverConfigurationUlong(EC_BUSY_POLL_PACKET_RATE_THRESHOLD));
+
+    m_moderation.Initialize(
+        m_dispatch->NetClientQueryDriverConfigurationUlong(EC_NOTIFICATION_LATENCY_BUDGET_US),
+        m_executionContext);
+
+    m_doorbellBatchPackets = m_dispatch->NetClientQueryDriverConfigurationUlong(TX_DOORBELL_BATCH_PACKETS);
+
+    ULONG64 frequency;
+    (void)NxQueryPerformanceCounter(&frequency);
+    m_doorbellBudgetInTicks =
+        m_dispatch->NetClientQueryDriverConfigurationUlong(TX_DOORBELL_BUDGET_US) * frequency / 1000000;
+
+    // Completion moderation is set per adapter
+    m_completionBatchNbls = m_adapterProperties.TxCompletionBatchNbls;
+    m_completionBudgetInTicks =
+        static_cast<ULONG64>(m_adapterProperties.TxCompletionBudgetInMicroseconds) * frequency / 1000000;
+
+    // Copy-break packets are copied into a single bounce buffer
+    m_copyBreakThreshold = min(
+        static_cast<size_t>(m_dispatch->NetClientQueryDriverConfigurationUlong(TX_COPY_BREAK_THRESHOLD)),
+        static_cast<size_t>(m_datapathCapabilities.MaximumTxFragmentSize));
+
+    m_bounceChecksum = m_dispatch->NetClientQueryDriverConfigurationBoolean(TX_BOUNCE_SOFTWARE_CHECKSUM);
+
+    // Capped by the prefetcher at NX_NBL_PREFETCH_MAX_DISTANCE
+    m_nblPrefetchDistance = m_dispatch->NetClientQueryDriverConfigurationUlong(TX_NBL_PREFETCH_DISTANCE);
+
     if (m_shouldReportCounters)
     {
 #ifdef _KERNEL_MODE
@@ -84,6 +115,8 @@ NxTxXlat::~NxTxXlat()
     }
 #endif
 
+    m_moderation.CancelCoalescingTimer();
+
     // Waits until the EC completely exits
     m_executionContext.Terminate();
 
@@ -138,8 +171,12 @@ NxTxXlat::GetNotificationsToArm()
         notifications.Flags.ShouldArmNblArrival = !m_ringBuffer.AllPacketsOwnedByNic();
 
         // If 0 packets were completed by the Adapter in the last iteration, then arm
-        // the adapter to issue Tx completion notifications.
-        notifications.Flags.ShouldArmTxCompletion = m_ringBuffer.AnyNicPackets();
+        // the adapter to issue Tx completion notifications. When moderation expects
+        // more packets within the latency budget, pick the completions up in one
+        // batch from the coalescing timer instead.
+        auto const coalesce = m_moderation.ShouldCoalesce() && !m_executionContext.IsStopping();
+        notifications.Flags.ShouldArmTxCompletion = m_ringBuffer.AnyNicPackets() && !coalesce;
+        notifications.Flags.ShouldArmCoalescingTimer = m_ringBuffer.AnyNicPackets() && coalesce;
 
         // At least one notification should be set whenever going through this path.
         //
@@ -171,6 +208,11 @@ NxTxXlat::ArmNotifications(
     {
         ArmAdapterTxNotification();
     }
+
+    if (notifications.Flags.ShouldArmCoalescingTimer)
+    {
+        m_moderation.ArmCoalescingTimer();
+    }
 }
 
 static EC_START_ROUTINE NetAdapterTransmitThread;
@@ -186,7 +228,7 @@ NetAdapterTransmitThread(
 }
 
 void
-NxTxXlat::SetupTxThreadProperties()
+NxTxXlat::SetupThreadProperties()
 {
 #if _KERNEL_MODE
     // setup thread prioirty;
@@ -220,91 +262,153 @@ NxTxXlat::SetupTxThreadProperties()
 void
 NxTxXlat::TransmitThread()
 {
-    SetupTxThreadProperties();
+    SetupThreadProperties();
 
     while (! m_executionContext.IsTerminated())
     {
-        m_queueDispatch->Start(m_queue);
-
-        auto cancelIssued = false;
+        EcStart();
 
-        // This represents the core execution of the Tx path
-        while (true)
+        do
         {
-            // update NBL queue counters
-            UpdateTxTranslationSpecificCounters();
+            EcRunIteration();
 
-            if (!cancelIssued)
-            {
-                // Check if the NBL serialization has any data
-                PollNetBufferLists();
+            // Arms notifications if no forward progress was made in
+            // this loop.
+            WaitForWork();
 
-                // Post NBLs to the producer side of the NBL
-                TranslateNbls();
-            }
+        } while (! EcWindDown());
+    }
+}
 
-            // update ringbuffer counters;
-            m_ringBuffer.UpdateRingbufferDepthCounters();
+void
+NxTxXlat::EcStart()
+{
+    m_queueDispatch->Start(m_queue);
+    m_ringBuffer.ResetLocalIndices();
 
-            // Allow the NetAdapter to return any packets that it is done with.
-            YieldToNetAdapter();
+    m_postedEndIndex = m_ringBuffer.Get()->EndIndex;
+    m_doorbellDeferralStart = 0;
+    m_completionDeferralStart = 0;
 
-            // Drain any packets that the NIC has completed.
-            // This means returning the associated NBLs for each completed
-            // NET_PACKET.
-            DrainCompletions();
+    if (m_latencyTracker)
+    {
+        m_latencyTracker->Reset();
+    }
 
-            if (m_shouldUpdateEcCounters)
-            {
-                // end of iteration, update execution context counters;
-                m_executionContext.UpdateCounters(
-                    !m_producedPackets && !m_completedPackets);
-            }
+    m_cancelIssued = false;
+}
 
-            // Arms notifications if no forward progress was made in
-            // this loop.
-            WaitForWork();
+void
+NxTxXlat::EcRunIteration()
+{
+    auto const pRing = m_ringBuffer.Get();
 
-            // This represents the wind down of Tx
-            if (m_executionContext.IsStopping())
-            {
-                if (!cancelIssued)
-                {
-                    // Indicate cancellation to the adapter
-                    // and drop all outstanding NBLs.
-                    //
-                    // One NBL may remain that has been partially programmed into the NIC.
-                    // So that NBL is kept around until the end
-
-                    m_queueDispatch->Cancel(m_queue);
-                    DropQueuedNetBufferLists();
-
-                    cancelIssued = true;
-                }
-
-                // The termination condition is that the NIC has returned all its
-                // packets.
-                if (!m_ringBuffer.AnyNicPackets())
-                {
-                    if (m_ringBuffer.AnyReturnedPackets())
-                    {
-                        DrainCompletions();
-                        NT_ASSERT(!m_ringBuffer.AnyReturnedPackets());
-                    }
-
-                    // DropQueuedNetBufferLists had completed as many NBLs as possible, but there's
-                    // a chance that one parital NBL couldn't be completed up there.  Do it now.
-                    AbortNbls(m_currentNbl);
-                    m_currentNbl = nullptr;
-                    m_currentNetBuffer = nullptr;
-
-                    m_queueDispatch->Stop(m_queue);
-                    m_executionContext.SignalStopped();
-                    break;
-                }
-            }
-        }
+    // This represents the core execution of the Tx path
+
+    // update NBL queue counters
+    UpdateTxTranslationSpecificCounters();
+
+    if (!m_cancelIssued)
+    {
+        // Check if the NBL serialization has any data
+        m_stageCounters.StartStage();
+        PollNetBufferLists();
+        m_stageCounters.EndStage(NxTxStage::PollNetBufferLists, 0);
+
+        // Post NBLs to the producer side of the NBL
+        auto const endIndex = pRing->EndIndex;
+
+        m_stageCounters.StartStage();
+        TranslateNbls();
+        m_stageCounters.EndStage(NxTxStage::TranslateNbls,
+            NetRingBufferGetNumberOfElementsInRange(pRing, endIndex, pRing->EndIndex));
+    }
+
+    // update ringbuffer counters;
+    m_ringBuffer.UpdateRingbufferDepthCounters();
+    m_ringBuffer.UpdateFragmentRingOccupancyCounters(
+        *NET_DATAPATH_DESCRIPTOR_GET_FRAGMENT_RING_BUFFER(m_descriptor));
+
+    // Allow the NetAdapter to return any packets that it is done with.
+    auto const beginIndex = pRing->BeginIndex;
+
+    m_stageCounters.StartStage();
+    YieldToNetAdapter();
+    m_stageCounters.EndStage(NxTxStage::YieldToNetAdapter,
+        NetRingBufferGetNumberOfElementsInRange(pRing, beginIndex, pRing->BeginIndex));
+
+    // Drain any packets that the NIC has completed.
+    // This means returning the associated NBLs for each completed
+    // NET_PACKET.
+    auto const nextIndex = m_ringBuffer.GetNextOSIndex();
+
+    m_stageCounters.StartStage();
+    DrainCompletions();
+    m_stageCounters.EndStage(NxTxStage::DrainCompletions,
+        NetRingBufferGetNumberOfElementsInRange(pRing, nextIndex, m_ringBuffer.GetNextOSIndex()));
+
+    if (m_shouldUpdateEcCounters)
+    {
+        // end of iteration, update execution context counters;
+        m_executionContext.UpdateCounters(
+            !m_producedPackets && !m_completedPackets);
+    }
+}
+
+bool
+NxTxXlat::EcWindDown()
+{
+    // This represents the wind down of Tx
+    if (! m_executionContext.IsStopping())
+    {
+        return false;
+    }
+
+    if (!m_cancelIssued)
+    {
+        // Indicate cancellation to the adapter
+        // and drop all outstanding NBLs.
+        //
+        // One NBL may remain that has been partially programmed into the NIC.
+        // So that NBL is kept around until the end
+
+        m_queueDispatch->Cancel(m_queue);
+        DropQueuedNetBufferLists();
+
+        m_cancelIssued = true;
+    }
+
+    // The termination condition is that the NIC has returned all its
+    // packets.
+    if (m_ringBuffer.AnyNicPackets())
+    {
+        return false;
+    }
+
+    if (m_ringBuffer.AnyReturnedPackets())
+    {
+        DrainCompletions();
+        NT_ASSERT(!m_ringBuffer.AnyReturnedPackets());
+    }
+
+    FlushCompletions();
+
+    // The queue is stopping, release the pages the mapping cache locked
+    if (m_dmaAdapter && m_dmaAdapter->GetMappingCache())
+    {
+        m_dmaAdapter->GetMappingCache()->Flush();
     }
+
+    // DropQueuedNetBufferLists had completed as many NBLs as possible, but there's
+    // a chance that one parital NBL couldn't be completed up there.  Do it now.
+    AbortNbls(m_currentNbl);
+    m_currentNbl = nullptr;
+    m_currentNetBuffer = nullptr;
+
+    m_queueDispatch->Stop(m_queue);
+    m_executionContext.SignalStopped();
+
+    return true;
 }
 
 void
@@ -316,12 +420,40 @@ NxTxXlat::DrainCompletions()
     auto const returned = m_ringBuffer.ReturnedPackets();
     auto const result = translator.CompletePackets(returned, m_bounceBufferPool);
 
-    m_completedPackets = result.CompletedTo != returned.begin();
+    m_completedPackets = result.CompletedTo.GetDistanceFrom(returned.begin());
 
     if (result.CompletedChain)
     {
-        m_nblDispatcher->SendNetBufferListsComplete(
-            result.CompletedChain, result.NumCompletedNbls, 0);
+        if (m_pendingCompletionChain)
+        {
+            m_pendingCompletionTail->Next = result.CompletedChain;
+        }
+        else
+        {
+            m_pendingCompletionChain = result.CompletedChain;
+        }
+
+        m_pendingCompletionTail = result.CompletedChainTail;
+        m_pendingCompletionNbls += result.NumCompletedNbls;
+    }
+
+    // The completed packets are reused once the ring advances, their
+    // samples are saved until their NBLs are actually completed
+    if (m_latencyTracker)
+    {
+        m_latencyTracker->HoldCompleted(NetRbPacketRange{ returned.begin(), result.CompletedTo });
+    }
+
+    if (m_pendingCompletionNbls != 0)
+    {
+        if (ShouldDeferCompletions())
+        {
+            m_deferredCompletions++;
+        }
+        else
+        {
+            FlushCompletions();
+        }
     }
 
     UINT32 numberOfNewNetPakcetsCompleted = result.CompletedTo.GetDistanceFrom(returned.begin());
@@ -332,10 +464,59 @@ NxTxXlat::DrainCompletions()
     m_ringBuffer.UpdateRingbufferPacketCounters(delta);
 }
 
+bool
+NxTxXlat::ShouldDeferCompletions(
+    void
+    )
+{
+    // A zero latency budget disables moderation
+    if (m_completionBatchNbls <= 1 ||
+        m_completionBudgetInTicks == 0 ||
+        m_pendingCompletionNbls >= m_completionBatchNbls ||
+        m_cancelIssued)
+    {
+        return false;
+    }
+
+    auto const now = NxQueryPerformanceCounter(nullptr);
+
+    if (m_completionDeferralStart == 0)
+    {
+        m_completionDeferralStart = now;
+    }
+
+    return now - m_completionDeferralStart < m_completionBudgetInTicks;
+}
+
+void
+NxTxXlat::FlushCompletions()
+{
+    m_completionDeferralStart = 0;
+
+    if (!m_pendingCompletionChain)
+    {
+        return;
+    }
+
+    m_nblDispatcher->SendNetBufferListsComplete(
+        m_pendingCompletionChain, m_pendingCompletionNbls, 0);
+
+    if (m_latencyTracker)
+    {
+        m_latencyTracker->StampHeldCompleted();
+    }
+
+    m_completionBatchSizes.Record(m_pendingCompletionNbls);
+
+    m_pendingCompletionChain = nullptr;
+    m_pendingCompletionTail = nullptr;
+    m_pendingCompletionNbls = 0;
+}
+
 void
 NxTxXlat::TranslateNbls()
 {
-    m_producedPackets = false;
+    m_producedPackets = 0;
 
     if (!m_currentNbl)
         return;
@@ -343,11 +524,30 @@ NxTxXlat::TranslateNbls()
     NxNblTranslator translator{ m_nblTranslationStats, *m_descriptor, m_datapathCapabilities, m_dmaAdapter.get(), m_contextBuffer, m_adapterProperties.MediaType };
     translator.m_netPacketChecksumOffset = m_checksumOffset;
     translator.m_netPacketLsoOffset = m_lsoOffset;
+    translator.m_copyBreakThreshold = m_copyBreakThreshold;
+    translator.m_bounceChecksum = m_bounceChecksum;
+    translator.m_nblPrefetchDistance = m_nblPrefetchDistance;
 
     auto const availablePacketRange = m_ringBuffer.AvailablePackets();
     auto const nextUntranslatedPacket = translator.TranslateNbls(m_currentNbl, m_currentNetBuffer, availablePacketRange, m_bounceBufferPool);
 
-    m_producedPackets = (nextUntranslatedPacket != availablePacketRange.begin());
+    m_producedPackets = nextUntranslatedPacket.GetDistanceFrom(availablePacketRange.begin());
+
+    if (m_latencyTracker)
+    {
+        auto const now = NxLatencyTracker::QueryTimestamp();
+
+        m_latencyTracker->ForEachSample(NetRbPacketRange{ availablePacketRange.begin(), nextUntranslatedPacket },
+            [this, now](NxPacketLatencyStamps & Stamps, UINT32 Index)
+        {
+            // Only the last packet of an NBL points back to it
+            auto const nbl = m_contextBuffer.GetPacketContext<PacketContext>(Index).NetBufferListToComplete;
+
+            Stamps = {};
+            Stamps.Enqueue = nbl ? NxLatencyTracker::GetEnqueueStamp(nbl) : 0;
+            Stamps.Translate = now;
+        });
+    }
 
     UINT32 numberOfNewNetPakcetsToSend = nextUntranslatedPacket.GetDistanceFrom(availablePacketRange.begin());
     NxRingBufferCounters delta = {};
@@ -360,23 +560,61 @@ NxTxXlat::TranslateNbls()
 void
 NxTxXlat::WaitForWork()
 {
+    if (EcPrepareToHalt())
+    {
+        m_executionContext.WaitForWork();
+        EcResumeFromHalt();
+    }
+}
+
+bool
+NxTxXlat::EcPrepareToHalt()
+{
+    // Within the busy-poll budget keep iterating, which advances the NIC
+    // and polls the NBL queue, rather than arming notifications and parking
+    if (m_busyPoll.ShouldPoll(m_producedPackets + m_completedPackets) && !m_executionContext.IsStopping())
+    {
+        return false;
+    }
+
+    // Likewise while moderation expects a batch within the latency budget
+    if (m_moderation.ShouldPoll(m_ringBuffer.GetNumberOfNetPacketsProduced(), m_producedPackets + m_completedPackets) &&
+        !m_executionContext.IsStopping())
+    {
+        return false;
+    }
+
     auto notificationsToArm = GetNotificationsToArm();
 
+    // Notifications are only armed once an iteration made no progress and
+    // the EC is about to halt, completions held back until then would wait
+    // for the next wake up
+    if (notificationsToArm.Value != 0)
+    {
+        FlushCompletions();
+    }
+
     // In order to handle race conditions, the notifications that should
     // be armed at halt cannot change between the halt preparation and the
     // actual halt. If they do change, re-arm the necessary notifications
     // and loop again.
     if (notificationsToArm.Value != 0 && notificationsToArm.Value == m_lastArmedNotifications.Value)
     {
-        m_executionContext.WaitForWork();
-
-        // after halting, don't arm any notifications
-        notificationsToArm.Value = 0;
+        return true;
     }
 
     ArmNotifications(notificationsToArm);
 
     m_lastArmedNotifications = notificationsToArm;
+
+    return false;
+}
+
+void
+NxTxXlat::EcResumeFromHalt()
+{
+    // after halting, don't arm any notifications
+    m_lastArmedNotifications.Value = 0;
 }
 
 void
@@ -454,6 +692,11 @@ NxTxXlat::SendNetBufferLists(
 {
     UNREFERENCED_PARAMETER((PortNumber, NumberOfNbls, SendFlags));
 
+    if (m_latencyTracker)
+    {
+        NxLatencyTracker::StampEnqueue(NblChain);
+    }
+
     m_synchronizedNblQueue.Enqueue(NblChain);
 
     if (m_queueNotification.TestAndClear())
@@ -473,19 +716,85 @@ NxTxXlat::YieldToNetAdapter()
 {
     if (m_ringBuffer.AnyNicPackets())
     {
-        if (m_dmaAdapter)
+        auto const pRing = m_ringBuffer.Get();
+        auto const unpostedPackets = NetRingBufferGetNumberOfElementsInRange(pRing, m_postedEndIndex, pRing->EndIndex);
+
+        // Advance is where the adapter rings its hardware doorbell, hold
+        // new packets back while more are about to be translated
+        if (unpostedPackets != 0 && ShouldDeferDoorbell(unpostedPackets))
+        {
+            m_deferredDoorbells++;
+            return;
+        }
+
+        // Packets posted earlier have been flushed already
+        if (m_dmaAdapter && unpostedPackets != 0)
         {
-            m_dmaAdapter->FlushIoBuffers(m_ringBuffer.NicPackets());
+            m_dmaAdapter->FlushIoBuffers(NetRbPacketRange{ *pRing, m_postedEndIndex, pRing->EndIndex });
+        }
+
+        if (m_latencyTracker)
+        {
+            m_latencyTracker->StampPosted();
         }
 
         m_queueDispatch->Advance(m_queue);
+
+        if (m_latencyTracker)
+        {
+            m_latencyTracker->StampReturned();
+        }
+
+        if (unpostedPackets != 0)
+        {
+            m_doorbells++;
+            m_doorbellPackets += unpostedPackets;
+        }
+
+        m_postedEndIndex = pRing->EndIndex;
+        m_doorbellDeferralStart = 0;
+    }
+}
+
+_Use_decl_annotations_
+bool
+NxTxXlat::ShouldDeferDoorbell(
+    UINT32 UnpostedPackets
+    )
+{
+    // A zero latency budget disables deferral, like completion moderation
+    if (m_doorbellBatchPackets <= 1 ||
+        m_doorbellBudgetInTicks == 0 ||
+        UnpostedPackets >= m_doorbellBatchPackets)
+    {
+        return false;
+    }
+
+    // Only defer while the next iteration is bound to add packets. Once the
+    // NBL queue is drained, the ring is full or translation stalled the EC
+    // could halt with the packets never given to the adapter.
+    if (m_cancelIssued ||
+        m_producedPackets == 0 ||
+        !m_ringBuffer.AnyAvailablePackets() ||
+        (!m_currentNbl && m_synchronizedNblQueue.GetNblQueueDepth() == 0))
+    {
+        return false;
     }
+
+    auto const now = NxQueryPerformanceCounter(nullptr);
+
+    if (m_doorbellDeferralStart == 0)
+    {
+        m_doorbellDeferralStart = now;
+    }
+
+    return now - m_doorbellDeferralStart < m_doorbellBudgetInTicks;
 }
 
 _Use_decl_annotations_
 NTSTATUS
 NxTxXlat::Initialize(
-    void
+    INxQueueScheduler * QueueScheduler
     )
 {
     m_adapterDispatch->GetDatapathCapabilities(m_adapter, &m_datapathCapabilities);
@@ -539,7 +848,9 @@ NxTxXlat::Initialize(
     m_descriptor = m_queueDispatch->GetNetDatapathDescriptor(m_queue);
 
     CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
-        m_ringBuffer.Initialize(NET_DATAPATH_DESCRIPTOR_GET_PACKET_RING_BUFFER(m_descriptor)),
+        m_ringBuffer.Initialize(
+            NET_DATAPATH_DESCRIPTOR_GET_PACKET_RING_BUFFER(m_descriptor),
+            m_dispatch->NetClientQueryDriverConfigurationBoolean(RING_BUFFER_ISOLATED_INDICES)),
         "Failed to initialize packet ring buffer.");
 
     CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
@@ -558,23 +869,57 @@ NxTxXlat::Initialize(
         CX_RETURN_IF_NOT_NT_SUCCESS(m_dmaAdapter->Initialize(*m_dispatch));
     }
 
+    auto const latencySamplingInterval =
+        m_dispatch->NetClientQueryDriverConfigurationUlong(PACKET_LATENCY_SAMPLING_INTERVAL);
+
+    if (latencySamplingInterval != 0)
+    {
+        m_latencyTracker = wil::make_unique_nothrow<NxLatencyTracker>(m_ringBuffer, latencySamplingInterval);
+
+        if (!m_latencyTracker)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(m_latencyTracker->Initialize());
+    }
+
+    // With copy-break any packet in the ring may hold a bounce buffer
+    auto numberOfBounceBuffers = static_cast<size_t>(perfParameters.NumberOfBounceBuffers);
+
+    if (m_copyBreakThreshold != 0)
+    {
+        numberOfBounceBuffers = max(numberOfBounceBuffers, static_cast<size_t>(perfParameters.PacketRingElementCount));
+    }
+
     CX_RETURN_IF_NOT_NT_SUCCESS(
         m_bounceBufferPool.Initialize(
             *m_dispatch,
             m_descriptor,
             m_datapathCapabilities,
-            perfParameters.NumberOfBounceBuffers));
+            numberOfBounceBuffers,
+            m_dispatch->NetClientQueryDriverConfigurationUlong(TX_STREAMING_COPY_THRESHOLD),
+            m_shouldReportCounters));
 
     for (auto i = 0ul; i < m_ringBuffer.Count(); i++)
     {
         new (&m_contextBuffer.GetPacketContext<PacketContext>(i)) PacketContext();
     }
 
-    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
-        m_executionContext.Initialize(this, NetAdapterTransmitThread),
-        "Failed to start Tx execution context. NxTxXlat=%p", this);
+    if (QueueScheduler)
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            QueueScheduler->AddQueue(*this, m_executionContext),
+            "Failed to add Tx queue to queue scheduler. NxTxXlat=%p", this);
+    }
+    else
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            m_executionContext.Initialize(this, NetAdapterTransmitThread),
+            "Failed to start Tx execution context. NxTxXlat=%p", this);
 
-    m_executionContext.SetDebugNameHint(L"Transmit", GetQueueId(), m_adapterProperties.NetLuid);
+        m_executionContext.SetDebugNameHint(L"Transmit", GetQueueId(), m_adapterProperties.NetLuid);
+    }
 
     return STATUS_SUCCESS;
 }
@@ -713,6 +1058,54 @@ NxTxXlat::ReportCounters()
     ULONG64 usefulIterationCount =
         localECCounters.IterationCount - localECCounters.BusyWaitIterationCount;
 
+    auto const busyPollCounters = m_busyPoll.GetCounters();
+    m_busyPoll.ResetCounters();
+
+    auto const moderationCounters = m_moderation.GetCounters();
+    m_moderation.ResetCounters();
+
+    UINT32 osOwnedPacketsPercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+    UINT32 nicOwnedPacketsPercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+    UINT32 returnedPacketsPercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+    UINT32 osOwnedFragmentsPercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+    UINT32 nicOwnedFragmentsPercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+
+    auto const &occupancy = localRBCounters.Occupancy;
+    occupancy.OsOwnedPackets.GetReportedPercentiles(osOwnedPacketsPercentiles);
+    occupancy.NicOwnedPackets.GetReportedPercentiles(nicOwnedPacketsPercentiles);
+    occupancy.ReturnedPackets.GetReportedPercentiles(returnedPacketsPercentiles);
+    occupancy.OsOwnedFragments.GetReportedPercentiles(osOwnedFragmentsPercentiles);
+    occupancy.NicOwnedFragments.GetReportedPercentiles(nicOwnedFragmentsPercentiles);
+
+    auto const completionBatchSizes = m_completionBatchSizes;
+    m_completionBatchSizes = {};
+
+    UINT32 completionBatchSizePercentiles[NX_RING_OCCUPANCY_PERCENTILES];
+    completionBatchSizes.GetReportedPercentiles(completionBatchSizePercentiles);
+
+    auto const bouncePoolCounters = m_bounceBufferPool.GetCounters();
+    m_bounceBufferPool.ResetCounters();
+    auto & copyEngine = m_bounceBufferPool.GetCopyEngine();
+    auto const copyEngineCounters = copyEngine.GetCounters();
+
+    NxDmaMappingCacheCounters mappingCacheCounters;
+
+    if (m_dmaAdapter && m_dmaAdapter->GetMappingCache())
+    {
+        mappingCacheCounters = m_dmaAdapter->GetMappingCache()->GetCounters();
+    }
+
+    size_t scatterGatherListBytes = 0;
+    LONG64 scatterGatherListBytesSaved = 0;
+
+    if (m_dmaAdapter)
+    {
+        m_dmaAdapter->GetScatterGatherListMemoryUsage(scatterGatherListBytes, scatterGatherListBytesSaved);
+    }
+
+    ULONG64 bounceBufferAverageHoldTime = bouncePoolCounters.NumberOfFrees == 0 ? 0 :
+        bouncePoolCounters.CumulativeHoldTime / bouncePoolCounters.NumberOfFrees;
+
     TraceLoggingWrite(
         g_hNetAdapterCxXlatProvider,
         "TxTranslationCounterUpdates",
@@ -724,6 +1117,26 @@ NxTxXlat::ReportCounters()
         TraceLoggingUInt64(localRBCounters.RingbufferEmptyCount, "numberOfRingbufferEmptySamples"),
         TraceLoggingUInt64(localRBCounters.RingbufferFullyOccupiedCount, "numberOfRingbufferFullSamples"),
         TraceLoggingUInt64(localRBCounters.RingbufferPartiallyOccupiedCount, "numberOfRingbufferPartiallyUsedSamples"),
+        TraceLoggingUInt64Array(occupancy.OsOwnedPackets.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "osOwnedPacketsLog2Histogram"),
+        TraceLoggingUInt32(occupancy.OsOwnedPackets.NumberOfSamples == 0 ? 0 : occupancy.OsOwnedPackets.Minimum, "osOwnedPacketsMinimum"),
+        TraceLoggingUInt32(occupancy.OsOwnedPackets.Maximum, "osOwnedPacketsMaximum"),
+        TraceLoggingUInt32Array(osOwnedPacketsPercentiles, NX_RING_OCCUPANCY_PERCENTILES, "osOwnedPacketsP50P90P99"),
+        TraceLoggingUInt64Array(occupancy.NicOwnedPackets.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "nicOwnedPacketsLog2Histogram"),
+        TraceLoggingUInt32(occupancy.NicOwnedPackets.NumberOfSamples == 0 ? 0 : occupancy.NicOwnedPackets.Minimum, "nicOwnedPacketsMinimum"),
+        TraceLoggingUInt32(occupancy.NicOwnedPackets.Maximum, "nicOwnedPacketsMaximum"),
+        TraceLoggingUInt32Array(nicOwnedPacketsPercentiles, NX_RING_OCCUPANCY_PERCENTILES, "nicOwnedPacketsP50P90P99"),
+        TraceLoggingUInt64Array(occupancy.ReturnedPackets.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "returnedPacketsLog2Histogram"),
+        TraceLoggingUInt32(occupancy.ReturnedPackets.NumberOfSamples == 0 ? 0 : occupancy.ReturnedPackets.Minimum, "returnedPacketsMinimum"),
+        TraceLoggingUInt32(occupancy.ReturnedPackets.Maximum, "returnedPacketsMaximum"),
+        TraceLoggingUInt32Array(returnedPacketsPercentiles, NX_RING_OCCUPANCY_PERCENTILES, "returnedPacketsP50P90P99"),
+        TraceLoggingUInt64Array(occupancy.OsOwnedFragments.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "osOwnedFragmentsLog2Histogram"),
+        TraceLoggingUInt32(occupancy.OsOwnedFragments.NumberOfSamples == 0 ? 0 : occupancy.OsOwnedFragments.Minimum, "osOwnedFragmentsMinimum"),
+        TraceLoggingUInt32(occupancy.OsOwnedFragments.Maximum, "osOwnedFragmentsMaximum"),
+        TraceLoggingUInt32Array(osOwnedFragmentsPercentiles, NX_RING_OCCUPANCY_PERCENTILES, "osOwnedFragmentsP50P90P99"),
+        TraceLoggingUInt64Array(occupancy.NicOwnedFragments.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "nicOwnedFragmentsLog2Histogram"),
+        TraceLoggingUInt32(occupancy.NicOwnedFragments.NumberOfSamples == 0 ? 0 : occupancy.NicOwnedFragments.Minimum, "nicOwnedFragmentsMinimum"),
+        TraceLoggingUInt32(occupancy.NicOwnedFragments.Maximum, "nicOwnedFragmentsMaximum"),
+        TraceLoggingUInt32Array(nicOwnedFragmentsPercentiles, NX_RING_OCCUPANCY_PERCENTILES, "nicOwnedFragmentsP50P90P99"),
         TraceLoggingUInt64(localRBCounters.NumberOfNetPacketsProduced, "totalNumberOfNetpacketsProducedForReceive"),
         TraceLoggingUInt64(localRBCounters.NumberOfNetPacketsConsumed, "totalNumberOfNetpacketsCompletedReceiving"),
         TraceLoggingUInt64(localECCounters.IterationCount, "ecUpdateIterationCount"),
@@ -733,15 +1146,151 @@ NxTxXlat::ReportCounters()
         TraceLoggingUInt64(localECCounters.BusyWaitCycles, "numberOfCpuCyclesPolledWithNoPackets"),
         TraceLoggingUInt64(localECCounters.ProcessingCycles, "numberOfCpuCyclesSpentProcessingPackets"),
         TraceLoggingUInt64(localECCounters.IdleCycles, "numberOfCpuCyclesSleeping"),
+        TraceLoggingUInt64(busyPollCounters.Polls, "busyPollIterations"),
+        TraceLoggingUInt64(busyPollCounters.PollsWithWork, "busyPollRunsThatFoundWork"),
+        TraceLoggingUInt64(busyPollCounters.BudgetExhausted, "busyPollRunsThatExhaustedBudget"),
+        TraceLoggingUInt64(busyPollCounters.SuppressedByPacketRate, "busyPollIdleIterationsBelowPacketRate"),
+        TraceLoggingUInt64(m_busyPoll.GetPacketRate(), "busyPollPacketRate"),
+        TraceLoggingUInt32(static_cast<UINT32>(m_moderation.GetMode()), "notificationMode"),
+        TraceLoggingUInt64(m_moderation.GetPacketRate(), "notificationModerationPacketRate"),
+        TraceLoggingUInt64(moderationCounters.ModeChanges, "notificationModeChanges"),
+        TraceLoggingUInt64(moderationCounters.PollIterations, "notificationModerationPollIterations"),
+        TraceLoggingUInt64(moderationCounters.PollRunsExpired, "notificationModerationPollRunsExpired"),
+        TraceLoggingUInt64(moderationCounters.CoalescingTimerArms, "notificationModerationCoalescingTimerArms"),
         TraceLoggingUInt64(m_CumulativeNBLQueueDepthInLastInterval, "cumulativeNblQueueDepth"),
         TraceLoggingUInt64(m_NBLQueueEmptyCount + m_NBLQueueOccupiedCount, "numberOfNblQueueStateSamples"),
         TraceLoggingUInt64(m_NBLQueueEmptyCount, "numberOfEmptyNblQueueSamples"),
-        TraceLoggingUInt64(m_NBLQueueOccupiedCount, "numberOfOccupiedNblQueueSamples")
+        TraceLoggingUInt64(m_doorbells, "numberOfDoorbells"),
+        TraceLoggingUInt64(m_doorbellPackets, "numberOfPacketsPostedByDoorbells"),
+        TraceLoggingUInt64(m_deferredDoorbells, "numberOfDeferredDoorbells"),
+        TraceLoggingUInt64(m_deferredCompletions, "numberOfDeferredCompletions"),
+        TraceLoggingUInt64(completionBatchSizes.NumberOfSamples, "numberOfCompletionBatches"),
+        TraceLoggingUInt64Array(completionBatchSizes.Buckets, NX_RING_OCCUPANCY_HISTOGRAM_BUCKETS, "completionBatchSizeLog2Histogram"),
+        TraceLoggingUInt32(completionBatchSizes.NumberOfSamples == 0 ? 0 : completionBatchSizes.Minimum, "completionBatchSizeMinimum"),
+        TraceLoggingUInt32(completionBatchSizes.Maximum, "completionBatchSizeMaximum"),
+        TraceLoggingUInt32Array(completionBatchSizePercentiles, NX_RING_OCCUPANCY_PERCENTILES, "completionBatchSizeP50P90P99"),
+        TraceLoggingUInt64(m_NBLQueueOccupiedCount, "numberOfOccupiedNblQueueSamples"),
+        TraceLoggingUInt64(bouncePoolCounters.PoolSize, "bounceBufferPoolSize"),
+        TraceLoggingUInt64(bouncePoolCounters.BuffersInUse, "bounceBuffersInUse"),
+        TraceLoggingUInt64(bouncePoolCounters.BuffersInUseHighWatermark, "bounceBuffersInUseHighWatermark"),
+        TraceLoggingUInt64(bouncePoolCounters.AllocationFailures, "bounceBufferAllocationFailures"),
+        TraceLoggingUInt64Array(bouncePoolCounters.AllocationBatchSizeHistogram, NET_CLIENT_BUFFER_POOL_BATCH_SIZE_BUCKETS, "bounceBufferAllocationBatchSizeLog2Histogram"),
+        TraceLoggingUInt64(bounceBufferAverageHoldTime, "bounceBufferAverageHoldTimeInCycles"),
+        TraceLoggingUInt64(bouncePoolCounters.NumberOfChunks, "bounceBufferPoolNumberOfChunks"),
+        TraceLoggingUInt64(bouncePoolCounters.MinimumChunkOccupancy, "bounceBufferPoolMinimumChunkOccupancy"),
+        TraceLoggingUInt64(bouncePoolCounters.MaximumChunkOccupancy, "bounceBufferPoolMaximumChunkOccupancy"),
+        TraceLoggingUInt64(m_nblTranslationStats.Packet.CopyBreak, "numberOfCopyBreakPackets"),
+        TraceLoggingUInt64(m_nblTranslationStats.Packet.DmaMapped, "numberOfDmaMappedPackets"),
+        TraceLoggingUInt64(m_nblTranslationStats.Packet.PartialBounce, "numberOfPartiallyBouncedPackets"),
+        TraceLoggingUInt64(m_nblTranslationStats.Packet.MultiBufferBounce, "numberOfMultiBufferBouncedPackets"),
+        TraceLoggingUInt32(static_cast<UINT32>(copyEngine.GetVariant()), "copyEngineVariant"),
+        TraceLoggingUInt64(copyEngineCounters.CachedBytes, "copyEngineCachedBytes"),
+        TraceLoggingUInt64(copyEngineCounters.StreamedBytes, "copyEngineStreamedBytes"),
+        TraceLoggingUInt64(copyEngineCounters.ChecksummedBytes, "copyEngineChecksummedBytes"),
+        TraceLoggingUInt64(m_nblTranslationStats.Packet.SoftwareChecksum, "numberOfSoftwareChecksummedPackets"),
+        TraceLoggingUInt64(m_nblTranslationStats.DMA.MappedFromCache, "numberOfPacketsMappedFromCache"),
+        TraceLoggingUInt64(mappingCacheCounters.Hits, "dmaMappingCacheHits"),
+        TraceLoggingUInt64(mappingCacheCounters.Misses, "dmaMappingCacheMisses"),
+        TraceLoggingUInt64(mappingCacheCounters.Evictions, "dmaMappingCacheEvictions"),
+        TraceLoggingUInt64(mappingCacheCounters.MapFailures, "dmaMappingCacheMapFailures"),
+        TraceLoggingUInt64(mappingCacheCounters.CacheFull, "dmaMappingCacheFull"),
+        TraceLoggingUInt64(mappingCacheCounters.NotAdmitted, "dmaMappingCacheNotAdmitted"),
+        TraceLoggingUInt64(scatterGatherListBytes, "scatterGatherListArenaBytes"),
+        TraceLoggingInt64(scatterGatherListBytesSaved, "scatterGatherListArenaBytesSaved")
     );
 
+    if (m_latencyTracker)
+    {
+        auto const & enqueueToTranslate = m_latencyTracker->GetHistogram(NxLatencyInterval::EnqueueToTranslate);
+        ULONG64 enqueueToTranslatePercentiles[NX_LATENCY_PERCENTILES];
+        enqueueToTranslate.GetReportedPercentiles(enqueueToTranslatePercentiles);
+        auto const & translateToPost = m_latencyTracker->GetHistogram(NxLatencyInterval::TranslateToPost);
+        ULONG64 translateToPostPercentiles[NX_LATENCY_PERCENTILES];
+        translateToPost.GetReportedPercentiles(translateToPostPercentiles);
+        auto const & postToReturn = m_latencyTracker->GetHistogram(NxLatencyInterval::PostToReturn);
+        ULONG64 postToReturnPercentiles[NX_LATENCY_PERCENTILES];
+        postToReturn.GetReportedPercentiles(postToReturnPercentiles);
+        auto const & returnToCompletion = m_latencyTracker->GetHistogram(NxLatencyInterval::ReturnToCompletion);
+        ULONG64 returnToCompletionPercentiles[NX_LATENCY_PERCENTILES];
+        returnToCompletion.GetReportedPercentiles(returnToCompletionPercentiles);
+        auto const & enqueueToCompletion = m_latencyTracker->GetHistogram(NxLatencyInterval::EnqueueToCompletion);
+        ULONG64 enqueueToCompletionPercentiles[NX_LATENCY_PERCENTILES];
+        enqueueToCompletion.GetReportedPercentiles(enqueueToCompletionPercentiles);
+
+        TraceLoggingWrite(
+            g_hNetAdapterCxXlatProvider,
+            "TxLatencyCounterUpdates",
+            TraceLoggingDescription("TX sampled packet latency event"),
+            TraceLoggingUInt32(m_executionContext.GetExecutionContextIdentifier(), "threadID"),
+            TraceLoggingUInt64(enqueueToTranslate.NumberOfSamples, "enqueueToTranslateSamples"),
+            TraceLoggingUInt64(enqueueToTranslate.Maximum, "enqueueToTranslateMaximumNs"),
+            TraceLoggingUInt64Array(enqueueToTranslatePercentiles, NX_LATENCY_PERCENTILES, "enqueueToTranslateP50P90P99P999Ns"),
+            TraceLoggingUInt64Array(enqueueToTranslate.Buckets, NX_LATENCY_HISTOGRAM_BUCKETS, "enqueueToTranslateHistogram"),
+            TraceLoggingUInt64(translateToPost.NumberOfSamples, "translateToPostSamples"),
+            TraceLoggingUInt64(translateToPost.Maximum, "translateToPostMaximumNs"),
+            TraceLoggingUInt64Array(translateToPostPercentiles, NX_LATENCY_PERCENTILES, "translateToPostP50P90P99P999Ns"),
+            TraceLoggingUInt64Array(translateToPost.Buckets, NX_LATENCY_HISTOGRAM_BUCKETS, "translateToPostHistogram"),
+            TraceLoggingUInt64(postToReturn.NumberOfSamples, "postToReturnSamples"),
+            TraceLoggingUInt64(postToReturn.Maximum, "postToReturnMaximumNs"),
+            TraceLoggingUInt64Array(postToReturnPercentiles, NX_LATENCY_PERCENTILES, "postToReturnP50P90P99P999Ns"),
+            TraceLoggingUInt64Array(postToReturn.Buckets, NX_LATENCY_HISTOGRAM_BUCKETS, "postToReturnHistogram"),
+            TraceLoggingUInt64(returnToCompletion.NumberOfSamples, "returnToCompletionSamples"),
+            TraceLoggingUInt64(returnToCompletion.Maximum, "returnToCompletionMaximumNs"),
+            TraceLoggingUInt64Array(returnToCompletionPercentiles, NX_LATENCY_PERCENTILES, "returnToCompletionP50P90P99P999Ns"),
+            TraceLoggingUInt64Array(returnToCompletion.Buckets, NX_LATENCY_HISTOGRAM_BUCKETS, "returnToCompletionHistogram"),
+            TraceLoggingUInt64(enqueueToCompletion.NumberOfSamples, "enqueueToCompletionSamples"),
+            TraceLoggingUInt64(enqueueToCompletion.Maximum, "enqueueToCompletionMaximumNs"),
+            TraceLoggingUInt64Array(enqueueToCompletionPercentiles, NX_LATENCY_PERCENTILES, "enqueueToCompletionP50P90P99P999Ns"),
+            TraceLoggingUInt64Array(enqueueToCompletion.Buckets, NX_LATENCY_HISTOGRAM_BUCKETS, "enqueueToCompletionHistogram")
+        );
+
+        m_latencyTracker->ResetHistograms();
+    }
+
+#if XLAT_STAGE_CYCLE_COUNTERS
+    auto const pollNetBufferLists = m_stageCounters.GetCounters(NxTxStage::PollNetBufferLists);
+    auto const translateNbls = m_stageCounters.GetCounters(NxTxStage::TranslateNbls);
+    auto const yieldToNetAdapter = m_stageCounters.GetCounters(NxTxStage::YieldToNetAdapter);
+    auto const drainCompletions = m_stageCounters.GetCounters(NxTxStage::DrainCompletions);
+    m_stageCounters.ResetCounters();
+
+    // Polling moves NBLs rather than packets, charge it per packet translated
+    auto const pollCyclesPerPacket = translateNbls.Packets == 0 ? 0 :
+        pollNetBufferLists.Cycles / translateNbls.Packets;
+
+    TraceLoggingWrite(
+        g_hNetAdapterCxXlatProvider,
+        "TxStageCycleCounterUpdates",
+        TraceLoggingDescription("TX per-stage cycle counter event"),
+        TraceLoggingUInt32(m_executionContext.GetExecutionContextIdentifier(), "threadID"),
+        TraceLoggingUInt64(pollNetBufferLists.Cycles, "pollNetBufferListsCycles"),
+        TraceLoggingUInt64(pollCyclesPerPacket, "pollNetBufferListsCyclesPerPacket"),
+        TraceLoggingUInt64(translateNbls.Cycles, "translateNblsCycles"),
+        TraceLoggingUInt64(translateNbls.Packets, "translateNblsPackets"),
+        TraceLoggingUInt64(translateNbls.GetCyclesPerPacket(), "translateNblsCyclesPerPacket"),
+        TraceLoggingUInt64(yieldToNetAdapter.Cycles, "yieldToNetAdapterCycles"),
+        TraceLoggingUInt64(yieldToNetAdapter.Packets, "yieldToNetAdapterPackets"),
+        TraceLoggingUInt64(yieldToNetAdapter.GetCyclesPerPacket(), "yieldToNetAdapterCyclesPerPacket"),
+        TraceLoggingUInt64(drainCompletions.Cycles, "drainCompletionsCycles"),
+        TraceLoggingUInt64(drainCompletions.Packets, "drainCompletionsPackets"),
+        TraceLoggingUInt64(drainCompletions.GetCyclesPerPacket(), "drainCompletionsCyclesPerPacket")
+    );
+#endif
+
     m_CumulativeNBLQueueDepthInLastInterval = 0;
     m_IterationCountInLastInterval = 0;
     m_NBLQueueEmptyCount = 0;
     m_NBLQueueOccupiedCount = 0;
+    m_doorbells = 0;
+    m_doorbellPackets = 0;
+    m_deferredDoorbells = 0;
+    m_deferredCompletions = 0;
+    m_nblTranslationStats.Packet.CopyBreak = 0;
+    m_nblTranslationStats.Packet.DmaMapped = 0;
+    m_nblTranslationStats.Packet.PartialBounce = 0;
+    m_nblTranslationStats.Packet.MultiBufferBounce = 0;
+    m_nblTranslationStats.Packet.SoftwareChecksum = 0;
+    m_nblTranslationStats.DMA.MappedFromCache = 0;
+    copyEngine.ResetCounters();
 }
 
@@ -13,7 +13,7 @@ Abstract:
 
 #include <NetClientAdapter.h>
 
-#include "NxExecutionContext.hpp"
+#include "NxQueueScheduler.hpp"
 #include "NxSignal.hpp"
 #include "NxRingBuffer.hpp"
 #include "NxContextBuffer.hpp"
@@ -22,9 +22,23 @@ Abstract:
 #include "NxNblTranslation.hpp"
 #include "NxDma.hpp"
 #include "NxPerfTuner.hpp"
+#include "NxStageCounters.hpp"
+#include "NxBusyPoll.hpp"
+#include "NxNotificationModeration.hpp"
+#include "NxLatencyTracker.hpp"
+
+enum class NxTxStage
+{
+    PollNetBufferLists,
+    TranslateNbls,
+    YieldToNetAdapter,
+    DrainCompletions,
+    Count
+};
 
 class NxTxXlat :
     public INxNblTx,
+    public INxExecutionContextQueue,
     public NxNonpagedAllocation<'xTxN'>
 {
 public:
@@ -51,7 +65,7 @@ public:
     _IRQL_requires_(PASSIVE_LEVEL)
     NTSTATUS
     Initialize(
-        void
+        _In_opt_ INxQueueScheduler * QueueScheduler
         );
 
     _IRQL_requires_(PASSIVE_LEVEL)
@@ -95,6 +109,46 @@ public:
         _In_ ULONG SendFlags
         );
 
+    //
+    // INxExecutionContextQueue
+    //
+
+    virtual
+    void
+    SetupThreadProperties(
+        void
+        );
+
+    virtual
+    void
+    EcStart(
+        void
+        );
+
+    virtual
+    void
+    EcRunIteration(
+        void
+        );
+
+    virtual
+    bool
+    EcPrepareToHalt(
+        void
+        );
+
+    virtual
+    void
+    EcResumeFromHalt(
+        void
+        );
+
+    virtual
+    bool
+    EcWindDown(
+        void
+        );
+
     void
     ReportCounters();
 
@@ -127,6 +181,9 @@ private:
     NxBounceBufferPool m_bounceBufferPool;
     wistd::unique_ptr<NxDmaAdapter> m_dmaAdapter;
 
+    // only allocated when packet latency sampling is enabled
+    wistd::unique_ptr<NxLatencyTracker> m_latencyTracker;
+
     //
     // Datapath variables
     // All below will change as TransmitThread runs
@@ -134,16 +191,57 @@ private:
     NET_BUFFER_LIST *m_currentNbl = nullptr;
     NET_BUFFER *m_currentNetBuffer = nullptr;
 
-    // These are used to determine when to arm notifications
-    // and halt queue operation
-    bool m_producedPackets = false;
-    bool m_completedPackets = false;
+    // Number of packets moved in the last iteration, used to determine
+    // when to arm notifications and halt queue operation
+    UINT32 m_producedPackets = 0;
+    UINT32 m_completedPackets = 0;
+
+    // Set once the adapter queue has been cancelled during wind down
+    bool m_cancelIssued = false;
+
+    // Deferred doorbells. The adapter is only advanced once enough packets
+    // have accumulated, or there is nothing more to send right away, or
+    // the first deferred packet has waited for the whole budget. A batch
+    // of at most one packet or a zero budget rings the doorbell right away.
+    UINT32 m_doorbellBatchPackets = 0;
+    ULONG64 m_doorbellBudgetInTicks = 0;
+    ULONG64 m_doorbellDeferralStart = 0;
+
+    // EndIndex as of the last Advance, packets past it haven't been seen
+    // by the adapter yet
+    UINT32 m_postedEndIndex = 0;
+
+    // Deferred completions. Completed NBLs are held back until enough of
+    // them have accumulated or the first one has waited for the whole
+    // budget, and are always given back before the EC halts. A batch of at
+    // most one NBL or a zero budget completes them immediately.
+    UINT32 m_completionBatchNbls = 0;
+    ULONG64 m_completionBudgetInTicks = 0;
+    ULONG64 m_completionDeferralStart = 0;
+    NET_BUFFER_LIST *m_pendingCompletionChain = nullptr;
+    NET_BUFFER_LIST *m_pendingCompletionTail = nullptr;
+    UINT32 m_pendingCompletionNbls = 0;
+
+    size_t m_copyBreakThreshold = 0;
+
+    bool m_bounceChecksum = false;
+
+    size_t m_nblPrefetchDistance = 0;
+
+    NxStageCycleCounters<NxTxStage, static_cast<size_t>(NxTxStage::Count)> m_stageCounters;
 
     // Tx translation specific counters
     ULONG64 m_CumulativeNBLQueueDepthInLastInterval = 0;
     ULONG64 m_IterationCountInLastInterval = 0;
     ULONG64 m_NBLQueueEmptyCount = 0;
     ULONG64 m_NBLQueueOccupiedCount = 0;
+    ULONG64 m_doorbells = 0;
+    ULONG64 m_doorbellPackets = 0;
+    ULONG64 m_deferredDoorbells = 0;
+    ULONG64 m_deferredCompletions = 0;
+
+    // Number of NBLs given back by each SendNetBufferListsComplete call
+    NxRingOccupancyHistogram m_completionBatchSizes;
 
 #ifdef _KERNEL_MODE
     KTIMER m_CounterReportTimer;
@@ -158,7 +256,8 @@ private:
             {
                 bool ShouldArmTxCompletion : 1;
                 bool ShouldArmNblArrival : 1;
-                UINT8 Reserved : 6;
+                bool ShouldArmCoalescingTimer : 1;
+                UINT8 Reserved : 5;
             } Flags;
 
             UINT8 Value = 0;
@@ -181,12 +280,25 @@ private:
     void
     DrainCompletions();
 
+    bool
+    ShouldDeferCompletions(
+        void
+        );
+
+    void
+    FlushCompletions();
+
     void
     TranslateNbls();
 
     void
     YieldToNetAdapter();
 
+    bool
+    ShouldDeferDoorbell(
+        _In_ UINT32 UnpostedPackets
+        );
+
     void
     WaitForWork();
 
@@ -219,9 +331,6 @@ private:
         ULONG ExtensionVersion
         ) const;
 
-    void
-    SetupTxThreadProperties();
-
     void
     UpdateTxTranslationSpecificCounters();
 
@@ -229,6 +338,9 @@ private:
     ULONG m_counterReportInterval = 0;
     bool m_shouldUpdateEcCounters = false;
 
+    NxBusyPoll m_busyPoll;
+    NxNotificationModeration m_moderation;
+
 #ifdef  _KERNEL_MODE
     static
     KDEFERRED_ROUTINE CounterReportDpcRoutine;
@@ -27,6 +27,30 @@ Abstract:
 using unique_nbl = wistd::unique_ptr<NET_BUFFER_LIST, wil::function_deleter<decltype(&NdisFreeNetBufferList), NdisFreeNetBufferList>>;
 using unique_nbl_pool = wil::unique_any<NDIS_HANDLE, decltype(&::NdisFreeNetBufferListPool), &::NdisFreeNetBufferListPool>;
 
+__inline
+ULONG64
+NxQueryPerformanceCounter(
+    _Out_opt_ ULONG64 *Frequency
+)
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+#if _KERNEL_MODE
+    counter = KeQueryPerformanceCounter(&frequency);
+#else
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+#endif
+
+    if (Frequency)
+    {
+        *Frequency = static_cast<ULONG64>(frequency.QuadPart);
+    }
+
+    return static_cast<ULONG64>(counter.QuadPart);
+}
+
 __inline
 UINT32
 NetRingBufferIncrementIndexByCount(